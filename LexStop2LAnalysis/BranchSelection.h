@@ -0,0 +1,44 @@
+////////////////////////////////////////////////////////////////////////////////
+/// Copyright (c) <2018> by Alex Armstrong
+///
+/// @file BranchSelection.h
+/// @author Alex Armstrong (alarmstr@cern.ch)
+/// @date <December 2018>
+/// @brief Whitelist of output branch names
+///
+/// Patterns are output (HFT) branch names with optional shell-style
+/// wildcards, e.g. "sigLep*" or "dR_?jet_lep". They are read from a file, one
+/// per line with '#' starting a comment, or from a comma separated list.
+/// An empty selection accepts every branch.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef LEXSTOP2LANALYSIS_BRANCHSELECTION_H
+#define LEXSTOP2LANALYSIS_BRANCHSELECTION_H
+
+#include <string>
+#include <vector>
+
+class BranchSelection {
+  public:
+    // Returns false if the file cannot be read
+    bool read_file(const std::string& file_name);
+    void add_patterns(const std::string& comma_separated_list);
+    void add_pattern(const std::string& pattern);
+
+    bool empty() const { return m_patterns.empty(); }
+    size_t size() const { return m_patterns.size(); }
+
+    // Returns true if branch matches any pattern (or there are none)
+    // and counts the match against the pattern
+    bool accept(const std::string& branch);
+
+    // Patterns that have not matched any branch yet
+    std::vector<std::string> unmatched_patterns() const;
+
+  private:
+    std::vector<std::string> m_patterns;
+    std::vector<unsigned> m_n_matches; // per pattern
+};
+
+#endif // LEXSTOP2LANALYSIS_BRANCHSELECTION_H
@@ -0,0 +1,61 @@
+////////////////////////////////////////////////////////////////////////////////
+/// Copyright (c) <2018> by Alex Armstrong
+///
+/// @file FastMath.h
+/// @author Alex Armstrong (alarmstr@cern.ch)
+/// @date <December 2018>
+/// @brief Polynomial approximations for the object kinematics conversion
+///
+/// Once objects are converted to Stop2L::PtEtaPhiM, the angular variables and
+/// transverse masses are plain arithmetic and the only transcendental calls
+/// left per object are the atan2 for phi and the log for eta. fast_atan2
+/// replaces the first with a fixed degree polynomial (Chebyshev fit, no
+/// branches on the signs) whose absolute error is well below the float
+/// precision of the output branches. It is used by make_px_py_pz_e_fast,
+/// which SuperflowAnaStop2L uses with --fast-math. The log is left to the
+/// math library, whose table driven version is faster than a polynomial of
+/// the same accuracy.
+///
+/// FastMathReport histograms the difference between fast and exact results so
+/// the approximation can be checked on a validation sample.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef LEXSTOP2LANALYSIS_FASTMATH_H
+#define LEXSTOP2LANALYSIS_FASTMATH_H
+
+#include "LexStop2LAnalysis/PtEtaPhiM.h"
+
+#include <array>
+#include <string>
+
+namespace Stop2L {
+
+// Maximum absolute error, checked over the full circle by benchFastMath
+const double FAST_ATAN2_MAX_ERROR = 3e-10; // rad
+
+double fast_atan2(double y, double x);
+
+class FastMathReport {
+  public:
+    enum Quantity { PHI = 0, ETA, MT, DPHI, DR, N_QUANTITY };
+    // |diff| histogram bins: exact, one per decade from 1e-14 to 1e-6, above
+    static const int MIN_DECADE = -14;
+    static const int MAX_DECADE = -6;
+    static const int N_BINS = MAX_DECADE - MIN_DECADE + 2;
+
+    FastMathReport();
+    void fill(Quantity q, double fast, double exact);
+    void add(const FastMathReport& other);
+    long long n_entries() const;
+    // One row per quantity, each line starting with prefix
+    void print(const std::string& prefix) const;
+
+  private:
+    std::array<std::array<long long, N_BINS>, N_QUANTITY> m_counts;
+    std::array<double, N_QUANTITY> m_max_diff;
+};
+
+} // namespace Stop2L
+
+#endif // LEXSTOP2LANALYSIS_FASTMATH_H
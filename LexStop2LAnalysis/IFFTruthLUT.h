@@ -0,0 +1,51 @@
+////////////////////////////////////////////////////////////////////////////////
+/// Copyright (c) <2018> by Alex Armstrong
+///
+/// @file IFFTruthLUT.h
+/// @author Alex Armstrong (alarmstr@cern.ch)
+/// @date <December 2018>
+/// @brief Lookup table of IFF truth classes
+///
+/// IFFTruthClassifier only depends on the lepton flavor, charge and five
+/// truth integers (truthType, truthOrigin and the first e/gamma mother type,
+/// origin and pdgId). The table maps those inputs, packed into a single key,
+/// to the IFF class so the classifier and its xAOD inputs are only needed the
+/// first time a combination is seen.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef LEXSTOP2LANALYSIS_IFFTRUTHLUT_H
+#define LEXSTOP2LANALYSIS_IFFTRUTHLUT_H
+
+#include <cstdint>
+#include <unordered_map>
+
+#include "IFFTruthClassifier/IFFTruthClassifierDefs.h"
+
+class IFFTruthLUT {
+  public:
+    IFFTruthLUT();
+
+    // Pack the classifier inputs into a key
+    // Returns false if an input is outside the packed range, in which case
+    // the lepton should be classified directly
+    static bool make_key(bool is_electron, int charge,
+                         int truth_type, int truth_origin,
+                         int mother_type, int mother_origin, int mother_pdgId,
+                         uint64_t& key);
+
+    // Returns true and sets type if the key is in the table
+    bool find(uint64_t key, IFF::Type& type);
+    void insert(uint64_t key, IFF::Type type);
+
+    size_t size() const { return m_table.size(); }
+    uint64_t n_hits() const { return m_n_hits; }
+    uint64_t n_misses() const { return m_n_misses; }
+
+  private:
+    std::unordered_map<uint64_t, IFF::Type> m_table;
+    uint64_t m_n_hits;
+    uint64_t m_n_misses;
+};
+
+#endif // LEXSTOP2LANALYSIS_IFFTRUTHLUT_H
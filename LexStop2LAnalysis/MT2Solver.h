@@ -0,0 +1,61 @@
+////////////////////////////////////////////////////////////////////////////////
+/// Copyright (c) <2018> by Alex Armstrong
+///
+/// @file MT2Solver.h
+/// @author Alex Armstrong (alarmstr@cern.ch)
+/// @date <December 2018>
+/// @brief Stransverse mass for massless visible and invisible particles
+///
+/// With massless particles the regions of invisible momenta giving
+/// mT <= M are parabolas that scale with M^2, and MT2 follows from their
+/// support functions as a maximum over transverse directions u:
+///
+///   MT2^2 = 4 max_u (u.pmiss)(u.p1)(u.p2) / -(u.p1 + u.p2)
+///
+/// taken over the arc where u.p1 < 0, u.p2 < 0 and u.pmiss > 0 (MT2 = 0 if
+/// the arc is empty). The function is unimodal on the arc, so a fixed number
+/// of golden section steps replaces the bisection and conic intersection
+/// tests of the general solvers. The number of steps follows from the
+/// requested relative precision on MT2.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef LEXSTOP2LANALYSIS_MT2SOLVER_H
+#define LEXSTOP2LANALYSIS_MT2SOLVER_H
+
+#include <cstddef>
+
+namespace Stop2L {
+
+class MT2Solver {
+  public:
+    static constexpr double DEFAULT_PRECISION = 1e-6;
+
+    explicit MT2Solver(double precision = DEFAULT_PRECISION);
+
+    // Relative precision on MT2, non-positive values give the default
+    void set_precision(double precision);
+    double precision() const { return m_precision; }
+    int n_steps() const { return m_n_steps; }
+
+    // Transverse momenta of the two visible particles and of the missing
+    // momentum. Visible masses are neglected.
+    double mt2(double p1x, double p1y, double p2x, double p2y,
+               double pmx, double pmy) const;
+
+    // Batch interface over n events stored as flat arrays. Events are solved
+    // in blocks with the golden section steps innermost over events, so the
+    // step loop has no per-event branches and vectorizes.
+    void mt2(const double* p1x, const double* p1y,
+             const double* p2x, const double* p2y,
+             const double* pmx, const double* pmy,
+             size_t n, double* out) const;
+
+  private:
+    double m_precision;
+    int m_n_steps;
+};
+
+} // namespace Stop2L
+
+#endif // LEXSTOP2LANALYSIS_MT2SOLVER_H
@@ -0,0 +1,44 @@
+////////////////////////////////////////////////////////////////////////////////
+/// Copyright (c) <2018> by Alex Armstrong
+///
+/// @file NearestDistances.h
+/// @author Alex Armstrong (alarmstr@cern.ch)
+/// @date <December 2018>
+/// @brief Minimum dR, dPhi and dEta between leptons and nearby objects
+///
+/// For every lepton, a single pass over flat eta/phi arrays gives the
+/// distance to the closest other lepton, jet, b-jet and non b-jet. The results
+/// reproduce the TLorentzVector based loops they replace: differences are
+/// taken as candidate minus lepton, dPhi is wrapped like
+/// TVector2::Phi_mpi_pi, each distance is rounded to float precision and
+/// DBL_MAX is returned when there is no candidate.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef LEXSTOP2LANALYSIS_NEARESTDISTANCES_H
+#define LEXSTOP2LANALYSIS_NEARESTDISTANCES_H
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+namespace Stop2L {
+
+struct NearestDistances {
+    enum Target { LEP = 0, JET, BJET, NONBJET, N_TARGET };
+
+    // [target][lepton index]
+    std::array<std::vector<double>, N_TARGET> dR;
+    std::array<std::vector<double>, N_TARGET> dPhi;
+    std::array<std::vector<double>, N_TARGET> dEta;
+};
+
+// jet_isB: 1 for b-jets, 0 otherwise
+void nearest_distances(const double* lep_eta, const double* lep_phi, size_t n_leps,
+                       const double* jet_eta, const double* jet_phi,
+                       const unsigned char* jet_isB, size_t n_jets,
+                       NearestDistances& out);
+
+} // namespace Stop2L
+
+#endif // LEXSTOP2LANALYSIS_NEARESTDISTANCES_H
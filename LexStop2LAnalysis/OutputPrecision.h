@@ -0,0 +1,58 @@
+////////////////////////////////////////////////////////////////////////////////
+/// Copyright (c) <2018> by Alex Armstrong
+///
+/// @file OutputPrecision.h
+/// @author Alex Armstrong (alarmstr@cern.ch)
+/// @date <December 2018>
+/// @brief Reduced precision of floating point output variables
+///
+/// Superflow fixes the branch type of each variable kind, so precision is
+/// reduced in the values instead: float variables are rounded to float32 and
+/// optionally to fewer mantissa bits. The dropped low bits are zero in every
+/// entry, which ROOT compression removes almost entirely.
+///
+/// Rules are "pattern:bits" pairs, with shell-style wildcards in the branch
+/// pattern and 0-23 mantissa bits kept (23 is plain float32). The first
+/// matching rule applies.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef LEXSTOP2LANALYSIS_OUTPUTPRECISION_H
+#define LEXSTOP2LANALYSIS_OUTPUTPRECISION_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Stop2L {
+
+const int FLOAT_MANTISSA_BITS = 23;
+
+// Keep the n_bits most significant explicit mantissa bits of x, rounding to
+// nearest. Infinities and NaN are returned unchanged.
+float truncate_mantissa(float x, int n_bits);
+
+// Round x to float32 with n_bits of mantissa. Values outside the float
+// range, such as the +/-DBL_MAX defaults of empty variables, are unchanged.
+double round_output(double x, int n_bits);
+
+class OutputPrecision {
+  public:
+    // Round every float variable without a rule to float32
+    void set_float32(bool float32) { m_float32 = float32; }
+    // Comma separated "pattern:bits" list
+    // Returns false if a rule is malformed
+    bool add_rules(const std::string& comma_separated_list);
+
+    // Mantissa bits kept for the branch, -1 if it is written unchanged
+    int mantissa_bits(const std::string& branch) const;
+    bool empty() const { return !m_float32 && m_rules.empty(); }
+
+  private:
+    bool m_float32 = false;
+    std::vector< std::pair<std::string, int> > m_rules;
+};
+
+} // namespace Stop2L
+
+#endif // LEXSTOP2LANALYSIS_OUTPUTPRECISION_H
@@ -0,0 +1,77 @@
+////////////////////////////////////////////////////////////////////////////////
+/// Copyright (c) <2018> by Alex Armstrong
+///
+/// @file PtEtaPhiM.h
+/// @author Alex Armstrong (alarmstr@cern.ch)
+/// @date <December 2018>
+/// @brief Plain four-momentum with cached collider kinematics
+///
+/// TLorentzVector stores (px, py, pz, E) and recomputes eta and phi with
+/// transcendental calls on every access. PtEtaPhiM is converted once, when an
+/// object is read in, and keeps pt, eta, phi, m and the direction cosines of
+/// phi so that angular differences and transverse masses are plain
+/// arithmetic. It is trivially copyable and can be kept in flat vectors.
+///
+/// The conversion and the angular differences follow the TLorentzVector
+/// accessors (Pt, Eta, Phi, M, DeltaPhi, DeltaR), so the values match the
+/// TLorentzVector based code they replace.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef LEXSTOP2LANALYSIS_PTETAPHIM_H
+#define LEXSTOP2LANALYSIS_PTETAPHIM_H
+
+#include <cmath>
+#include <type_traits>
+
+namespace Stop2L {
+
+struct PtEtaPhiM {
+    double pt, eta, phi, m;
+    double cos_phi, sin_phi;
+
+    double px() const { return pt * cos_phi; }
+    double py() const { return pt * sin_phi; }
+};
+static_assert(std::is_trivially_copyable<PtEtaPhiM>::value,
+              "PtEtaPhiM must stay a plain struct");
+
+// Same as TLorentzVector::SetPxPyPzE followed by Pt(), Eta(), Phi() and M()
+PtEtaPhiM make_px_py_pz_e(double px, double py, double pz, double e);
+// Same with phi from Stop2L::fast_atan2, see FastMath.h
+PtEtaPhiM make_px_py_pz_e_fast(double px, double py, double pz, double e);
+
+// Same as a.DeltaPhi(b) for TLorentzVectors, in [-pi, pi)
+inline double delta_phi(const PtEtaPhiM& a, const PtEtaPhiM& b) {
+    double x = a.phi - b.phi;
+    x = x >= M_PI ? x - 2 * M_PI : x;
+    x = x < -M_PI ? x + 2 * M_PI : x;
+    return x;
+}
+// Same as a.DeltaR(b) for TLorentzVectors
+inline double delta_r(const PtEtaPhiM& a, const PtEtaPhiM& b) {
+    double deta = a.eta - b.eta;
+    double dphi = delta_phi(a, b);
+    return std::sqrt(deta * deta + dphi * dphi);
+}
+// cos(a.phi - b.phi) from the cached direction cosines
+inline double cos_delta_phi(const PtEtaPhiM& a, const PtEtaPhiM& b) {
+    return a.cos_phi * b.cos_phi + a.sin_phi * b.sin_phi;
+}
+// sin(a.phi - b.phi) from the cached direction cosines
+inline double sin_delta_phi(const PtEtaPhiM& a, const PtEtaPhiM& b) {
+    return a.sin_phi * b.cos_phi - a.cos_phi * b.sin_phi;
+}
+// Transverse mass of two massless objects. For nearly collinear objects
+// 1 - cos(dPhi) is taken as sin^2(dPhi) / (1 + cos(dPhi)) to avoid the
+// cancellation.
+inline double transverse_mass(const PtEtaPhiM& a, const PtEtaPhiM& b) {
+    double c = cos_delta_phi(a, b);
+    double s = sin_delta_phi(a, b);
+    double one_minus_cos = c > 0 ? s * s / (1 + c) : 1 - c;
+    return std::sqrt(2 * a.pt * b.pt * one_minus_cos);
+}
+
+} // namespace Stop2L
+
+#endif // LEXSTOP2LANALYSIS_PTETAPHIM_H
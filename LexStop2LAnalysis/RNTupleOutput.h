@@ -0,0 +1,33 @@
+////////////////////////////////////////////////////////////////////////////////
+/// Copyright (c) <2018> by Alex Armstrong
+///
+/// @file RNTupleOutput.h
+/// @author Alex Armstrong (alarmstr@cern.ch)
+/// @date <December 2018>
+/// @brief RNTuple output format for the flat ntuples
+///
+/// Superflow writes its output as TTrees, so the RNTuple format is made by
+/// converting the finished output file: every tree becomes an RNTuple of the
+/// same name whose fields are named like the branches (the HFTnames). Other
+/// objects in the file, such as the cutflow histograms, are copied as they
+/// are. RNTuple needs ROOT 6.28 or newer; with older releases
+/// rntuple_output_supported() is false and conversion fails.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef LEXSTOP2LANALYSIS_RNTUPLEOUTPUT_H
+#define LEXSTOP2LANALYSIS_RNTUPLEOUTPUT_H
+
+#include <string>
+
+namespace Stop2L {
+
+bool rntuple_output_supported();
+
+// Replace the trees in file_name by RNTuples, in place. Returns false and
+// leaves the file untouched if any tree fails to convert.
+bool convert_to_rntuple(const std::string& file_name);
+
+} // namespace Stop2L
+
+#endif // LEXSTOP2LANALYSIS_RNTUPLEOUTPUT_H
@@ -0,0 +1,132 @@
+////////////////////////////////////////////////////////////////////////////////
+/// Copyright (c) <2018> by Alex Armstrong
+///
+/// @file TriggerBits.h
+/// @author Alex Armstrong (alarmstr@cern.ch)
+/// @date <December 2018>
+/// @brief Lepton trigger codes of SuperflowAnaStop2L and decoding of its
+///        packed trigger output
+///
+/// With --packed-triggers the flat ntuples store two trigger branches:
+///   trigPassBits : bit i is set if the trigger with code i passed the
+///                  analysis trigger strategy (fired, matched to the trigger
+///                  leptons and above the offline pT thresholds)
+///   firedTrig    : code of the first trigger that passed, 0 if none
+///
+/// Example:
+///   if (Stop2L::pass_trig(trigPassBits, Stop2L::Trig::lepTrigs)) {...}
+///   cout << Stop2L::trig_name(firedTrig) << '\n';
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef LEXSTOP2LANALYSIS_TRIGGERBITS_H
+#define LEXSTOP2LANALYSIS_TRIGGERBITS_H
+
+#include <array>
+#include <cstddef>
+#include <string>
+
+namespace Stop2L {
+
+// Trigger codes. These are written to the output so they must not change.
+enum class Trig : unsigned int {
+    none = 0,
+    HLT_e120_lhloose,
+    HLT_e60_lhmedium,
+    HLT_e24_lhmedium_L1EM20VH,
+    HLT_e140_lhloose_nod0,
+    HLT_e60_lhmedium_nod0,
+    HLT_e26_lhtight_nod0_ivarloose,
+    HLT_mu40,
+    HLT_mu20_iloose_L1MU15,
+    HLT_mu50,
+    HLT_mu26_ivarmedium,
+    HLT_2e12_lhloose_L12EM10VH,
+    HLT_2e17_lhvloose_nod0,
+    HLT_2e24_lhvloose_nod0,
+    HLT_2e17_lhvloose_nod0_L12EM15VHI,
+    HLT_mu18_mu8noL1,
+    HLT_2mu10,
+    HLT_mu22_mu8noL1,
+    HLT_2mu14,
+    HLT_e17_lhloose_mu14,
+    HLT_e7_lhmedium_mu24,
+    HLT_e26_lhmedium_nod0_L1EM22VHI_mu8noL1,
+    HLT_e17_lhloose_nod0_mu14,
+    HLT_e7_lhmedium_nod0_mu24,
+    HLT_e26_lhmedium_nod0_mu8noL1,
+    // Combined triggers (any single lepton, any dilepton, either)
+    singleLepTrigs,
+    dilepTrigs,
+    lepTrigs,
+    N
+};
+const std::size_t N_TRIG = static_cast<std::size_t>(Trig::N);
+static_assert(N_TRIG <= 31, "trigPassBits is stored in a signed 32-bit branch");
+
+// Names indexed by trigger code, matching the unpacked output branch names
+inline const std::array<std::string, N_TRIG>& trig_names() {
+    static const std::array<std::string, N_TRIG> names = {{
+        "",
+        "HLT_e120_lhloose",
+        "HLT_e60_lhmedium",
+        "HLT_e24_lhmedium_L1EM20VH",
+        "HLT_e140_lhloose_nod0",
+        "HLT_e60_lhmedium_nod0",
+        "HLT_e26_lhtight_nod0_ivarloose",
+        "HLT_mu40",
+        "HLT_mu20_iloose_L1MU15",
+        "HLT_mu50",
+        "HLT_mu26_ivarmedium",
+        "HLT_2e12_lhloose_L12EM10VH",
+        "HLT_2e17_lhvloose_nod0",
+        "HLT_2e24_lhvloose_nod0",
+        "HLT_2e17_lhvloose_nod0_L12EM15VHI",
+        "HLT_mu18_mu8noL1",
+        "HLT_2mu10",
+        "HLT_mu22_mu8noL1",
+        "HLT_2mu14",
+        "HLT_e17_lhloose_mu14",
+        "HLT_e7_lhmedium_mu24",
+        "HLT_e26_lhmedium_nod0_L1EM22VHI_mu8noL1",
+        "HLT_e17_lhloose_nod0_mu14",
+        "HLT_e7_lhmedium_nod0_mu24",
+        "HLT_e26_lhmedium_nod0_mu8noL1",
+        "passSingleLepTrigs",
+        "passDilepTrigs",
+        "passLepTrigs"
+    }};
+    return names;
+}
+
+// Name of a trigger code, empty if the code is unknown or none
+inline const std::string& trig_name(int code) {
+    static const std::string unknown = "";
+    if (code < 0 || code >= static_cast<int>(N_TRIG)) return unknown;
+    return trig_names()[code];
+}
+
+// Trigger with the given name, Trig::none if unknown
+inline Trig to_trig(const std::string& name) {
+    for (std::size_t itrig = 1; itrig < N_TRIG; ++itrig) {
+        if (trig_names()[itrig] == name) return static_cast<Trig>(itrig);
+    }
+    return Trig::none;
+}
+
+// Bit of a trigger in trigPassBits
+inline int trig_bit(Trig trig) {
+    return 1 << static_cast<int>(trig);
+}
+
+// Decode trigPassBits
+inline bool pass_trig(int trig_pass_bits, Trig trig) {
+    return trig != Trig::none && (trig_pass_bits & trig_bit(trig)) != 0;
+}
+inline bool pass_trig(int trig_pass_bits, const std::string& name) {
+    return pass_trig(trig_pass_bits, to_trig(name));
+}
+
+} // namespace Stop2L
+
+#endif // LEXSTOP2LANALYSIS_TRIGGERBITS_H
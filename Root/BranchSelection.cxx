@@ -0,0 +1,61 @@
+#include "LexStop2LAnalysis/BranchSelection.h"
+
+#include <fnmatch.h>
+#include <fstream>
+#include <sstream>
+
+namespace {
+std::string trim(const std::string& s) {
+    const char* ws = " \t\r\n";
+    size_t first = s.find_first_not_of(ws);
+    if (first == std::string::npos) return "";
+    size_t last = s.find_last_not_of(ws);
+    return s.substr(first, last - first + 1);
+}
+} // anonymous namespace
+
+bool BranchSelection::read_file(const std::string& file_name) {
+    std::ifstream ifs(file_name);
+    if (!ifs) return false;
+    std::string line;
+    while (std::getline(ifs, line)) {
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) line.erase(comment);
+        add_pattern(line);
+    }
+    return true;
+}
+
+void BranchSelection::add_patterns(const std::string& comma_separated_list) {
+    std::stringstream ss(comma_separated_list);
+    std::string pattern;
+    while (std::getline(ss, pattern, ',')) {
+        add_pattern(pattern);
+    }
+}
+
+void BranchSelection::add_pattern(const std::string& pattern) {
+    std::string p = trim(pattern);
+    if (p.empty()) return;
+    m_patterns.push_back(p);
+    m_n_matches.push_back(0);
+}
+
+bool BranchSelection::accept(const std::string& branch) {
+    if (m_patterns.empty()) return true;
+    bool accepted = false;
+    for (size_t i = 0; i < m_patterns.size(); ++i) {
+        if (fnmatch(m_patterns[i].c_str(), branch.c_str(), 0) != 0) continue;
+        ++m_n_matches[i];
+        accepted = true;
+    }
+    return accepted;
+}
+
+std::vector<std::string> BranchSelection::unmatched_patterns() const {
+    std::vector<std::string> unmatched;
+    for (size_t i = 0; i < m_patterns.size(); ++i) {
+        if (m_n_matches[i] == 0) unmatched.push_back(m_patterns[i]);
+    }
+    return unmatched;
+}
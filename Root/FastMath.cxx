@@ -0,0 +1,102 @@
+#include "LexStop2LAnalysis/FastMath.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+using std::cout;
+#include <sstream>
+
+namespace Stop2L {
+
+namespace {
+// atan(t) = t * P(t^2) on [0, 1], max error 2.8e-10
+const double ATAN_COEFFS[] = {
+    0.99999999961452557,
+    -0.33333323665627207,
+    0.19999595854182503,
+    -0.14279048416991902,
+    0.1105378475369569,
+    -0.087961175586024787,
+    0.067101139906049254,
+    -0.044273668281211334,
+    0.02220345491548132,
+    -0.0071661648935417328,
+    0.0010844927498172296,
+};
+
+// Estrin's scheme, shorter dependency chains than Horner's
+inline double polynomial(const double* c, double x) {
+    double x2 = x * x;
+    double x4 = x2 * x2;
+    double x8 = x4 * x4;
+    double q0 = (c[0] + c[1] * x) + (c[2] + c[3] * x) * x2;
+    double q1 = (c[4] + c[5] * x) + (c[6] + c[7] * x) * x2;
+    double q2 = (c[8] + c[9] * x) + c[10] * x2;
+    return q0 + q1 * x4 + q2 * x8;
+}
+const char* QUANTITY_NAMES[FastMathReport::N_QUANTITY] = {"phi", "eta", "mT", "dPhi", "dR"};
+} // anonymous namespace
+
+double fast_atan2(double y, double x) {
+    double ax = std::fabs(x), ay = std::fabs(y);
+    double num = std::min(ax, ay), den = std::max(ax, ay);
+    double t = den > 0 ? num / den : 0;
+    double r = t * polynomial(ATAN_COEFFS, t * t);
+    // Unfold the octant, with the signed zero conventions of std::atan2.
+    // Written as selects of values so the signs of random directions cost
+    // no mispredicted branches.
+    double swapped = ay > ax;
+    r = swapped * M_PI_2 + (1 - 2 * swapped) * r;
+    double negative_x = std::signbit(x);
+    r = negative_x * M_PI + (1 - 2 * negative_x) * r;
+    return std::copysign(r, y);
+}
+
+FastMathReport::FastMathReport() {
+    for (auto& counts : m_counts) counts.fill(0);
+    m_max_diff.fill(0);
+}
+void FastMathReport::fill(Quantity q, double fast, double exact) {
+    double diff = std::fabs(fast - exact);
+    int bin = 0;
+    if (!(diff <= std::pow(10.0, MAX_DECADE))) { // NaN goes to the last bin
+        bin = N_BINS - 1;
+    } else if (diff > 0) {
+        int decade = static_cast<int>(std::ceil(std::log10(diff)));
+        bin = std::max(decade, MIN_DECADE) - MIN_DECADE + 1;
+    }
+    m_counts[q][bin]++;
+    m_max_diff[q] = std::max(m_max_diff[q], diff);
+}
+void FastMathReport::add(const FastMathReport& other) {
+    for (int q = 0; q < N_QUANTITY; ++q) {
+        for (int bin = 0; bin < N_BINS; ++bin) m_counts[q][bin] += other.m_counts[q][bin];
+        m_max_diff[q] = std::max(m_max_diff[q], other.m_max_diff[q]);
+    }
+}
+long long FastMathReport::n_entries() const {
+    long long n = 0;
+    for (const auto& counts : m_counts) {
+        for (long long count : counts) n += count;
+    }
+    return n;
+}
+void FastMathReport::print(const std::string& prefix) const {
+    std::ostringstream header;
+    header << std::setw(6) << "" << std::setw(12) << "max |diff|" << std::setw(10) << "exact";
+    for (int decade = MIN_DECADE; decade <= MAX_DECADE; ++decade) {
+        header << std::setw(10) << ("<=1e" + std::to_string(decade));
+    }
+    header << std::setw(10) << ("> 1e" + std::to_string(MAX_DECADE));
+    cout << prefix << header.str() << '\n';
+    for (int q = 0; q < N_QUANTITY; ++q) {
+        std::ostringstream row;
+        row << std::setw(6) << QUANTITY_NAMES[q]
+            << std::setw(12) << std::setprecision(3) << m_max_diff[q];
+        for (long long count : m_counts[q]) row << std::setw(10) << count;
+        cout << prefix << row.str() << '\n';
+    }
+}
+
+} // namespace Stop2L
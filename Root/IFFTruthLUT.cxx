@@ -0,0 +1,50 @@
+#include "LexStop2LAnalysis/IFFTruthLUT.h"
+
+IFFTruthLUT::IFFTruthLUT() :
+    m_n_hits(0),
+    m_n_misses(0)
+{
+    // Typical samples only have a few hundred distinct truth combinations
+    m_table.reserve(1024);
+}
+
+bool IFFTruthLUT::make_key(bool is_electron, int charge,
+                           int truth_type, int truth_origin,
+                           int mother_type, int mother_origin, int mother_pdgId,
+                           uint64_t& key) {
+    // Bit layout (59 bits used)
+    //   [ 0, 8) truthType              [ 8,16) truthOrigin
+    //   [16,24) firstEgMotherTruthType [24,32) firstEgMotherTruthOrigin
+    //   [32,56) firstEgMotherPdgId, offset to be non-negative
+    //   [56,58) charge sign + 1        [58]    is electron
+    const int pdgId_offset = 1 << 23;
+    if (truth_type < 0 || truth_type > 0xff) return false;
+    if (truth_origin < 0 || truth_origin > 0xff) return false;
+    if (mother_type < 0 || mother_type > 0xff) return false;
+    if (mother_origin < 0 || mother_origin > 0xff) return false;
+    if (mother_pdgId < -pdgId_offset || mother_pdgId >= pdgId_offset) return false;
+    uint64_t charge_sign = charge > 0 ? 2 : (charge < 0 ? 0 : 1);
+    key = static_cast<uint64_t>(truth_type)
+        | static_cast<uint64_t>(truth_origin) << 8
+        | static_cast<uint64_t>(mother_type) << 16
+        | static_cast<uint64_t>(mother_origin) << 24
+        | static_cast<uint64_t>(mother_pdgId + pdgId_offset) << 32
+        | charge_sign << 56
+        | static_cast<uint64_t>(is_electron) << 58;
+    return true;
+}
+
+bool IFFTruthLUT::find(uint64_t key, IFF::Type& type) {
+    auto it = m_table.find(key);
+    if (it == m_table.end()) {
+        ++m_n_misses;
+        return false;
+    }
+    ++m_n_hits;
+    type = it->second;
+    return true;
+}
+
+void IFFTruthLUT::insert(uint64_t key, IFF::Type type) {
+    m_table.emplace(key, type);
+}
@@ -0,0 +1,199 @@
+#include "LexStop2LAnalysis/MT2Solver.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Stop2L {
+
+constexpr double MT2Solver::DEFAULT_PRECISION;
+
+namespace {
+const double GOLDEN = 0.6180339887498949; // (sqrt(5) - 1) / 2
+const double EDGE_TOLERANCE = 1e-12;
+const size_t BLOCK_SIZE = 64;
+
+////////////////////////////////////////////////////////////////////////////////
+// Search arcs of a block of up to N events, one array entry per event
+// Each arc is parameterised by t in [0, 1] along two chords, from its lower
+// edge to its middle and from its middle to its upper edge. A single chord
+// would pass close to the origin for arcs approaching a half circle. The
+// projections of u are linear along each chord and the function is
+// homogeneous of degree 2 in u, so no trigonometry is needed per step.
+////////////////////////////////////////////////////////////////////////////////
+template<size_t N>
+struct ArcBlock {
+    // Value at the start of each chord and its change along it
+    double a[2][N], da[2][N]; // -u.p1
+    double b[2][N], db[2][N]; // -u.p2
+    double d[2][N], dd[2][N]; // u.pmiss
+    double ux[2][N], dux[2][N];
+    double uy[2][N], duy[2][N];
+};
+
+// Both chords are evaluated and one selected so there is no branch
+template<size_t N>
+inline double arc_value(const ArcBlock<N>& arcs, size_t i, double t) {
+    bool upper = t > 0.5;
+    double s0 = 2 * t;
+    double s1 = 2 * t - 1;
+    double a = upper ? arcs.a[1][i] + s1 * arcs.da[1][i] : arcs.a[0][i] + s0 * arcs.da[0][i];
+    double b = upper ? arcs.b[1][i] + s1 * arcs.db[1][i] : arcs.b[0][i] + s0 * arcs.db[0][i];
+    double d = upper ? arcs.d[1][i] + s1 * arcs.dd[1][i] : arcs.d[0][i] + s0 * arcs.dd[0][i];
+    double ux = upper ? arcs.ux[1][i] + s1 * arcs.dux[1][i] : arcs.ux[0][i] + s0 * arcs.dux[0][i];
+    double uy = upper ? arcs.uy[1][i] + s1 * arcs.duy[1][i] : arcs.uy[0][i] + s0 * arcs.duy[0][i];
+    return d * a * b / ((a + b) * (ux * ux + uy * uy));
+}
+
+// Edges of the arc of unit directions u with u.v > 0 for the three unit
+// vectors v. Each half circle runs counterclockwise from (vy, -vx) to
+// (-vy, vx) and the edges of the arc are the half circle edges lying in all
+// the other half circles. Returns false if the arc is empty.
+bool arc_edges(const double vx[3], const double vy[3], double lo[2], double hi[2]) {
+    bool found_lo = false, found_hi = false;
+    for (int i = 0; i < 3; ++i) {
+        bool lo_inside = true, hi_inside = true;
+        for (int j = 0; j < 3; ++j) {
+            double proj = vy[i] * vx[j] - vx[i] * vy[j]; // (vy_i, -vx_i).v_j
+            lo_inside = lo_inside && proj >= -EDGE_TOLERANCE;
+            hi_inside = hi_inside && -proj >= -EDGE_TOLERANCE;
+        }
+        if (lo_inside && !found_lo) {
+            lo[0] = vy[i];
+            lo[1] = -vx[i];
+            found_lo = true;
+        }
+        if (hi_inside && !found_hi) {
+            hi[0] = -vy[i];
+            hi[1] = vx[i];
+            found_hi = true;
+        }
+    }
+    if (!found_lo || !found_hi) return false;
+    // hi must be counterclockwise of lo by at most pi
+    double cross = lo[0] * hi[1] - lo[1] * hi[0];
+    double dot = lo[0] * hi[0] + lo[1] * hi[1];
+    return cross > EDGE_TOLERANCE || (cross > -EDGE_TOLERANCE && dot < 0);
+}
+
+// Fill entry i of the block with the arc of one event. Events with MT2 = 0
+// get an arc on which the function is 0 everywhere.
+template<size_t N>
+void set_arc(ArcBlock<N>& arcs, size_t i, double p1x, double p1y, double p2x, double p2y,
+             double pmx, double pmy) {
+    double ux[3] = {1, 1, 1}, uy[3] = {0, 0, 0};
+    double a[3] = {1, 1, 1}, b[3] = {1, 1, 1}, d[3] = {0, 0, 0};
+    double n1 = std::sqrt(p1x * p1x + p1y * p1y);
+    double n2 = std::sqrt(p2x * p2x + p2y * p2y);
+    double nm = std::sqrt(pmx * pmx + pmy * pmy);
+    double lo[2], hi[2];
+    if (n1 > 0 && n2 > 0 && nm > 0) {
+        const double vx[3] = {-p1x / n1, -p2x / n2, pmx / nm};
+        const double vy[3] = {-p1y / n1, -p2y / n2, pmy / nm};
+        if (arc_edges(vx, vy, lo, hi)) {
+            // The middle of an arc of at most pi is hi - lo rotated clockwise
+            double mx = hi[1] - lo[1];
+            double my = lo[0] - hi[0];
+            double nmid = std::sqrt(mx * mx + my * my);
+            ux[0] = lo[0];
+            uy[0] = lo[1];
+            ux[1] = mx / nmid;
+            uy[1] = my / nmid;
+            ux[2] = hi[0];
+            uy[2] = hi[1];
+            for (int k = 0; k < 3; ++k) {
+                a[k] = -(ux[k] * p1x + uy[k] * p1y);
+                b[k] = -(ux[k] * p2x + uy[k] * p2y);
+                d[k] = ux[k] * pmx + uy[k] * pmy;
+            }
+        }
+    }
+    for (int k = 0; k < 2; ++k) {
+        arcs.a[k][i] = a[k];
+        arcs.da[k][i] = a[k + 1] - a[k];
+        arcs.b[k][i] = b[k];
+        arcs.db[k][i] = b[k + 1] - b[k];
+        arcs.d[k][i] = d[k];
+        arcs.dd[k][i] = d[k + 1] - d[k];
+        arcs.ux[k][i] = ux[k];
+        arcs.dux[k][i] = ux[k + 1] - ux[k];
+        arcs.uy[k][i] = uy[k];
+        arcs.duy[k][i] = uy[k + 1] - uy[k];
+    }
+}
+
+// Solve n <= N events with the golden section steps innermost over events.
+// The steps have selects only, so the events are solved side by side and
+// the step loops vectorize for large blocks.
+template<size_t N>
+void solve_block(const double* p1x, const double* p1y, const double* p2x, const double* p2y,
+                 const double* pmx, const double* pmy, size_t n, int n_steps, double* out) {
+    ArcBlock<N> arcs;
+    // Golden section bracket [lo, hi] and interior points x1 < x2
+    double lo[N], hi[N];
+    double x1[N], f1[N], x2[N], f2[N];
+    double x[N];
+    for (size_t i = 0; i < n; ++i) {
+        set_arc(arcs, i, p1x[i], p1y[i], p2x[i], p2y[i], pmx[i], pmy[i]);
+        lo[i] = 0;
+        hi[i] = 1;
+        x1[i] = 1 - GOLDEN;
+        x2[i] = GOLDEN;
+        f1[i] = arc_value(arcs, i, x1[i]);
+        f2[i] = arc_value(arcs, i, x2[i]);
+    }
+    for (int step = 0; step < n_steps; ++step) {
+        for (size_t i = 0; i < n; ++i) {
+            bool right = f1[i] < f2[i]; // the maximum lies in [x1, hi]
+            double new_lo = right ? x1[i] : lo[i];
+            double new_hi = right ? hi[i] : x2[i];
+            double width = new_hi - new_lo;
+            x[i] = right ? new_lo + GOLDEN * width : new_hi - GOLDEN * width;
+            lo[i] = new_lo;
+            hi[i] = new_hi;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            bool right = f1[i] < f2[i];
+            double f = arc_value(arcs, i, x[i]);
+            double keep_x = right ? x2[i] : x1[i];
+            double keep_f = right ? f2[i] : f1[i];
+            x1[i] = right ? keep_x : x[i];
+            f1[i] = right ? keep_f : f;
+            x2[i] = right ? x[i] : keep_x;
+            f2[i] = right ? f : keep_f;
+        }
+    }
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = 2 * std::sqrt(std::max(0.0, std::max(f1[i], f2[i])));
+    }
+}
+} // anonymous namespace
+
+MT2Solver::MT2Solver(double precision) {
+    set_precision(precision);
+}
+void MT2Solver::set_precision(double precision) {
+    m_precision = precision > 0 ? precision : DEFAULT_PRECISION;
+    // The relative error on MT2 falls with the square of the bracket width,
+    // which shrinks by GOLDEN per step. Two extra steps cover the curvature
+    // of sharply peaked arcs.
+    double n_steps = std::log(m_precision) / (2 * std::log(GOLDEN));
+    m_n_steps = std::max(0, static_cast<int>(std::ceil(n_steps))) + 2;
+}
+double MT2Solver::mt2(double p1x, double p1y, double p2x, double p2y,
+                      double pmx, double pmy) const {
+    double out = 0;
+    solve_block<1>(&p1x, &p1y, &p2x, &p2y, &pmx, &pmy, 1, m_n_steps, &out);
+    return out;
+}
+void MT2Solver::mt2(const double* p1x, const double* p1y,
+                    const double* p2x, const double* p2y,
+                    const double* pmx, const double* pmy,
+                    size_t n, double* out) const {
+    for (size_t first = 0; first < n; first += BLOCK_SIZE) {
+        solve_block<BLOCK_SIZE>(p1x + first, p1y + first, p2x + first, p2y + first,
+                                pmx + first, pmy + first, std::min(BLOCK_SIZE, n - first),
+                                m_n_steps, out + first);
+    }
+}
+
+} // namespace Stop2L
@@ -0,0 +1,85 @@
+#include "LexStop2LAnalysis/NearestDistances.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace Stop2L {
+
+namespace {
+// Same wrapping as TVector2::Phi_mpi_pi for differences of two phi values
+inline double wrap_dphi(double x) {
+    const double pi = M_PI;
+    const double two_pi = 2 * M_PI;
+    x = x >= pi ? x - two_pi : x;
+    x = x < -pi ? x + two_pi : x;
+    return x;
+}
+// Distances are stored as floats in the original loops
+inline double finalize(double x) {
+    return x == DBL_MAX ? DBL_MAX : static_cast<double>(static_cast<float>(x));
+}
+} // anonymous namespace
+
+void nearest_distances(const double* lep_eta, const double* lep_phi, size_t n_leps,
+                       const double* jet_eta, const double* jet_phi,
+                       const unsigned char* jet_isB, size_t n_jets,
+                       NearestDistances& out) {
+    typedef NearestDistances ND;
+    for (int t = 0; t < ND::N_TARGET; ++t) {
+        out.dR[t].assign(n_leps, DBL_MAX);
+        out.dPhi[t].assign(n_leps, DBL_MAX);
+        out.dEta[t].assign(n_leps, DBL_MAX);
+    }
+    for (size_t i = 0; i < n_leps; ++i) {
+        const double eta = lep_eta[i];
+        const double phi = lep_phi[i];
+
+        double lep_dR = DBL_MAX, lep_dPhi = DBL_MAX, lep_dEta = DBL_MAX;
+        for (size_t j = 0; j < n_leps; ++j) {
+            if (j == i) continue;
+            double deta = lep_eta[j] - eta;
+            double dphi = wrap_dphi(lep_phi[j] - phi);
+            lep_dR = std::min(lep_dR, std::sqrt(deta*deta + dphi*dphi));
+            lep_dPhi = std::min(lep_dPhi, std::fabs(dphi));
+            lep_dEta = std::min(lep_dEta, std::fabs(deta));
+        }
+
+        // Branch-free over jets so the loop vectorizes; b-tagging only
+        // selects which minimum a jet can update
+        double jet_dR = DBL_MAX, jet_dPhi = DBL_MAX, jet_dEta = DBL_MAX;
+        double b_dR = DBL_MAX, b_dPhi = DBL_MAX, b_dEta = DBL_MAX;
+        double nonb_dR = DBL_MAX, nonb_dPhi = DBL_MAX, nonb_dEta = DBL_MAX;
+        for (size_t k = 0; k < n_jets; ++k) {
+            double deta = std::fabs(jet_eta[k] - eta);
+            double dphi = wrap_dphi(jet_phi[k] - phi);
+            double dR = std::sqrt(deta*deta + dphi*dphi);
+            dphi = std::fabs(dphi);
+            bool isB = jet_isB[k];
+            jet_dR = std::min(jet_dR, dR);
+            jet_dPhi = std::min(jet_dPhi, dphi);
+            jet_dEta = std::min(jet_dEta, deta);
+            b_dR = std::min(b_dR, isB ? dR : DBL_MAX);
+            b_dPhi = std::min(b_dPhi, isB ? dphi : DBL_MAX);
+            b_dEta = std::min(b_dEta, isB ? deta : DBL_MAX);
+            nonb_dR = std::min(nonb_dR, isB ? DBL_MAX : dR);
+            nonb_dPhi = std::min(nonb_dPhi, isB ? DBL_MAX : dphi);
+            nonb_dEta = std::min(nonb_dEta, isB ? DBL_MAX : deta);
+        }
+
+        out.dR[ND::LEP][i] = finalize(lep_dR);
+        out.dPhi[ND::LEP][i] = finalize(lep_dPhi);
+        out.dEta[ND::LEP][i] = finalize(lep_dEta);
+        out.dR[ND::JET][i] = finalize(jet_dR);
+        out.dPhi[ND::JET][i] = finalize(jet_dPhi);
+        out.dEta[ND::JET][i] = finalize(jet_dEta);
+        out.dR[ND::BJET][i] = finalize(b_dR);
+        out.dPhi[ND::BJET][i] = finalize(b_dPhi);
+        out.dEta[ND::BJET][i] = finalize(b_dEta);
+        out.dR[ND::NONBJET][i] = finalize(nonb_dR);
+        out.dPhi[ND::NONBJET][i] = finalize(nonb_dPhi);
+        out.dEta[ND::NONBJET][i] = finalize(nonb_dEta);
+    }
+}
+
+} // namespace Stop2L
@@ -0,0 +1,55 @@
+#include "LexStop2LAnalysis/OutputPrecision.h"
+
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fnmatch.h>
+#include <sstream>
+
+namespace Stop2L {
+
+float truncate_mantissa(float x, int n_bits) {
+    if (!std::isfinite(x) || n_bits >= FLOAT_MANTISSA_BITS) return x;
+    if (n_bits < 0) n_bits = 0;
+    uint32_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    const int n_drop = FLOAT_MANTISSA_BITS - n_bits;
+    const uint32_t drop_mask = (uint32_t(1) << n_drop) - 1;
+    // Round half away from zero on the magnitude, a carry moves into the
+    // exponent as it should
+    uint32_t rounded = (bits + (uint32_t(1) << (n_drop - 1))) & ~drop_mask;
+    float out;
+    std::memcpy(&out, &rounded, sizeof(out));
+    // Never round a finite value up to infinity
+    return std::isfinite(out) ? out : x;
+}
+
+double round_output(double x, int n_bits) {
+    if (n_bits < 0 || !(std::fabs(x) <= FLT_MAX)) return x;
+    return truncate_mantissa(static_cast<float>(x), n_bits);
+}
+
+bool OutputPrecision::add_rules(const std::string& comma_separated_list) {
+    std::stringstream ss(comma_separated_list);
+    std::string rule;
+    while (std::getline(ss, rule, ',')) {
+        size_t colon = rule.rfind(':');
+        if (colon == std::string::npos || colon == 0 || colon + 1 == rule.size()) return false;
+        char* end = nullptr;
+        long n_bits = std::strtol(rule.c_str() + colon + 1, &end, 10);
+        if (*end != '\0' || n_bits < 0 || n_bits > FLOAT_MANTISSA_BITS) return false;
+        m_rules.emplace_back(rule.substr(0, colon), static_cast<int>(n_bits));
+    }
+    return true;
+}
+
+int OutputPrecision::mantissa_bits(const std::string& branch) const {
+    for (const auto& rule : m_rules) {
+        if (fnmatch(rule.first.c_str(), branch.c_str(), 0) == 0) return rule.second;
+    }
+    return m_float32 ? FLOAT_MANTISSA_BITS : -1;
+}
+
+} // namespace Stop2L
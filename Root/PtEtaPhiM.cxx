@@ -0,0 +1,37 @@
+#include "LexStop2LAnalysis/PtEtaPhiM.h"
+#include "LexStop2LAnalysis/FastMath.h"
+
+namespace Stop2L {
+
+namespace {
+template<typename Atan2>
+inline PtEtaPhiM convert(double px, double py, double pz, double e, Atan2 atan2) {
+    PtEtaPhiM p;
+    double pt2 = px * px + py * py;
+    double p2 = pt2 + pz * pz;
+    p.pt = std::sqrt(pt2);
+    p.phi = px == 0 && py == 0 ? 0 : atan2(py, px);
+    p.cos_phi = p.pt > 0 ? px / p.pt : 1;
+    p.sin_phi = p.pt > 0 ? py / p.pt : 0;
+    // TVector3::PseudoRapidity, without the warning along the beam axis
+    double ptot = std::sqrt(p2);
+    double cos_theta = ptot == 0 ? 1 : pz / ptot;
+    if (cos_theta * cos_theta < 1) {
+        p.eta = -0.5 * std::log((1 - cos_theta) / (1 + cos_theta));
+    } else {
+        p.eta = pz == 0 ? 0 : (pz > 0 ? 10e10 : -10e10);
+    }
+    double m2 = e * e - p2;
+    p.m = m2 < 0 ? -std::sqrt(-m2) : std::sqrt(m2);
+    return p;
+}
+} // anonymous namespace
+
+PtEtaPhiM make_px_py_pz_e(double px, double py, double pz, double e) {
+    return convert(px, py, pz, e, [](double y, double x) { return std::atan2(y, x); });
+}
+PtEtaPhiM make_px_py_pz_e_fast(double px, double py, double pz, double e) {
+    return convert(px, py, pz, e, fast_atan2);
+}
+
+} // namespace Stop2L
@@ -0,0 +1,93 @@
+#include "LexStop2LAnalysis/RNTupleOutput.h"
+
+#include <exception>
+#include <iostream>
+using std::cout;
+#include <set>
+#include <vector>
+
+#include "RVersion.h"
+#include "TFile.h"
+#include "TKey.h"
+#include "TSystem.h"
+#include "TTree.h"
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6, 28, 0)
+#define LEXSTOP2LANALYSIS_HAS_RNTUPLE
+#include "ROOT/RNTupleImporter.hxx"
+#endif
+
+namespace Stop2L {
+
+bool rntuple_output_supported() {
+#ifdef LEXSTOP2LANALYSIS_HAS_RNTUPLE
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool convert_to_rntuple(const std::string& file_name) {
+#ifndef LEXSTOP2LANALYSIS_HAS_RNTUPLE
+    cout << "ERROR :: Unable to convert " << file_name << " to RNTuple, which requires"
+         << " ROOT 6.28 or newer (found " << ROOT_RELEASE << ")\n";
+    return false;
+#else
+    TFile* in_file = TFile::Open(file_name.c_str(), "READ");
+    if (!in_file || in_file->IsZombie()) {
+        cout << "ERROR :: Unable to open " << file_name << " to convert to RNTuple\n";
+        return false;
+    }
+    // Written next to the input and renamed once every tree is converted
+    std::string tmp_name = file_name + ".rntuple.tmp";
+    TFile* out_file = TFile::Open(tmp_name.c_str(), "RECREATE");
+    if (!out_file || out_file->IsZombie()) {
+        cout << "ERROR :: Unable to create " << tmp_name << '\n';
+        in_file->Close();
+        delete in_file;
+        return false;
+    }
+    std::vector<std::string> tree_names;
+    std::set<std::string> seen; // keys are ordered by decreasing cycle
+    TIter next_key(in_file->GetListOfKeys());
+    while (TKey* key = static_cast<TKey*>(next_key())) {
+        if (!seen.insert(key->GetName()).second) continue;
+        TObject* obj = key->ReadObj();
+        if (dynamic_cast<TTree*>(obj)) {
+            tree_names.push_back(key->GetName());
+        } else {
+            out_file->cd();
+            obj->Write(key->GetName());
+        }
+        delete obj;
+    }
+    out_file->Close();
+    delete out_file;
+    in_file->Close();
+    delete in_file;
+
+    // The importer appends each RNTuple to the file, with the field names
+    // taken from the branch names
+    using ROOT::Experimental::RNTupleImporter;
+    for (const std::string& tree_name : tree_names) {
+        try {
+            auto importer = RNTupleImporter::Create(file_name, tree_name, tmp_name).Unwrap();
+            importer->SetIsQuiet(true);
+            importer->Import();
+        } catch (const std::exception& e) {
+            cout << "ERROR :: Unable to convert " << tree_name << " in " << file_name
+                 << " to RNTuple: " << e.what() << '\n';
+            gSystem->Unlink(tmp_name.c_str());
+            return false;
+        }
+    }
+    // rename replaces the TTree file atomically, so one of the two always exists
+    if (gSystem->Rename(tmp_name.c_str(), file_name.c_str()) != 0) {
+        cout << "ERROR :: Unable to move " << tmp_name << " to " << file_name
+             << ", the RNTuple output is left in " << tmp_name << '\n';
+        return false;
+    }
+    return true;
+#endif
+}
+
+} // namespace Stop2L
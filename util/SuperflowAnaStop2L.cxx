@@ -9,6 +9,7 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 // std
+#include <cstdint>
 #include <cstdlib>
 #include <cmath>
 #include <fstream>
@@ -17,13 +18,35 @@ using std::cout;
 #include <string>
 using std::string;
 #include <getopt.h>
+#include <iomanip>
 #include <map>
 using std::map;
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <chrono>
+#include <functional>
+#include <set>
+#include <sstream>
 #include <utility>
 using std::pair;
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+using std::vector;
 
 // ROOT
 #include "TChain.h"
+#include "TChainElement.h"
+#include "TFile.h"
+#include "TFileMerger.h"
+#include "TH1D.h"
+#include "TKey.h"
+#include "TROOT.h"
+#include "TSystem.h"
 #include "TVectorD.h"
 #include "TF1.h"
 
@@ -32,6 +55,7 @@ using std::pair;
 #include "xAODRootAccess/TStore.h"
 #include "xAODEgamma/Electron.h"
 #include "xAODMuon/Muon.h"
+#include "AthContainers/AuxElement.h"
 
 // ASG
 #include "AsgTools/StatusCode.h"
@@ -59,6 +83,17 @@ using namespace asg::msgUserCode; // required for ANA_CHECK
 //Jigsaw
 #include "jigsawcalculator/JigsawCalculator.h"
 
+// LexStop2LAnalysis
+#include "LexStop2LAnalysis/BranchSelection.h"
+#include "LexStop2LAnalysis/IFFTruthLUT.h"
+#include "LexStop2LAnalysis/MT2Solver.h"
+#include "LexStop2LAnalysis/FastMath.h"
+#include "LexStop2LAnalysis/PtEtaPhiM.h"
+#include "LexStop2LAnalysis/NearestDistances.h"
+#include "LexStop2LAnalysis/OutputPrecision.h"
+#include "LexStop2LAnalysis/RNTupleOutput.h"
+#include "LexStop2LAnalysis/TriggerBits.h"
+
 using namespace std;
 using namespace sflow;
 
@@ -73,35 +108,232 @@ int m_lumi = 1000; // inverse picobarns (ipb)
 Susy::AnalysisType m_ana_type = Susy::AnalysisType::Ana_Stop2L;
 const float ZMASS = 91.2;
 const float GeVtoMeV = 1000.0;
+// ASG tools register in a global tool store and are initialized through code
+// that is not thread-safe, so worker threads build and tear down their tools
+// one at a time under this lock
+std::mutex m_tool_mutex;
 
 ////////////////////////////////////////////////////////////////////////////////
 // Declarations
 ////////////////////////////////////////////////////////////////////////////////
+struct AnaOptions;
+struct EventContext;
+class VarFlow;
+struct AnaCut;
+struct SelectionCuts;
+struct CutProfile;
+struct RunSummary;
+struct CutChain;
+enum class Selection;
+bool read_ana_options(int& argc, char* argv[], AnaOptions& ana_options);
 TChain* create_new_chain(string input, string ttree_name, bool verbose);
 Superflow* create_new_superflow(SFOptions sf_options, TChain* chain);
-bool set_global_variables(Superflow* sf);
-void add_cleaning_cuts(Superflow* sf);
-void add_analysis_cuts(Superflow* sf);
-void add_4bcutflow_cuts(Superflow* sf);
-void add_event_variables(Superflow* sf);
-void add_trigger_variables(Superflow* sf);
-void add_lepton_variables(Superflow* sf);
-void add_mc_lepton_variables(Superflow* sf);
-void add_jet_variables(Superflow* sf);
-void add_met_variables(Superflow* sf);
-void add_dilepton_variables(Superflow* sf);
-void add_jigsaw_variables(Superflow* sf);
-void add_miscellaneous_variables(Superflow* sf);
-void add_Zlepton_variables(Superflow* sf);
-void add_Zll_probeLep_variables(Superflow* sf);
-void add_multi_object_variables(Superflow* sf);
+Superflow* build_superflow(SFOptions sf_options, TChain* chain, EventContext* ctx);
+void print_branch_selection_summary(const VarFlow& vars);
+void add_region_branches(const VarFlow& vars, size_t first, const vector<Selection>& sels);
+bool run_multithreaded(SFOptions sf_options, int n_threads, Long64_t first_entry, RunSummary& summary);
+bool run_with_checkpoints(SFOptions sf_options, Long64_t first_entry, Long64_t checkpoint_every, bool resume, RunSummary& summary);
+bool check_resumed_parts(const vector<string>& part_names, Long64_t next_entry,
+                         Long64_t first_entry, Long64_t checkpoint_every);
+bool read_entry_cache(const string& cache_name, const string& input, vector< pair<string, Long64_t> >& file_entries);
+bool write_entry_cache(const string& cache_name, const string& input, const vector< pair<string, Long64_t> >& file_entries);
+vector< pair<string, Long64_t> > get_file_entries(TChain* chain);
+vector<string> get_input_files(const string& input);
+void print_shard_plan(const vector< pair<string, Long64_t> >& file_entries, int n_jobs);
+bool add_selection(const string& selection_name);
+string selection_name(Selection sel);
+bool can_overlap(Selection a, Selection b);
+string selection_output_name(const string& output_name, Selection sel);
+bool split_output_by_selection(const string& output_name, const vector<SelectionCuts>& selection_cuts);
+TTree* copy_selection_entries(TTree* tree, Selection sel);
+TH1* split_cutflow_histogram(TH1* hist, int pass_bin, const SelectionCuts& sel_cuts, const vector<SelectionCuts>& selection_cuts);
+bool finalize_output(const string& output_name, const RunSummary& summary);
+bool set_global_variables(Superflow* sf, EventContext* ctx);
+void read_event(Superlink* sl, EventContext* ctx);
+void require_stages(Superlink* sl, EventContext* ctx, unsigned stages);
+void run_stage(Superlink* sl, EventContext* ctx, unsigned stage);
+void read_objects(Superlink* sl, EventContext* ctx);
+void read_truth(EventContext* ctx);
+void find_Z_pair(EventContext* ctx);
+void set_region_variables(Superlink* sl, EventContext* ctx, Selection sel);
+void add_cut(Superflow* sf, EventContext* ctx, const AnaCut& cut);
+vector<AnaCut> get_cleaning_cuts(EventContext* ctx);
+vector<int> order_by_expected_cost(const vector<AnaCut>& cuts, const map<string, CutProfile>& profile);
+void add_cleaning_cuts(Superflow* sf, EventContext* ctx);
+void add_analysis_cuts(Superflow* sf, EventContext* ctx);
+vector<AnaCut> get_analysis_cuts(Selection sel, EventContext* ctx);
+void print_selection_cutflows(const vector<SelectionCuts>& selection_cuts);
+void print_run_summary(const RunSummary& summary);
+bool read_cut_profile(const string& file_name, map<string, CutProfile>& profile);
+bool write_cut_profile(const string& file_name, const vector<CutProfile>& profiles);
+void print_cut_profile(const vector<CutProfile>& profiles);
+void add_4bcutflow_cuts(Superflow* sf, EventContext* ctx);
+void add_event_variables(VarFlow* sf, EventContext* ctx);
+void add_trigger_variables(VarFlow* sf, EventContext* ctx);
+void add_trigger_pass_variables(VarFlow* sf, EventContext* ctx);
+void add_packed_trigger_pass_variables(VarFlow* sf, EventContext* ctx);
+void add_lepton_variables(VarFlow* sf, EventContext* ctx);
+void add_mc_lepton_variables(VarFlow* sf, EventContext* ctx);
+void add_jet_variables(VarFlow* sf, EventContext* ctx);
+void add_met_variables(VarFlow* sf);
+void add_dilepton_variables(VarFlow* sf, EventContext* ctx);
+void add_jigsaw_variables(VarFlow* sf, EventContext* ctx);
+void add_miscellaneous_variables(VarFlow* sf, EventContext* ctx);
+void add_Zlepton_variables(VarFlow* sf, EventContext* ctx);
+void add_Zll_probeLep_variables(VarFlow* sf, EventContext* ctx);
+void add_multi_object_variables(VarFlow* sf, EventContext* ctx);
 
 void add_weight_systematics(Superflow* sf);
 void add_shape_systematics(Superflow* sf);
 
 
+// Analysis specific options (set with user input)
+// These are stripped from the command line before it is handed to Superflow
+struct AnaOptions {
+    int n_threads = 1; // >1 splits the entry range across worker threads
+    // Entry range of the input chain to process (inclusive)
+    Long64_t first_entry = -1;
+    Long64_t last_entry = -1;
+    // Process shard k of N equal sized entry ranges (--shard k/N)
+    int shard_index = -1;
+    int n_shards = 0;
+    string entry_cache = ""; // per-file entry counts of the input
+    int n_plan_jobs = 0; // >0 prints the --shard ranges for that many jobs and exits
+    Long64_t checkpoint_every = 0; // >0 checkpoints after every that many entries
+    bool resume = false; // continue from the last checkpoint
+    bool packed_triggers = false; // one trigger bitfield branch instead of a bool per trigger
+    bool iff_lut = true; // look up IFF truth classes instead of running the classifier
+    int validate_iff_every = 0; // >0 checks the IFF lookup table against the classifier every N events
+    string branches = ""; // file or comma separated list of output branches to keep (default all)
+    bool float32_outputs = false; // round float variables to float32
+    string truncate_mantissa = ""; // "pattern:bits,..." mantissa bits kept per float branch
+    string profile_cuts = ""; // file the cost and rejection of each cut is written to
+    string reorder_cuts = ""; // cut profile used to reorder the cleaning cuts
+    double mt2_precision = 0; // >0 computes MT2 with Stop2L::MT2Solver at this relative precision
+    bool fast_math = false; // approximate phi when converting object kinematics
+    int validate_fast_math_every = 0; // >0 compares fast and exact kinematics every N events
+    string output_format = "ttree"; // "rntuple" converts the output trees to RNTuple after the job
+};
+AnaOptions m_ana_options;
+// Output branches to write, set from --branches
+BranchSelection m_branch_selection;
+// Precision of float output branches, set from --float32-outputs and --truncate-mantissa
+Stop2L::OutputPrecision m_output_precision;
+// Massless MT2 solver, used instead of kin::getMT2 if --mt2-precision is set
+Stop2L::MT2Solver m_mt2_solver;
+
+////////////////////////////////////////////////////////////////////////////////
+// Output variable registration
+// Output variables are registered through a VarFlow rather than on the
+// Superflow directly. Variables whose HFT name is not in the branch selection
+// are dropped before reaching Superflow, so their lambdas are never evaluated
+// and their branches never created. Float variables are wrapped to round
+// their values if the output precision asks for it.
+////////////////////////////////////////////////////////////////////////////////
+typedef std::function<double(Superlink*, var_float*)> FloatVar;
+typedef std::function<vector<double>(Superlink*, var_float_array*)> FloatArrayVar;
+class VarFlow {
+  public:
+    VarFlow(Superflow* sf, const BranchSelection& selection, const Stop2L::OutputPrecision& precision) :
+        m_sf(sf),
+        m_selection(selection),
+        m_precision(precision)
+    {}
+    // Held back until the HFT name decides whether the variable is kept
+    VarFlow& operator<<(NewVar new_var) {
+        m_new_var.reset(new NewVar(new_var));
+        return *this;
+    }
+    VarFlow& operator<<(HFTname hft_name) {
+        m_skip = !m_selection.accept(hft_name.name);
+        m_mantissa_bits = m_precision.mantissa_bits(hft_name.name);
+        if (m_skip) {
+            m_n_skipped++;
+        } else {
+            m_n_kept++;
+            m_kept_names.push_back(hft_name.name);
+            *m_sf << *m_new_var;
+            *m_sf << hft_name;
+        }
+        m_new_var.reset();
+        return *this;
+    }
+    VarFlow& operator<<(SaveVar save_var) {
+        if (!m_skip) *m_sf << save_var;
+        m_skip = false;
+        return *this;
+    }
+    VarFlow& operator<<(FloatVar var) {
+        if (m_skip) return *this;
+        int n_bits = m_mantissa_bits;
+        if (n_bits < 0) {
+            *m_sf << var;
+        } else {
+            *m_sf << FloatVar([var, n_bits](Superlink* sl, var_float* v) -> double {
+                return Stop2L::round_output(var(sl, v), n_bits);
+            });
+        }
+        return *this;
+    }
+    VarFlow& operator<<(FloatArrayVar var) {
+        if (m_skip) return *this;
+        int n_bits = m_mantissa_bits;
+        if (n_bits < 0) {
+            *m_sf << var;
+        } else {
+            *m_sf << FloatArrayVar([var, n_bits](Superlink* sl, var_float_array* v) -> vector<double> {
+                vector<double> out = var(sl, v);
+                for (double& x : out) x = Stop2L::round_output(x, n_bits);
+                return out;
+            });
+        }
+        return *this;
+    }
+    // All other variable lambdas
+    template<typename T,
+             typename std::enable_if<!std::is_convertible<T, FloatVar>::value
+                                  && !std::is_convertible<T, FloatArrayVar>::value, int>::type = 0>
+    VarFlow& operator<<(T&& t) {
+        if (!m_skip) *m_sf << std::forward<T>(t);
+        return *this;
+    }
+
+    int n_kept() const { return m_n_kept; }
+    int n_skipped() const { return m_n_skipped; }
+    const vector<string>& kept_names() const { return m_kept_names; } // in registration order
+    const BranchSelection& selection() const { return m_selection; }
+
+  private:
+    Superflow* m_sf;
+    BranchSelection m_selection; // copied so concurrent builds do not share match counts
+    const Stop2L::OutputPrecision& m_precision;
+    std::unique_ptr<NewVar> m_new_var;
+    bool m_skip = false;
+    int m_mantissa_bits = -1; // of the current variable
+    int m_n_kept = 0;
+    int m_n_skipped = 0;
+    vector<string> m_kept_names;
+};
+// Per-file entry counts read from the entry cache
+// If set, the input chain is built from these without opening every file
+vector< pair<string, Long64_t> > m_file_entries;
+
 // Selections (set with user input)
+// A comma separated list (or "all") runs several selections in one pass over
+// the input, see add_analysis_cuts
+enum class Selection {
+    // Values are the bits of the passSelections output variable
+    baseline_DF = 0,
+    baseline_SS,
+    baseline_SS_den,
+    zjets3l,
+    fake_baseline_DF,
+    fake_zjets3l,
+    zjets2l_inc
+};
+vector<Selection> m_selections; // in the order requested
 // Formatting: m_<region>_<SF/DF>_<den>
+// Set for every requested selection
 bool m_baseline_DF = false;
 bool m_baseline_SS = false;
 bool m_baseline_SS_den = false;
@@ -109,33 +341,312 @@ bool m_zjets_3l = false;
 bool m_fake_baseline_DF = false;
 bool m_fake_zjets_3l = false;
 bool m_zjets2l_inc = false;
+// Output branches written for only some of the selections, see
+// add_region_branches. The per-selection files of a multi-selection job keep
+// only the branches a job running that selection alone writes.
+map<string, std::set<Selection>> m_region_branches;
+
+////////////////////////////////////////////////////////////////////////////////
+// Per-event stages
+// The per-event state is built in stages, each run the first time a cut or
+// variable needs it (see require_stages). Events rejected by the cleaning or
+// multiplicity cuts never pay for truth classification or trigger matching.
+// Stages are listed after the stages they depend on, see m_stage_deps.
+////////////////////////////////////////////////////////////////////////////////
+enum Stage : unsigned {
+    STAGE_OBJECTS = 1 << 0, // jets, MET and the baseline/signal/inverted leptons
+    STAGE_TRUTH   = 1 << 1, // prompt and FNP lepton collections (MC only)
+    STAGE_ZTAG    = 1 << 2, // Z candidate pair among the signal leptons
+    STAGE_TRIGGER = 1 << 3, // selection specific leptons and trigger strategy
+    STAGE_JIGSAW  = 1 << 4, // Jigsaw variables
+};
+const int N_STAGES = 5;
+// Stages each stage depends on, indexed by bit position
+const unsigned m_stage_deps[N_STAGES] = {
+    0,             // objects
+    STAGE_OBJECTS, // truth
+    STAGE_OBJECTS, // Z-tag
+    STAGE_ZTAG,    // trigger
+    STAGE_OBJECTS, // Jigsaw
+};
+
+// Analysis cut that can either be registered on a Superflow or evaluated as
+// part of a selection in multi-selection mode
+struct AnaCut {
+    string name;
+    std::function<bool(Superlink*)> pass;
+    unsigned stages = 0; // Stage bits needed before the cut is evaluated
+};
+struct SelectionCuts {
+    Selection sel;
+    vector<AnaCut> cuts;
+    vector<Long64_t> n_pass; // raw cutflow counts, one per cut
+    vector<double> sumw_pass; // weighted cutflow counts, with the weights Superflow counts with
+};
+// Cost and rejection of a cut, measured with --profile-cuts
+// Rejection is among the events reaching the cut
+struct CutProfile {
+    string name;
+    Long64_t n_eval = 0;
+    Long64_t n_fail = 0;
+    double total_ns = 0;
+    double ns_per_eval() const { return n_eval ? total_ns / n_eval : 0; }
+    double rejection() const { return n_eval ? double(n_fail) / n_eval : 0; }
+};
+// Independent cuts evaluated in the order of least expected cost. Each cut
+// is still registered with Superflow in the canonical order, reading its
+// result from the chain which runs once per event.
+struct CutChain {
+    bool pass(Superlink* sl, int icut);
+    void clear() { m_run = false; m_evaluated = 0; m_passed = 0; }
+
+    vector<AnaCut> cuts; // canonical order
+    vector<int> order; // evaluation order, indices into cuts
+    bool m_run = false; // evaluation order already run for this event
+    uint64_t m_evaluated = 0; // bit per cut (canonical order) evaluated this event
+    uint64_t m_passed = 0; // bit per cut (canonical order) evaluated and passed
+};
+// Cost and rejection of each cut, read from --reorder-cuts
+map<string, CutProfile> m_cut_profile;
+// Counts reported at the end of the job, summed over the contexts of all
+// worker threads or checkpoint blocks
+struct RunSummary {
+    void add(const EventContext& ctx);
+    void add(const RunSummary& other);
+
+    vector<SelectionCuts> selection_cuts;
+    size_t iff_lut_size = 0; // largest lookup table of any context
+    Long64_t iff_n_hits = 0;
+    Long64_t iff_n_misses = 0;
+    Long64_t iff_n_validated = 0;
+    Long64_t iff_n_mismatched = 0;
+    Stop2L::FastMathReport fast_math_report;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Trigger menu
+// Lepton triggers used in the trigger strategy are listed in the Trig enum of
+// LexStop2LAnalysis/TriggerBits.h. The trigger tables below are compiled into
+// enum indexed arrays by compile_trigger_menu() at startup so the per event
+// trigger logic never looks up a trigger by name.
+////////////////////////////////////////////////////////////////////////////////
+using Stop2L::Trig;
+using Stop2L::N_TRIG;
+using Stop2L::to_trig;
+using Stop2L::NearestDistances;
+using Stop2L::PtEtaPhiM;
+typedef std::bitset<N_TRIG> TrigBits;
+inline size_t to_idx(Trig t) { return static_cast<size_t>(t); }
+
+////////////////////////////////////////////////////////////////////////////////
+// Systematic-invariant cache
+// Superflow reruns every cut and variable for each shape systematic, handing
+// over the same Susy objects with shifted kinematics. Quantities that only
+// depend on truth information or trigger decisions are computed on the first
+// pass over an event and reused by the others. Anything depending on the
+// object kinematics is either recomputed or checked against the kinematics it
+// was computed with.
+////////////////////////////////////////////////////////////////////////////////
+struct SysInvariantCache {
+    // Returns true if the cache was reset for a new event
+    // trig_bit_idx: position of each Trig in the event trigger bits (-1 if
+    // absent from the trigger tool's menu)
+    bool update(const Susy::Event* evt, const std::array<int, N_TRIG>& trig_bit_idx);
+
+    int m_run = -1;
+    unsigned long long m_event_number = 0;
+
+    vector< pair<const Susy::Lepton*, IFF::Type> > m_iff_classes;
+    TrigBits m_trig_fired; // set once per event from the trigger bits
+
+    // Trigger matching of each lepton, against every fired trigger of the
+    // menu, computed the first time the lepton is seen in the event
+    static const uint MAX_TRIG_LEPS = 16;
+    vector<const Susy::Lepton*> m_trig_leps; // index into the arrays below
+    std::array<TrigBits, MAX_TRIG_LEPS> m_lep_trig_match; // single lepton triggers
+    std::array<TrigBits, MAX_TRIG_LEPS * MAX_TRIG_LEPS> m_dilep_trig_match; // [i*MAX_TRIG_LEPS + j]
+    struct JetFlags {
+        const Susy::Jet* jet;
+        float pt, eta; // kinematics the flags were computed with
+        bool isB, isForward;
+    };
+    vector<JetFlags> m_jet_flags;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Lepton table
+// Column-wise kinematics of every lepton in m_leps, filled once per event (and
+// systematic) by the "read in" cut. Lepton collections are stored alongside as
+// index lists into the table so the per-collection output variables only
+// gather precomputed values instead of recomputing them for every collection
+// a lepton belongs to.
+////////////////////////////////////////////////////////////////////////////////
+struct LeptonTable {
+    void clear();
+    void fill(const LeptonVector& leps, const PtEtaPhiM& met);
+    // Index of each lepton of leps in the table (leptons must be in the table)
+    void index(const LeptonVector& leps, vector<int>& idx) const;
+    size_t size() const { return lep.size(); }
+    // Kinematics of lepton i of a collection given by its index list
+    const PtEtaPhiM& kin_at(const vector<int>& idx, size_t i) const { return kin[idx.at(i)]; }
+
+    vector<const Susy::Lepton*> lep;
+    vector<int> isEle;
+    vector<int> q;
+    vector<PtEtaPhiM> kin;
+    vector<double> pt, eta, phi, e, m;
+    vector<double> clusEtaBE; // electron cluster eta, lepton eta for muons
+    vector<double> d0sigBSCorr;
+    vector<double> z0SinTheta;
+    vector<double> mT; // transverse mass with the MET
+    vector<double> dPhiMET; // |dPhi| with the MET
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Jet table
+// Classification and flat kinematics of every jet in sl->jets, filled once per
+// event (and systematic) by the "read in" cut. Jet counts and category
+// selections read from here instead of asking the jet selector again.
+////////////////////////////////////////////////////////////////////////////////
+struct JetTable {
+    enum Flag : unsigned char { BJET = 1 << 0, FORWARD = 1 << 1, LIGHT = 1 << 2 };
+    void clear();
+    void add(const Susy::Jet* jet, bool is_bjet, bool is_forward);
+    size_t size() const { return flags.size(); }
+
+    vector<unsigned char> flags; // Flag bitmask of each jet
+    vector<unsigned char> isB; // 1 for b-jets, as taken by nearest_distances
+    vector<PtEtaPhiM> kin;
+    vector<double> eta, phi;
+    int n_bjets = 0;
+    int n_forward = 0;
+    int n_light = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Jigsaw observables written to the output (-DBL_MAX if not available)
+// Filled from the calculator by the Jigsaw stage the first time an event needs
+// them, so only for events passing the selection and only in jobs that save
+// Jigsaw variables.
+////////////////////////////////////////////////////////////////////////////////
+struct JigsawVars {
+    double shat;
+    double pTT_T;
+    double RPT;
+    double gamInvRp1;
+    double MDR;
+    double DPB_vSS;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Multi-lepton system
+// Four-vector sum shared by the cuts and variables of an event, with its
+// kinematics converted once. Built the first time it is requested, see
+// get_dilepton, get_Z_system and get_Z_probe_system.
+////////////////////////////////////////////////////////////////////////////////
+struct LepSystem : PtEtaPhiM {
+    void set(const TLorentzVector& sum);
+
+    bool valid = false;
+    TLorentzVector p4;
+    TVector3 boost; // to the rest frame of the system
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Per-event context
+// Holds everything the "read in" cut and the event stages compute for the
+// current event. Each Superflow gets its own context, which is captured by
+// every cut and variable lambda registered on it. Containers are cleared
+// between events, never freed, so their storage is reused for the whole job.
+////////////////////////////////////////////////////////////////////////////////
+struct EventContext {
+    explicit EventContext(const string& tool_suffix = "");
+    void clear(); // reset per-event state, keeping allocated capacity
+    void clear_region(); // reset only the selection dependent state
+
+    int m_cutflags = 0;
+    unsigned m_stages_done = 0; // Stage bits already run for this event
+    JetTable m_jet_table;
+    JetVector m_light_jets;
+    PtEtaPhiM m_MET;
+    // Formatting for lepton vectors: m_<identifier>Leps
+    // This is assumed in macros so it is required
+    // Only exception is for the all inclusive m_leps
+    LeptonVector m_leps;
+    LeptonVector m_sigLeps;
+    LeptonVector m_invLeps;
+    LeptonVector m_promptLeps;
+    LeptonVector m_fnpLeps;
+    LeptonVector m_promptSigLeps;
+    LeptonVector m_promptInvLeps;
+    LeptonVector m_fnpSigLeps;
+    LeptonVector m_fnpInvLeps;
+
+    LeptonVector m_ZLeps;
+    LeptonVector m_probeLeps;
+
+    // Kinematics of m_leps and each lepton collection as indices into it
+    // Formatting for index lists: m_<identifier>Leps_idx (assumed in macros)
+    LeptonTable m_lep_table;
+    vector<int> m_leps_idx;
+    vector<int> m_sigLeps_idx;
+    vector<int> m_invLeps_idx;
+    vector<int> m_promptLeps_idx;
+    vector<int> m_fnpLeps_idx;
+    vector<int> m_promptSigLeps_idx;
+    vector<int> m_promptInvLeps_idx;
+    vector<int> m_fnpSigLeps_idx;
+    vector<int> m_fnpInvLeps_idx;
+    vector<int> m_ZLeps_idx;
+    vector<int> m_probeLeps_idx;
+    // Lepton distances to the closest objects, see get_nearest_distances
+    NearestDistances m_nearest;
+    bool m_nearest_valid = false;
+    int m_ztagged_idx1 = -1;
+    int m_ztagged_idx2 = -1;
+    TLorentzVector m_ztagged_p4; // sum of the pair found by find_Z_pair
+    // Lepton systems, see get_dilepton etc.
+    LepSystem m_dilep; // leading two of m_leps
+    LepSystem m_Zsys; // leading two of m_ZLeps
+    LepSystem m_Zprobe; // m_Zsys and the leading probe lepton
+    int m_probeLep_idx = 0;
+    int m_trigLep_idx0 = -1;
+    int m_trigLep_idx1 = -1;
+    vector<int> m_trigMatch_idx; // trigger match cache index of each of m_leps
+    Trig m_firedTrig = Trig::none;
+    TrigBits m_triggerPass; // indexed by Trig
+
+    // Scratch space for the trigger strategy
+    LeptonVector m_prefTrigLeps;
+    LeptonVector m_allTrigLeps;
+
+    // Multi-selection mode
+    vector<SelectionCuts> m_selection_cuts;
+    // Reordered cut chain and cut profiling
+    CutChain m_cleaning_chain;
+    vector<CutProfile> m_cut_profiles;
+    int m_passSelections = 0; // bit per Selection passed by the event
+
+    // Reused across the nominal and shape systematic passes of an event
+    SysInvariantCache m_sys_cache;
+    Long64_t m_n_events = 0; // distinct events seen
+    // Trigger bit positions, resolved once from the trigger tool
+    std::array<int, N_TRIG> m_trig_bit_idx;
+
+    // Tools (one instance per context so event loops never share them)
+    IFFTruthClassifier m_truthClassifier;
+    IFFTruthLUT m_iff_lut;
+    Long64_t m_iff_n_validated = 0;
+    Long64_t m_iff_n_mismatched = 0;
+    Stop2L::FastMathReport m_fast_math_report; // see --validate-fast-math
+    // Reused as the classifier input so no xAOD object is made per lepton
+    xAOD::Electron m_iff_electron;
+    xAOD::Muon m_iff_muon;
+    jigsaw::JigsawCalculator m_calculator;
+    std::map< std::string, std::vector<TLorentzVector> > m_jigsaw_objects;
+    JigsawVars m_jigsaw_vars;
+};
 
-// globals for use in superflow cuts and variables
-// TODO: Do I need static variables
-static int m_cutflags = 0;
-static JetVector m_light_jets;
-static TLorentzVector m_MET;
-// Formatting for lepton vectors: m_<identifier>Leps
-// This is assumed in macros so it is required
-// Only exception is for the all inclusive m_leps
-static LeptonVector m_leps;
-static LeptonVector m_sigLeps;
-static LeptonVector m_invLeps;
-static LeptonVector m_promptLeps;
-static LeptonVector m_fnpLeps;
-static LeptonVector m_promptSigLeps;
-static LeptonVector m_promptInvLeps;
-static LeptonVector m_fnpSigLeps;
-static LeptonVector m_fnpInvLeps;
-
-static LeptonVector m_ZLeps;
-static LeptonVector m_probeLeps;
-static int m_ztagged_idx1;
-static int m_ztagged_idx2;
-static int m_probeLep_idx;
-static int m_trigLep_idx0;
-static int m_trigLep_idx1;
-static string m_firedTrig;
 static map< uint, vector<string> > m_single_ele_trigs {
     { 2015, {
         "HLT_e120_lhloose",
@@ -280,460 +791,356 @@ static map<string, pair<float,float>> m_dilepton_pT_thresholds = {
     // 2017-2018
     {"HLT_e26_lhmedium_nod0_mu8noL1", std::make_pair(27, 9)},
 };
-static map<string, uint> m_trig_enum = {
-    {"HLT_e120_lhloose",                          1},
-    {"HLT_e60_lhmedium",                          2},
-    {"HLT_e24_lhmedium_L1EM20VH",                 3},
-    {"HLT_e140_lhloose_nod0",                     4},
-    {"HLT_e60_lhmedium_nod0",                     5},
-    {"HLT_e26_lhtight_nod0_ivarloose",            6},
-    {"HLT_mu40",                                  7},
-    {"HLT_mu20_iloose_L1MU15",                    8},
-    {"HLT_mu50",                                  9},
-    {"HLT_mu26_ivarmedium",                      10},
-    {"HLT_2e12_lhloose_L12EM10VH",               11},
-    {"HLT_2e17_lhvloose_nod0",                   12},
-    {"HLT_2e24_lhvloose_nod0",                   13},
-    {"HLT_2e17_lhvloose_nod0_L12EM15VHI",        14},
-    {"HLT_mu18_mu8noL1",                         15},
-    {"HLT_2mu10",                                16},
-    {"HLT_mu22_mu8noL1",                         17},
-    {"HLT_2mu14",                                18},
-    {"HLT_e17_lhloose_mu14",                     19},
-    {"HLT_e7_lhmedium_mu24",                     20},
-    {"HLT_e26_lhmedium_nod0_L1EM22VHI_mu8noL1",  21},
-    {"HLT_e17_lhloose_nod0_mu14",                22},
-    {"HLT_e7_lhmedium_nod0_mu24",                23},
-    {"HLT_e26_lhmedium_nod0_mu8noL1",            24}
+// Names of the Trig enum values, used for the trigger tool
+static const std::array<string, N_TRIG>& m_trig_names = Stop2L::trig_names();
+
+// Trigger tables compiled by compile_trigger_menu()
+struct TrigMenu {
+    vector<Trig> single_ele;
+    vector<Trig> single_mu;
+    vector<Trig> dielectron;
+    vector<Trig> dimuon;
+    vector<Trig> diff_flav;
+    TrigBits single_lep_mask; // triggers combined into singleLepTrigs
+    TrigBits dilep_mask; // triggers combined into dilepTrigs
 };
+const uint FIRST_TRIG_YEAR = 2015;
+static std::array<TrigMenu, 4> m_trig_menus; // indexed by year - FIRST_TRIG_YEAR
+// Offline pT thresholds; the second leg is the muon for different flavor
+// triggers and unused for single lepton triggers
+static std::array< pair<float,float>, N_TRIG> m_trig_pT_thresholds;
 
 
-static map<string, bool> m_triggerPass;
-
-static IFFTruthClassifier m_truthClassifier("truthClassifier");
-
-static jigsaw::JigsawCalculator m_calculator;
-static std::map< std::string, float> m_jigsaw_vars;
-
 // Helpful functions
 bool isSignal(const Susy::Lepton* lep, Superlink* sl);
-bool isSignal(const Susy::Lepton* lep);
+bool isSignal(const Susy::Lepton* lep, const EventContext* ctx);
 bool isInverted(const Susy::Lepton* lepton, Superlink* sl);
-bool isInverted(const Susy::Lepton* lepton);
-bool isPrompt(Susy::Lepton* lepton);
-bool isFNP(Susy::Lepton* lepton);
-bool isUnknownTruth(Susy::Lepton* lepton);
-void add_lepton_property_flags(Superflow* sf);
-void add_lepton_property_indexes(Superflow* sf);
-void add_mc_lepton_property_flags(Superflow* sf);
-void add_mc_lepton_property_indexes(Superflow* sf);
-IFF::Type get_IFF_class(Susy::Lepton* lep);
-const xAOD::Electron* to_iff_aod_electron(Susy::Electron& ele);
-const xAOD::Muon* to_iff_aod_muon(Susy::Muon& muo);
+bool isInverted(const Susy::Lepton* lepton, const EventContext* ctx);
+bool isPrompt(Susy::Lepton* lepton, EventContext* ctx);
+bool isFNP(Susy::Lepton* lepton, EventContext* ctx);
+bool isUnknownTruth(Susy::Lepton* lepton, EventContext* ctx);
+void add_lepton_property_flags(VarFlow* sf, EventContext* ctx);
+void add_lepton_property_indexes(VarFlow* sf, EventContext* ctx);
+void add_mc_lepton_property_flags(VarFlow* sf, EventContext* ctx);
+void add_mc_lepton_property_indexes(VarFlow* sf, EventContext* ctx);
+IFF::Type get_IFF_class(Susy::Lepton* lep, EventContext* ctx);
+IFF::Type classify_IFF(const Susy::Lepton* lep, EventContext* ctx);
+bool make_IFF_key(const Susy::Lepton* lep, uint64_t& key);
+void print_IFF_summary(const RunSummary& summary);
+PtEtaPhiM to_kin(double px, double py, double pz, double e);
+void validate_fast_math(Superlink* sl, EventContext* ctx);
+void print_fast_math_summary(const RunSummary& summary);
+const xAOD::Electron& to_iff_aod_electron(const Susy::Electron& ele, xAOD::Electron& e);
+const xAOD::Muon& to_iff_aod_muon(const Susy::Muon& muo, xAOD::Muon& m);
 int to_int(IFF::Type t);
 
-bool is_1lep_trig_matched(Superlink* sl, string trig_name, Susy::Lepton* lep, float pt_min = 0);
-bool is_2lep_trig_matched(Superlink* sl, string trig_name, Susy::Lepton* lep1, Susy::Lepton* lep2, float pt_min1 = 0, float pt_min2 = 0);
+bool compile_trigger_menu();
+void resolve_trigger_bits(TriggerTools& trig_tool, EventContext* ctx);
+const TrigMenu& trig_menu(int year);
+bool is_trig_fired(Superlink* sl, EventContext* ctx, Trig trig);
+int get_trig_match_index(Superlink* sl, EventContext* ctx, const TrigMenu& menu, Susy::Lepton* lep);
+bool is_1lep_trig_matched(Superlink* sl, EventContext* ctx, Trig trig, Susy::Lepton* lep, float pt_min = 0);
+bool is_2lep_trig_matched(Superlink* sl, EventContext* ctx, Trig trig, Susy::Lepton* lep1, Susy::Lepton* lep2, float pt_min1 = 0, float pt_min2 = 0);
+const SysInvariantCache::JetFlags& get_jet_flags(Superlink* sl, EventContext* ctx, Susy::Jet* jet);
+template<typename T> vector<T> gather(const vector<T>& col, const vector<int>& idx);
+const NearestDistances& get_nearest_distances(Superlink* sl, EventContext* ctx);
+const LepSystem& get_dilepton(EventContext* ctx);
+const LepSystem& get_Z_system(EventContext* ctx);
+const LepSystem& get_Z_probe_system(EventContext* ctx);
+const JigsawVars& get_jigsaw_vars(Superlink* sl, EventContext* ctx);
+void compute_jigsaw_vars(EventContext* ctx);
 #define ADD_LEP_TRIGGER_VAR(trig_name) { \
     *sf << NewVar(#trig_name" trigger bit"); { \
         *sf << HFTname(#trig_name); \
         *sf << [=](Superlink* /*sl*/, var_bool*) -> bool { \
-            return m_triggerPass.at(#trig_name); \
+            return ctx->m_triggerPass.test(to_idx(Trig::trig_name)); \
         }; \
         *sf << SaveVar(); \
     } \
 }
 
 // Addings a jigsaw variable
+// var_name must be a field of JigsawVars
 #define ADD_JIGSAW_VAR(var_name) { \
     *sf << NewVar(#var_name); { \
         *sf << HFTname(#var_name); \
-        *sf << [](Superlink* /*sl*/, var_float*) -> double { \
-            return m_jigsaw_vars.count(#var_name) ? m_jigsaw_vars.at(#var_name) : -DBL_MAX; }; \
+        *sf << [ctx](Superlink* sl, var_float*) -> double { \
+            return get_jigsaw_vars(sl, ctx).var_name; }; \
         *sf << SaveVar(); \
     } \
 }
 
 // Adding main lepton variables
-#define ADD_LEPTON_VARS(lep_name) { \
+// lep_stages are the stages that build the lepton collection, if the cuts do not
+#define ADD_LEPTON_VARS(lep_name, lep_stages) { \
     *sf << NewVar("number of "#lep_name"s"); { \
         *sf << HFTname("n_"#lep_name"s"); \
-        *sf << [](Superlink* /*sl*/, var_int*) -> int { return m_##lep_name##s.size();}; \
+        *sf << [ctx](Superlink* sl, var_int*) -> int { \
+            require_stages(sl, ctx, lep_stages); \
+            return ctx->m_##lep_name##s.size(); \
+        }; \
         *sf << SaveVar(); \
     } \
     *sf << NewVar(#lep_name" isEle"); { \
         *sf << HFTname(#lep_name"IsEle"); \
-        *sf << [](Superlink* /*sl*/, var_int_array*) -> vector<int> { \
-            vector<int> out; \
-            for(const auto& l : m_##lep_name##s) { out.push_back( l->isEle() ); } \
-            return out; \
+        *sf << [ctx](Superlink* sl, var_int_array*) -> vector<int> { \
+            require_stages(sl, ctx, lep_stages); \
+            return gather(ctx->m_lep_table.isEle, ctx->m_##lep_name##s_idx); \
         }; \
         *sf << SaveVar(); \
     } \
     *sf << NewVar(#lep_name" pT"); { \
         *sf << HFTname(#lep_name"Pt"); \
-        *sf << [=](Superlink* /*sl*/, var_float_array*) -> vector<double> { \
-            vector<double> out; \
-            for(const auto& l : m_##lep_name##s) { out.push_back( l->Pt() ); } \
-            return out; \
+        *sf << [ctx](Superlink* sl, var_float_array*) -> vector<double> { \
+            require_stages(sl, ctx, lep_stages); \
+            return gather(ctx->m_lep_table.pt, ctx->m_##lep_name##s_idx); \
         }; \
     *sf << SaveVar(); \
     } \
     *sf << NewVar(#lep_name" eta"); { \
         *sf << HFTname(#lep_name"Eta"); \
-        *sf << [](Superlink* /*sl*/, var_float_array*) -> vector<double> { \
-            vector<double> out; \
-            for(const auto& l : m_##lep_name##s) { out.push_back( l->Eta() ); } \
-            return out; \
+        *sf << [ctx](Superlink* sl, var_float_array*) -> vector<double> { \
+            require_stages(sl, ctx, lep_stages); \
+            return gather(ctx->m_lep_table.eta, ctx->m_##lep_name##s_idx); \
         }; \
         *sf << SaveVar(); \
     } \
     *sf << NewVar(#lep_name" clusBE2 eta"); { \
         *sf << HFTname(#lep_name"ClusEtaBE"); \
-        *sf << [](Superlink* /*sl*/, var_float_array*) -> vector<double> { \
-            vector<double> out; \
-            for(const auto& l : m_##lep_name##s) { \
-                if (l->isEle()) { \
-                    auto el = static_cast<Susy::Electron*>(l); \
-                    out.push_back(el->clusEtaBE); \
-                } else { \
-                    out.push_back(l->Eta()); \
-                } \
-            } \
-            return out; \
+        *sf << [ctx](Superlink* sl, var_float_array*) -> vector<double> { \
+            require_stages(sl, ctx, lep_stages); \
+            return gather(ctx->m_lep_table.clusEtaBE, ctx->m_##lep_name##s_idx); \
         }; \
         *sf << SaveVar(); \
     } \
     *sf << NewVar(#lep_name" phi"); { \
         *sf << HFTname(#lep_name"Phi"); \
-        *sf << [](Superlink* /*sl*/, var_float_array*) -> vector<double> { \
-            vector<double> out; \
-            for(const auto& l : m_##lep_name##s) { out.push_back( l->Phi() ); } \
-            return out; \
+        *sf << [ctx](Superlink* sl, var_float_array*) -> vector<double> { \
+            require_stages(sl, ctx, lep_stages); \
+            return gather(ctx->m_lep_table.phi, ctx->m_##lep_name##s_idx); \
         }; \
         *sf << SaveVar(); \
     } \
     *sf << NewVar(#lep_name" energy"); { \
         *sf << HFTname(#lep_name"E"); \
-        *sf << [](Superlink* /*sl*/, var_float_array*) -> vector<double> { \
-            vector<double> out; \
-            for(const auto& l : m_##lep_name##s) { out.push_back( l->E() ); } \
-            return out; \
+        *sf << [ctx](Superlink* sl, var_float_array*) -> vector<double> { \
+            require_stages(sl, ctx, lep_stages); \
+            return gather(ctx->m_lep_table.e, ctx->m_##lep_name##s_idx); \
         }; \
         *sf << SaveVar(); \
     } \
     *sf << NewVar(#lep_name" mass"); { \
         *sf << HFTname(#lep_name"M"); \
-        *sf << [](Superlink* /*sl*/, var_float_array*) -> vector<double> { \
-            vector<double> out; \
-            for(const auto& l : m_##lep_name##s) { out.push_back( l->M() ); } \
-            return out; \
+        *sf << [ctx](Superlink* sl, var_float_array*) -> vector<double> { \
+            require_stages(sl, ctx, lep_stages); \
+            return gather(ctx->m_lep_table.m, ctx->m_##lep_name##s_idx); \
         }; \
         *sf << SaveVar(); \
     } \
     *sf << NewVar(#lep_name" charge"); { \
         *sf << HFTname(#lep_name"q"); \
-        *sf << [](Superlink* /*sl*/, var_int_array*) -> vector<int> { \
-            vector<int> out; \
-            for(const auto& l : m_##lep_name##s) { out.push_back(l->q); } \
-            return out; \
+        *sf << [ctx](Superlink* sl, var_int_array*) -> vector<int> { \
+            require_stages(sl, ctx, lep_stages); \
+            return gather(ctx->m_lep_table.q, ctx->m_##lep_name##s_idx); \
         }; \
         *sf << SaveVar(); \
     } \
     *sf << NewVar(#lep_name" d0sigBSCorr"); { \
         *sf << HFTname(#lep_name"d0sigBSCorr"); \
-        *sf << [](Superlink* /*sl*/, var_float_array*) -> vector<double> { \
-            vector<double> out; \
-            for(const auto& l : m_##lep_name##s) { out.push_back(l->d0sigBSCorr); } \
-            return out; \
+        *sf << [ctx](Superlink* sl, var_float_array*) -> vector<double> { \
+            require_stages(sl, ctx, lep_stages); \
+            return gather(ctx->m_lep_table.d0sigBSCorr, ctx->m_##lep_name##s_idx); \
         }; \
         *sf << SaveVar(); \
     } \
     *sf << NewVar(#lep_name" z0SinTheta"); { \
         *sf << HFTname(#lep_name"z0SinTheta"); \
-        *sf << [](Superlink* /*sl*/, var_float_array*) -> vector<double> { \
-            vector<double> out; \
-            for(const auto& l : m_##lep_name##s) { out.push_back( l->z0SinTheta() ); } \
-            return out; \
+        *sf << [ctx](Superlink* sl, var_float_array*) -> vector<double> { \
+            require_stages(sl, ctx, lep_stages); \
+            return gather(ctx->m_lep_table.z0SinTheta, ctx->m_##lep_name##s_idx); \
         }; \
         *sf << SaveVar(); \
     } \
     *sf << NewVar(#lep_name" transverse mass"); { \
         *sf << HFTname(#lep_name"mT"); \
-        *sf << [](Superlink* /*sl*/, var_float_array*) -> vector<double> { \
-            vector<double> out; \
-            for(const auto& l : m_##lep_name##s) { \
-                double dphi = l->DeltaPhi(m_MET); \
-                double pT2 = l->Pt()*m_MET.Pt(); \
-                double lep_mT = sqrt(2 * pT2 * ( 1 - cos(dphi) )); \
-                out.push_back(lep_mT); \
-            } \
-            return out; \
+        *sf << [ctx](Superlink* sl, var_float_array*) -> vector<double> { \
+            require_stages(sl, ctx, lep_stages); \
+            return gather(ctx->m_lep_table.mT, ctx->m_##lep_name##s_idx); \
         }; \
         *sf << SaveVar(); \
     } \
     *sf << NewVar("delta Phi of "#lep_name" and met"); { \
         *sf << HFTname("dPhi_met_"#lep_name); \
-        *sf << [](Superlink* /*sl*/, var_float_array*) -> vector<double> { \
-            vector<double> out; \
-            for(const auto& l : m_##lep_name##s) { \
-                out.push_back( fabs(l->DeltaPhi(m_MET)) ); \
-            } \
-            return out; \
+        *sf << [ctx](Superlink* sl, var_float_array*) -> vector<double> { \
+            require_stages(sl, ctx, lep_stages); \
+            return gather(ctx->m_lep_table.dPhiMET, ctx->m_##lep_name##s_idx); \
         }; \
         *sf << SaveVar(); \
     } \
     *sf << NewVar("dR between "#lep_name" and closest lep"); { \
         *sf << HFTname("dR_lep_"#lep_name); \
-        *sf << [](Superlink* /*sl*/, var_float_array*) -> vector<double> { \
-            vector<double> out; \
-            for(const auto& l : m_##lep_name##s) { \
-                double dR = m_leps.size() ? DBL_MAX : -DBL_MAX; \
-                for (Susy::Lepton* l2 : m_leps) { \
-                    if (l2 == l) continue; \
-                    float tmp_dR = fabs(l2->DeltaR(*l)); \
-                    if (tmp_dR < dR) dR = tmp_dR; \
-                } \
-                out.push_back( fabs(dR) ); \
-            } \
-            return out; \
+        *sf << [ctx](Superlink* sl, var_float_array*) -> vector<double> { \
+            require_stages(sl, ctx, lep_stages); \
+            const NearestDistances& nearest = get_nearest_distances(sl, ctx); \
+            return gather(nearest.dR[NearestDistances::LEP], ctx->m_##lep_name##s_idx); \
         }; \
         *sf << SaveVar(); \
     } \
     *sf << NewVar("dR between "#lep_name" and closest jet"); { \
         *sf << HFTname("dR_jet_"#lep_name); \
-        *sf << [](Superlink* sl, var_float_array*) -> vector<double> { \
-            vector<double> out; \
-            for(const auto& l : m_##lep_name##s) { \
-                double dR = sl->jets->size() ? DBL_MAX : -DBL_MAX; \
-                for (Susy::Jet* jet : *sl->jets) { \
-                    float tmp_dR = fabs(jet->DeltaR(*l)); \
-                    if (tmp_dR < dR) dR = tmp_dR; \
-                } \
-                out.push_back( fabs(dR) ); \
-            } \
-            return out; \
+        *sf << [ctx](Superlink* sl, var_float_array*) -> vector<double> { \
+            require_stages(sl, ctx, lep_stages); \
+            const NearestDistances& nearest = get_nearest_distances(sl, ctx); \
+            return gather(nearest.dR[NearestDistances::JET], ctx->m_##lep_name##s_idx); \
         }; \
         *sf << SaveVar(); \
     } \
     *sf << NewVar("dR between "#lep_name" and closest b-jet"); { \
         *sf << HFTname("dR_bjet_"#lep_name); \
-        *sf << [](Superlink* sl, var_float_array*) -> vector<double> { \
-            vector<double> out; \
-            for(const auto& l : m_##lep_name##s) { \
-                double dR = sl->tools->numberOfBJets(*sl->jets) ? DBL_MAX : -DBL_MAX; \
-                for (Susy::Jet* jet : *sl->jets) { \
-                    if (!sl->tools->jetSelector().isBJet(jet)) continue; \
-                    float tmp_dR = fabs(jet->DeltaR(*l)); \
-                    if (tmp_dR < dR) dR = tmp_dR; \
-                } \
-                out.push_back( fabs(dR) ); \
-            } \
-            return out; \
+        *sf << [ctx](Superlink* sl, var_float_array*) -> vector<double> { \
+            require_stages(sl, ctx, lep_stages); \
+            const NearestDistances& nearest = get_nearest_distances(sl, ctx); \
+            return gather(nearest.dR[NearestDistances::BJET], ctx->m_##lep_name##s_idx); \
         }; \
         *sf << SaveVar(); \
     } \
     *sf << NewVar("dR between "#lep_name" and closest non b-jet"); { \
         *sf << HFTname("dR_nonbjet_"#lep_name); \
-        *sf << [](Superlink* sl, var_float_array*) -> vector<double> { \
-            vector<double> out; \
-            for(const auto& l : m_##lep_name##s) { \
-                double dR = sl->jets->size() ? DBL_MAX : -DBL_MAX; \
-                for (Susy::Jet* jet : *sl->jets) { \
-                    if (sl->tools->jetSelector().isBJet(jet)) continue; \
-                    float tmp_dR = fabs(jet->DeltaR(*l)); \
-                    if (tmp_dR < dR) dR = tmp_dR; \
-                } \
-                out.push_back( fabs(dR) ); \
-            } \
-            return out; \
+        *sf << [ctx](Superlink* sl, var_float_array*) -> vector<double> { \
+            require_stages(sl, ctx, lep_stages); \
+            const NearestDistances& nearest = get_nearest_distances(sl, ctx); \
+            return gather(nearest.dR[NearestDistances::NONBJET], ctx->m_##lep_name##s_idx); \
         }; \
         *sf << SaveVar(); \
     } \
     *sf << NewVar("dPhi between "#lep_name" and closest lep"); { \
         *sf << HFTname("dPhi_lep_"#lep_name); \
-        *sf << [](Superlink* /*sl*/, var_float_array*) -> vector<double> { \
-            vector<double> out; \
-            for(const auto& l : m_##lep_name##s) { \
-                double dPhi = m_leps.size() ? DBL_MAX : -DBL_MAX; \
-                for (Susy::Lepton* l2 : m_leps) { \
-                    if (l2 == l) continue; \
-                    float tmp_dPhi = fabs(l2->DeltaPhi(*l)); \
-                    if (tmp_dPhi < dPhi) dPhi = tmp_dPhi; \
-                } \
-                out.push_back( fabs(dPhi) ); \
-            } \
-            return out; \
+        *sf << [ctx](Superlink* sl, var_float_array*) -> vector<double> { \
+            require_stages(sl, ctx, lep_stages); \
+            const NearestDistances& nearest = get_nearest_distances(sl, ctx); \
+            return gather(nearest.dPhi[NearestDistances::LEP], ctx->m_##lep_name##s_idx); \
         }; \
         *sf << SaveVar(); \
     } \
     *sf << NewVar("dPhi between "#lep_name" and closest jet"); { \
         *sf << HFTname("dPhi_jet_"#lep_name); \
-        *sf << [](Superlink* sl, var_float_array*) -> vector<double> { \
-            vector<double> out; \
-            for(const auto& l : m_##lep_name##s) { \
-                double dPhi = sl->jets->size() ? DBL_MAX : -DBL_MAX; \
-                for (Susy::Jet* jet : *sl->jets) { \
-                    float tmp_dPhi = fabs(jet->DeltaPhi(*l)); \
-                    if (tmp_dPhi < dPhi) dPhi = tmp_dPhi; \
-                } \
-                out.push_back( fabs(dPhi) ); \
-            } \
-            return out; \
+        *sf << [ctx](Superlink* sl, var_float_array*) -> vector<double> { \
+            require_stages(sl, ctx, lep_stages); \
+            const NearestDistances& nearest = get_nearest_distances(sl, ctx); \
+            return gather(nearest.dPhi[NearestDistances::JET], ctx->m_##lep_name##s_idx); \
         }; \
         *sf << SaveVar(); \
     } \
     *sf << NewVar("dPhi between "#lep_name" and closest b-jet"); { \
         *sf << HFTname("dPhi_bjet_"#lep_name); \
-        *sf << [](Superlink* sl, var_float_array*) -> vector<double> { \
-            vector<double> out; \
-            for(const auto& l : m_##lep_name##s) { \
-                double dPhi = sl->tools->numberOfBJets(*sl->jets) ? DBL_MAX : -DBL_MAX; \
-                for (Susy::Jet* jet : *sl->jets) { \
-                    if (!sl->tools->jetSelector().isBJet(jet)) continue; \
-                    float tmp_dPhi = fabs(jet->DeltaPhi(*l)); \
-                    if (tmp_dPhi < dPhi) dPhi = tmp_dPhi; \
-                } \
-                out.push_back( fabs(dPhi) ); \
-            } \
-            return out; \
+        *sf << [ctx](Superlink* sl, var_float_array*) -> vector<double> { \
+            require_stages(sl, ctx, lep_stages); \
+            const NearestDistances& nearest = get_nearest_distances(sl, ctx); \
+            return gather(nearest.dPhi[NearestDistances::BJET], ctx->m_##lep_name##s_idx); \
         }; \
         *sf << SaveVar(); \
     } \
     *sf << NewVar("dPhi between "#lep_name" and closest non b-jet"); { \
         *sf << HFTname("dPhi_nonbjet_"#lep_name); \
-        *sf << [](Superlink* sl, var_float_array*) -> vector<double> { \
-            vector<double> out; \
-            for(const auto& l : m_##lep_name##s) { \
-                double dPhi = sl->jets->size() ? DBL_MAX : -DBL_MAX; \
-                for (Susy::Jet* jet : *sl->jets) { \
-                    if (sl->tools->jetSelector().isBJet(jet)) continue; \
-                    float tmp_dPhi = fabs(jet->DeltaPhi(*l)); \
-                    if (tmp_dPhi < dPhi) dPhi = tmp_dPhi; \
-                } \
-                out.push_back( fabs(dPhi) ); \
-            } \
-            return out; \
+        *sf << [ctx](Superlink* sl, var_float_array*) -> vector<double> { \
+            require_stages(sl, ctx, lep_stages); \
+            const NearestDistances& nearest = get_nearest_distances(sl, ctx); \
+            return gather(nearest.dPhi[NearestDistances::NONBJET], ctx->m_##lep_name##s_idx); \
         }; \
         *sf << SaveVar(); \
     } \
     *sf << NewVar("dEta between "#lep_name" and closest lep"); { \
         *sf << HFTname("dEta_lep_"#lep_name); \
-        *sf << [](Superlink* /*sl*/, var_float_array*) -> vector<double> { \
-            vector<double> out; \
-            for(const auto& l : m_##lep_name##s) { \
-                double dEta = m_leps.size() ? DBL_MAX : -DBL_MAX; \
-                for (Susy::Lepton* l2 : m_leps) { \
-                    if (l2 == l) continue; \
-                    float tmp_dEta = fabs(l2->Eta() - l->Eta()); \
-                    if (tmp_dEta < dEta) dEta = tmp_dEta; \
-                } \
-                out.push_back( fabs(dEta) ); \
-            } \
-            return out; \
+        *sf << [ctx](Superlink* sl, var_float_array*) -> vector<double> { \
+            require_stages(sl, ctx, lep_stages); \
+            const NearestDistances& nearest = get_nearest_distances(sl, ctx); \
+            return gather(nearest.dEta[NearestDistances::LEP], ctx->m_##lep_name##s_idx); \
         }; \
         *sf << SaveVar(); \
     } \
     *sf << NewVar("dEta between "#lep_name" and closest jet"); { \
         *sf << HFTname("dEta_jet_"#lep_name); \
-        *sf << [](Superlink* sl, var_float_array*) -> vector<double> { \
-            vector<double> out; \
-            for(const auto& l : m_##lep_name##s) { \
-                double dEta = sl->jets->size() ? DBL_MAX : -DBL_MAX; \
-                for (Susy::Jet* jet : *sl->jets) { \
-                    float tmp_dEta = fabs(jet->Eta() - l->Eta()); \
-                    if (tmp_dEta < dEta) dEta = tmp_dEta; \
-                } \
-                out.push_back( fabs(dEta) ); \
-            } \
-            return out; \
+        *sf << [ctx](Superlink* sl, var_float_array*) -> vector<double> { \
+            require_stages(sl, ctx, lep_stages); \
+            const NearestDistances& nearest = get_nearest_distances(sl, ctx); \
+            return gather(nearest.dEta[NearestDistances::JET], ctx->m_##lep_name##s_idx); \
         }; \
         *sf << SaveVar(); \
     } \
     *sf << NewVar("dEta between "#lep_name" and closest b-jet"); { \
         *sf << HFTname("dEta_bjet_"#lep_name); \
-        *sf << [](Superlink* sl, var_float_array*) -> vector<double> { \
-            vector<double> out; \
-            for(const auto& l : m_##lep_name##s) { \
-                double dEta = sl->tools->numberOfBJets(*sl->jets) ? DBL_MAX : -DBL_MAX; \
-                for (Susy::Jet* jet : *sl->jets) { \
-                    if (!sl->tools->jetSelector().isBJet(jet)) continue; \
-                    float tmp_dEta = fabs(jet->Eta() - l->Eta()); \
-                    if (tmp_dEta < dEta) dEta = tmp_dEta; \
-                } \
-                out.push_back( fabs(dEta) ); \
-            } \
-            return out; \
+        *sf << [ctx](Superlink* sl, var_float_array*) -> vector<double> { \
+            require_stages(sl, ctx, lep_stages); \
+            const NearestDistances& nearest = get_nearest_distances(sl, ctx); \
+            return gather(nearest.dEta[NearestDistances::BJET], ctx->m_##lep_name##s_idx); \
         }; \
         *sf << SaveVar(); \
     } \
     *sf << NewVar("dEta between "#lep_name" and closest non b-jet"); { \
         *sf << HFTname("dEta_nonbjet_"#lep_name); \
-        *sf << [](Superlink* sl, var_float_array*) -> vector<double> { \
-            vector<double> out; \
-            for(const auto& l : m_##lep_name##s) { \
-                double dEta = sl->jets->size() ? DBL_MAX : -DBL_MAX; \
-                for (Susy::Jet* jet : *sl->jets) { \
-                    if (sl->tools->jetSelector().isBJet(jet)) continue; \
-                    float tmp_dEta = fabs(jet->Eta() - l->Eta()); \
-                    if (tmp_dEta < dEta) dEta = tmp_dEta; \
-                } \
-                out.push_back( fabs(dEta) ); \
-            } \
-            return out; \
+        *sf << [ctx](Superlink* sl, var_float_array*) -> vector<double> { \
+            require_stages(sl, ctx, lep_stages); \
+            const NearestDistances& nearest = get_nearest_distances(sl, ctx); \
+            return gather(nearest.dEta[NearestDistances::NONBJET], ctx->m_##lep_name##s_idx); \
         }; \
         *sf << SaveVar(); \
     } \
     *sf << NewVar(#lep_name" truth type"); { \
         *sf << HFTname(#lep_name"TruthType"); \
-        *sf << [](Superlink* /*sl*/, var_int_array*) -> vector<int> { \
+        *sf << [ctx](Superlink* sl, var_int_array*) -> vector<int> { \
+            require_stages(sl, ctx, lep_stages); \
             vector<int> out; \
-            for(const auto& l : m_##lep_name##s) { out.push_back(l->mcType); } \
+            for(const auto& l : ctx->m_##lep_name##s) { out.push_back(l->mcType); } \
             return out; \
         }; \
         *sf << SaveVar(); \
     } \
     *sf << NewVar(#lep_name" truth origin"); { \
         *sf << HFTname(#lep_name"TruthOrigin"); \
-        *sf << [](Superlink* /*sl*/, var_int_array*) -> vector<int> { \
+        *sf << [ctx](Superlink* sl, var_int_array*) -> vector<int> { \
+            require_stages(sl, ctx, lep_stages); \
             vector<int> out; \
-            for(const auto& l : m_##lep_name##s) { out.push_back(l->mcOrigin); } \
+            for(const auto& l : ctx->m_##lep_name##s) { out.push_back(l->mcOrigin); } \
             return out; \
         }; \
         *sf << SaveVar(); \
     } \
     *sf << NewVar(#lep_name" truth mother type"); { \
         *sf << HFTname(#lep_name"TruthMotherType"); \
-        *sf << [](Superlink* /*sl*/, var_int_array*) -> vector<int> { \
+        *sf << [ctx](Superlink* sl, var_int_array*) -> vector<int> { \
+            require_stages(sl, ctx, lep_stages); \
             vector<int> out; \
-            for(const auto& l : m_##lep_name##s) { out.push_back(l->mcFirstEgMotherTruthType); } \
+            for(const auto& l : ctx->m_##lep_name##s) { out.push_back(l->mcFirstEgMotherTruthType); } \
             return out; \
         }; \
         *sf << SaveVar(); \
     } \
     *sf << NewVar(#lep_name" truth mother origin"); { \
         *sf << HFTname(#lep_name"TruthMotherOrigin"); \
-        *sf << [](Superlink* /*sl*/, var_int_array*) -> vector<int> { \
+        *sf << [ctx](Superlink* sl, var_int_array*) -> vector<int> { \
+            require_stages(sl, ctx, lep_stages); \
             vector<int> out; \
-            for(const auto& l : m_##lep_name##s) { out.push_back(l->mcFirstEgMotherTruthOrigin); } \
+            for(const auto& l : ctx->m_##lep_name##s) { out.push_back(l->mcFirstEgMotherTruthOrigin); } \
             return out; \
         }; \
         *sf << SaveVar(); \
     } \
     *sf << NewVar(#lep_name" truth mother PDG ID"); { \
         *sf << HFTname(#lep_name"TruthMotherPDGID"); \
-        *sf << [](Superlink* /*sl*/, var_int_array*) -> vector<int> { \
+        *sf << [ctx](Superlink* sl, var_int_array*) -> vector<int> { \
+            require_stages(sl, ctx, lep_stages); \
             vector<int> out; \
-            for(const auto& l : m_##lep_name##s) { out.push_back(l->mcFirstEgMotherPdgId); } \
+            for(const auto& l : ctx->m_##lep_name##s) { out.push_back(l->mcFirstEgMotherPdgId); } \
             return out; \
         }; \
         *sf << SaveVar(); \
     } \
     *sf << NewVar(#lep_name" truth IFF class"); { \
         *sf << HFTname(#lep_name"TruthIFFClass"); \
-        *sf << [](Superlink* /*sl*/, var_int_array*) -> vector<int> { \
+        *sf << [ctx](Superlink* sl, var_int_array*) -> vector<int> { \
+            require_stages(sl, ctx, lep_stages); \
             vector<int> out; \
-            for(const auto& l : m_##lep_name##s) { out.push_back( to_int(get_IFF_class(l)) ); } \
+            for(const auto& l : ctx->m_##lep_name##s) { out.push_back( to_int(get_IFF_class(l, ctx)) ); } \
             return out; \
         }; \
         *sf << SaveVar(); \
@@ -748,94 +1155,169 @@ int main(int argc, char* argv[])
     /////////////////////////////////////////////////////////////////////
     // Read in the command-line options (input file, num events, etc...)
     ////////////////////////////////////////////////////////////////////
+    if(!read_ana_options(argc, argv, m_ana_options)) {
+        exit(1);
+    }
     SFOptions options(argc, argv);
     options.ana_name = m_ana_name;
     if(!read_options(options)) {
         exit(1);
     }
+    if (!compile_trigger_menu()) {
+        exit(1);
+    }
 
-    if (options.ana_selection == "baseline_DF") {
-        m_baseline_DF = true;
-        cout << "INFO :: Running baseline DF selections\n";
-    } else if (options.ana_selection == "baseline_SS") {
-        m_baseline_SS = true;
-        cout << "INFO :: Running baseline SF selections\n";
-    } else if (options.ana_selection == "baseline_SS_den") {
-        m_baseline_SS_den = true;
-        cout << "INFO :: Running baseline SF denominator selections\n";
-    } else if (options.ana_selection == "zjets3l") {
-        m_zjets_3l = true;
-        cout << "INFO :: Running Z+jets selections\n";
-    } else if (options.ana_selection == "fake_baseline_DF") {
-        m_fake_baseline_DF = true;
-        cout << "INFO :: Running baseline DF denominator selections\n";
-    } else if (options.ana_selection == "fake_zjets3l") {
-        m_fake_zjets_3l = true;
-        cout << "INFO :: Running Z+jets denominator selections\n";
-    } else if (options.ana_selection == "zjets2l_inc") {
-        m_zjets2l_inc = true;
-        cout << "INFO :: Running Z+jets 2 lepton inclusive selections\n";
-    } else {
-        cout << "ERROR :: Unknown analysis selection:" << options.ana_selection << '\n';
+    string selection_list = options.ana_selection;
+    if (selection_list == "all") {
+        // Every selection that can share a pass over the input, see can_overlap
+        selection_list = "baseline_DF,baseline_SS,baseline_SS_den,zjets3l,"
+                         "fake_baseline_DF,fake_zjets3l";
+        cout << "INFO :: Selection \"all\" leaves out zjets2l_inc, which overlaps zjets3l"
+             << " and fake_zjets3l and needs a job of its own\n";
+    }
+    std::stringstream selection_stream(selection_list);
+    string sel_name;
+    while (std::getline(selection_stream, sel_name, ',')) {
+        if (!add_selection(sel_name)) {
+            exit(1);
+        }
+    }
+    if (m_selections.empty()) {
+        cout << "ERROR :: No analysis selection given\n";
+        exit(1);
+    }
+    // A multi-selection job writes one row per event, which carries the
+    // state of a single selection
+    for (uint isel = 0; isel < m_selections.size(); ++isel) {
+        for (uint jsel = isel + 1; jsel < m_selections.size(); ++jsel) {
+            if (!can_overlap(m_selections.at(isel), m_selections.at(jsel))) continue;
+            cout << "ERROR :: Selections " << selection_name(m_selections.at(isel)) << " and "
+                 << selection_name(m_selections.at(jsel)) << " can pass the same events,"
+                 << " run them in separate jobs\n";
+            exit(1);
+        }
+    }
+    if (m_selections.size() > 1 && options.output_name == "") {
+        cout << "ERROR :: Multi-selection mode requires an explicit output file name\n";
+        exit(1);
+    }
+    if (m_ana_options.output_format == "rntuple" && options.output_name == "") {
+        cout << "ERROR :: RNTuple output requires an explicit output file name\n";
         exit(1);
     }
+    bool cache_found = false;
+    if (m_ana_options.entry_cache != "") {
+        cache_found = read_entry_cache(m_ana_options.entry_cache, options.input, m_file_entries);
+        if (!cache_found) m_file_entries.clear();
+    }
     // New TChain* added to heap, remember to delete later
     TChain* chain = create_new_chain(options.input, m_input_ttree_name, m_verbose);
 
     Long64_t tot_num_events = chain->GetEntries();
-    options.n_events_to_process = (options.n_events_to_process < 0 ? tot_num_events : options.n_events_to_process);
-
-    xAOD::TEvent* tEvent = new xAOD::TEvent(); (void)tEvent;
-    xAOD::TStore* tStore = new xAOD::TStore(); (void)tStore;
+    if (m_ana_options.entry_cache != "" && !cache_found) {
+        // Counting the entries above opened every file so save the result
+        m_file_entries = get_file_entries(chain);
+        write_entry_cache(m_ana_options.entry_cache, options.input, m_file_entries);
+    }
+    if (m_ana_options.n_plan_jobs > 0) {
+        if (m_file_entries.empty()) m_file_entries = get_file_entries(chain);
+        print_shard_plan(m_file_entries, m_ana_options.n_plan_jobs);
+        delete chain;
+        exit(0);
+    }
 
-    ////////////////////////////////////////////////////////////
-    // Initialize & configure the analysis
-    //  > Superflow inherits from SusyNtAna : TSelector
-    ////////////////////////////////////////////////////////////
-    Superflow* superflow = create_new_superflow(options, chain);
+    // Entry range to process
+    Long64_t first_entry = 0;
+    Long64_t last_entry = tot_num_events - 1;
+    if (m_ana_options.n_shards > 0) {
+        first_entry = m_ana_options.shard_index * tot_num_events / m_ana_options.n_shards;
+        last_entry = (m_ana_options.shard_index + 1) * tot_num_events / m_ana_options.n_shards - 1;
+        if (options.output_name == "") {
+            // Keep the default output names of different shards apart
+            options.suffix_name += "shard" + std::to_string(m_ana_options.shard_index)
+                                 + "of" + std::to_string(m_ana_options.n_shards);
+        }
+    } else {
+        if (m_ana_options.first_entry >= 0) first_entry = m_ana_options.first_entry;
+        if (m_ana_options.last_entry >= 0) last_entry = std::min(m_ana_options.last_entry, tot_num_events - 1);
+    }
+    if (first_entry > last_entry && tot_num_events > 0) {
+        if (m_ana_options.n_shards > 0) {
+            // More shards than entries, expected when jobs are submitted automatically
+            cout << m_ana_name << "    Shard " << m_ana_options.shard_index << "/" << m_ana_options.n_shards
+                 << " of " << tot_num_events << " entries is empty, nothing to do\n";
+            delete chain;
+            exit(0);
+        }
+        cout << "ERROR :: Empty entry range [" << first_entry << ", " << last_entry << "]\n";
+        exit(1);
+    }
+    Long64_t n_range_entries = last_entry - first_entry + 1;
+    options.n_events_to_process = (options.n_events_to_process < 0 ? n_range_entries : std::min<Long64_t>(options.n_events_to_process, n_range_entries));
+    if (first_entry != 0 || n_range_entries != tot_num_events) {
+        cout << options.ana_name << "    Processing entries [" << first_entry << ", "
+             << first_entry + options.n_events_to_process - 1 << "]\n";
+    }
 
     cout << options.ana_name << "    Total Entries: " << chain->GetEntries() << endl;
     //if (options.run_mode == SuperflowRunMode::single_event_syst) sf->setSingleEventSyst(nt_sys_);
 
-    // Set variables for use in other cuts/vars. MUST ADD FIRST!
-    // TODO: Move to after cleaning cuts and remove globals from cutflow
-    set_global_variables(superflow);
+    if (m_ana_options.n_threads > 1) {
+        // Each worker builds its own chain, xAOD event and store and Superflow
+        delete chain;
+        RunSummary summary;
+        if (!run_multithreaded(options, m_ana_options.n_threads, first_entry, summary)) {
+            exit(1);
+        }
+        if (!finalize_output(options.output_name, summary)) {
+            exit(1);
+        }
+        cout << m_ana_name << "    Done." << endl;
+        exit(0);
+    }
 
-    // Event selections
-    add_cleaning_cuts(superflow);
-    add_analysis_cuts(superflow);
-    //add_4bcutflow_cuts(superflow);
+    xAOD::TEvent* tEvent = new xAOD::TEvent(); (void)tEvent;
+    xAOD::TStore* tStore = new xAOD::TStore(); (void)tStore;
 
-    // Output variables
-    add_event_variables(superflow);
-    add_trigger_variables(superflow);
-    add_lepton_variables(superflow);
-    add_mc_lepton_variables(superflow);
-    add_jet_variables(superflow);
-    add_met_variables(superflow);
-    add_dilepton_variables(superflow);
-    if (m_baseline_DF || m_baseline_SS || m_baseline_SS_den || m_fake_baseline_DF) {
-        add_jigsaw_variables(superflow);
-    } else if (m_zjets_3l || m_fake_zjets_3l || m_zjets2l_inc) {
-        add_Zlepton_variables(superflow);
+    if (m_ana_options.checkpoint_every > 0) {
+        // Each block of entries builds its own chain and Superflow
+        delete chain;
+        RunSummary summary;
+        if (!run_with_checkpoints(options, first_entry, m_ana_options.checkpoint_every, m_ana_options.resume, summary)) {
+            exit(1);
+        }
+        if (!finalize_output(options.output_name, summary)) {
+            exit(1);
+        }
+        cout << m_ana_name << "    Done." << endl;
+        exit(0);
     }
-    if (m_zjets_3l || m_fake_zjets_3l) {
-        add_Zll_probeLep_variables(superflow);
-    };
-    add_miscellaneous_variables(superflow);
-    add_multi_object_variables(superflow);
 
-    // Systematics
-    add_weight_systematics(superflow);
-    add_shape_systematics(superflow);
+    ////////////////////////////////////////////////////////////
+    // Initialize & configure the analysis
+    //  > Superflow inherits from SusyNtAna : TSelector
+    ////////////////////////////////////////////////////////////
+    EventContext ctx;
+    Superflow* superflow = build_superflow(options, chain, &ctx);
 
     // Run Superflow
-    chain->Process(superflow, options.input.c_str(), options.n_events_to_process);
+    chain->Process(superflow, options.input.c_str(), options.n_events_to_process, first_entry);
+    RunSummary summary;
+    summary.add(ctx);
+    print_run_summary(summary);
+    if (m_ana_options.profile_cuts != "") {
+        print_cut_profile(ctx.m_cut_profiles);
+        if (!write_cut_profile(m_ana_options.profile_cuts, ctx.m_cut_profiles)) exit(1);
+    }
 
     // Clean up
     delete superflow;
     delete chain;
 
+    if (!finalize_output(options.output_name, summary)) {
+        exit(1);
+    }
+
     cout << m_ana_name << "    Done." << endl;
     exit(0);
 }
@@ -843,9 +1325,584 @@ int main(int argc, char* argv[])
 ////////////////////////////////////////////////////////////////////////////////
 // Function definitions
 ////////////////////////////////////////////////////////////////////////////////
+bool read_ana_options(int& argc, char* argv[], AnaOptions& ana_options) {
+    // Consumed options are removed from argv so Superflow never sees them
+    int n_kept = 1;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--threads") {
+            if (i + 1 >= argc) {
+                cout << "ERROR :: " << arg << " requires an argument\n";
+                return false;
+            }
+            ana_options.n_threads = atoi(argv[++i]);
+            if (ana_options.n_threads < 1) {
+                cout << "ERROR :: Number of threads must be positive: " << argv[i] << '\n';
+                return false;
+            }
+        } else if (arg == "--first-entry" || arg == "--last-entry") {
+            if (i + 1 >= argc) {
+                cout << "ERROR :: " << arg << " requires an argument\n";
+                return false;
+            }
+            Long64_t entry = atoll(argv[++i]);
+            if (entry < 0) {
+                cout << "ERROR :: " << arg << " must be non-negative: " << argv[i] << '\n';
+                return false;
+            }
+            (arg == "--first-entry" ? ana_options.first_entry : ana_options.last_entry) = entry;
+        } else if (arg == "--shard") {
+            if (i + 1 >= argc) {
+                cout << "ERROR :: " << arg << " requires an argument\n";
+                return false;
+            }
+            string shard = argv[++i];
+            size_t slash = shard.find('/');
+            if (slash != string::npos) {
+                ana_options.shard_index = atoi(shard.substr(0, slash).c_str());
+                ana_options.n_shards = atoi(shard.substr(slash + 1).c_str());
+            }
+            if (slash == string::npos || ana_options.n_shards < 1
+                || ana_options.shard_index < 0 || ana_options.shard_index >= ana_options.n_shards) {
+                cout << "ERROR :: Expected --shard k/N with 0 <= k < N: " << shard << '\n';
+                return false;
+            }
+        } else if (arg == "--checkpoint-every") {
+            if (i + 1 >= argc) {
+                cout << "ERROR :: " << arg << " requires an argument\n";
+                return false;
+            }
+            ana_options.checkpoint_every = atoll(argv[++i]);
+            if (ana_options.checkpoint_every < 1) {
+                cout << "ERROR :: Checkpoint interval must be positive: " << argv[i] << '\n';
+                return false;
+            }
+        } else if (arg == "--resume") {
+            ana_options.resume = true;
+        } else if (arg == "--packed-triggers") {
+            ana_options.packed_triggers = true;
+        } else if (arg == "--no-iff-lut") {
+            ana_options.iff_lut = false;
+        } else if (arg == "--validate-iff-lut") {
+            if (i + 1 >= argc) {
+                cout << "ERROR :: " << arg << " requires an argument\n";
+                return false;
+            }
+            ana_options.validate_iff_every = atoi(argv[++i]);
+            if (ana_options.validate_iff_every < 1) {
+                cout << "ERROR :: IFF validation interval must be positive: " << argv[i] << '\n';
+                return false;
+            }
+        } else if (arg == "--branches") {
+            if (i + 1 >= argc) {
+                cout << "ERROR :: " << arg << " requires an argument\n";
+                return false;
+            }
+            ana_options.branches = argv[++i];
+        } else if (arg == "--float32-outputs") {
+            ana_options.float32_outputs = true;
+        } else if (arg == "--truncate-mantissa") {
+            if (i + 1 >= argc) {
+                cout << "ERROR :: " << arg << " requires an argument\n";
+                return false;
+            }
+            ana_options.truncate_mantissa = argv[++i];
+        } else if (arg == "--profile-cuts" || arg == "--reorder-cuts") {
+            if (i + 1 >= argc) {
+                cout << "ERROR :: " << arg << " requires an argument\n";
+                return false;
+            }
+            (arg == "--profile-cuts" ? ana_options.profile_cuts : ana_options.reorder_cuts) = argv[++i];
+        } else if (arg == "--mt2-precision") {
+            if (i + 1 >= argc) {
+                cout << "ERROR :: " << arg << " requires an argument\n";
+                return false;
+            }
+            ana_options.mt2_precision = atof(argv[++i]);
+            if (ana_options.mt2_precision <= 0 || ana_options.mt2_precision >= 1) {
+                cout << "ERROR :: MT2 precision must be between 0 and 1: " << argv[i] << '\n';
+                return false;
+            }
+        } else if (arg == "--fast-math") {
+            ana_options.fast_math = true;
+        } else if (arg == "--validate-fast-math") {
+            if (i + 1 >= argc) {
+                cout << "ERROR :: " << arg << " requires an argument\n";
+                return false;
+            }
+            ana_options.validate_fast_math_every = atoi(argv[++i]);
+            if (ana_options.validate_fast_math_every < 1) {
+                cout << "ERROR :: Fast math validation interval must be positive: " << argv[i] << '\n';
+                return false;
+            }
+        } else if (arg == "--output-format") {
+            if (i + 1 >= argc) {
+                cout << "ERROR :: " << arg << " requires an argument\n";
+                return false;
+            }
+            ana_options.output_format = argv[++i];
+            if (ana_options.output_format != "ttree" && ana_options.output_format != "rntuple") {
+                cout << "ERROR :: Unknown output format (ttree or rntuple): " << argv[i] << '\n';
+                return false;
+            }
+            if (ana_options.output_format == "rntuple" && !Stop2L::rntuple_output_supported()) {
+                cout << "ERROR :: RNTuple output requires ROOT 6.28 or newer\n";
+                return false;
+            }
+        } else if (arg == "--entry-cache") {
+            if (i + 1 >= argc) {
+                cout << "ERROR :: " << arg << " requires an argument\n";
+                return false;
+            }
+            ana_options.entry_cache = argv[++i];
+        } else if (arg == "--plan-shards") {
+            if (i + 1 >= argc) {
+                cout << "ERROR :: " << arg << " requires an argument\n";
+                return false;
+            }
+            ana_options.n_plan_jobs = atoi(argv[++i]);
+            if (ana_options.n_plan_jobs < 1) {
+                cout << "ERROR :: Number of planned jobs must be positive: " << argv[i] << '\n';
+                return false;
+            }
+        } else {
+            argv[n_kept++] = argv[i];
+        }
+    }
+    argc = n_kept;
+    argv[argc] = nullptr;
+    if (ana_options.n_shards > 0 && (ana_options.first_entry >= 0 || ana_options.last_entry >= 0)) {
+        cout << "ERROR :: --shard cannot be combined with --first-entry/--last-entry\n";
+        return false;
+    }
+    if (ana_options.resume && ana_options.checkpoint_every == 0) {
+        cout << "ERROR :: --resume requires the --checkpoint-every of the interrupted job\n";
+        return false;
+    }
+    if (ana_options.checkpoint_every > 0 && ana_options.n_threads > 1) {
+        cout << "ERROR :: Checkpointing is not supported in multi-threaded mode\n";
+        return false;
+    }
+    if (ana_options.branches != "") {
+        // A readable file lists the patterns, anything else is the list itself
+        if (!m_branch_selection.read_file(ana_options.branches)) {
+            m_branch_selection.add_patterns(ana_options.branches);
+        }
+        if (m_branch_selection.empty()) {
+            cout << "ERROR :: No output branches selected by --branches " << ana_options.branches << '\n';
+            return false;
+        }
+    }
+    if (ana_options.profile_cuts != "" && ana_options.reorder_cuts != "") {
+        cout << "ERROR :: Cuts are profiled in their canonical order, drop --reorder-cuts\n";
+        return false;
+    }
+    if (ana_options.profile_cuts != "" && (ana_options.n_threads > 1 || ana_options.checkpoint_every > 0)) {
+        cout << "ERROR :: Cut profiling requires a single-threaded job without checkpoints\n";
+        return false;
+    }
+    if (ana_options.reorder_cuts != "") {
+        if (!read_cut_profile(ana_options.reorder_cuts, m_cut_profile)) return false;
+        if (m_cut_profile.empty()) {
+            cout << "ERROR :: Cut profile " << ana_options.reorder_cuts << " lists no cuts\n";
+            return false;
+        }
+    }
+    if (ana_options.validate_fast_math_every > 0 && !ana_options.fast_math) {
+        cout << "ERROR :: --validate-fast-math requires --fast-math\n";
+        return false;
+    }
+    if (ana_options.mt2_precision > 0) m_mt2_solver.set_precision(ana_options.mt2_precision);
+    m_output_precision.set_float32(ana_options.float32_outputs);
+    if (!m_output_precision.add_rules(ana_options.truncate_mantissa)) {
+        cout << "ERROR :: Expected --truncate-mantissa pattern:bits[,pattern:bits...] with 0 <= bits <= "
+             << Stop2L::FLOAT_MANTISSA_BITS << ": " << ana_options.truncate_mantissa << '\n';
+        return false;
+    }
+    return true;
+}
+bool read_entry_cache(const string& cache_name, const string& input, vector< pair<string, Long64_t> >& file_entries) {
+    // Format: a header line naming the input followed by "<file> <entries>"
+    // for each file of the chain, in chain order
+    std::ifstream cache(cache_name);
+    if (!cache.is_open()) {
+        cout << m_ana_name << "    No entry cache found at " << cache_name << ", it will be created\n";
+        return false;
+    }
+    string line;
+    std::getline(cache, line);
+    if (line != "# input: " + input) {
+        cout << "WARNING :: Entry cache " << cache_name << " was made for a different input, ignoring it\n";
+        return false;
+    }
+    file_entries.clear();
+    string file_name;
+    Long64_t n_entries;
+    while (cache >> file_name >> n_entries) {
+        file_entries.emplace_back(file_name, n_entries);
+    }
+    if (file_entries.empty()) {
+        cout << "WARNING :: Entry cache " << cache_name << " lists no files, ignoring it\n";
+        return false;
+    }
+    // The files behind the same input (a file list or directory) can change
+    vector<string> input_files = get_input_files(input);
+    bool same_files = input_files.size() == file_entries.size();
+    for (size_t ifile = 0; same_files && ifile < input_files.size(); ++ifile) {
+        same_files = input_files[ifile] == file_entries[ifile].first;
+    }
+    if (!same_files) {
+        cout << "WARNING :: Entry cache " << cache_name << " lists " << file_entries.size()
+             << " files but the input now has " << input_files.size()
+             << " or different ones, ignoring it\n";
+        return false;
+    }
+    cout << m_ana_name << "    Read entries of " << file_entries.size()
+         << " files from " << cache_name << '\n';
+    return true;
+}
+bool write_entry_cache(const string& cache_name, const string& input, const vector< pair<string, Long64_t> >& file_entries) {
+    std::ofstream cache(cache_name);
+    if (!cache.is_open()) {
+        cout << "WARNING :: Unable to write entry cache " << cache_name << '\n';
+        return false;
+    }
+    cache << "# input: " << input << '\n';
+    for (const auto& it : file_entries) {
+        cache << it.first << ' ' << it.second << '\n';
+    }
+    cout << m_ana_name << "    Wrote entries of " << file_entries.size()
+         << " files to " << cache_name << '\n';
+    return true;
+}
+vector< pair<string, Long64_t> > get_file_entries(TChain* chain) {
+    // Only valid once the chain entries have been counted (GetEntries)
+    vector< pair<string, Long64_t> > file_entries;
+    TObjArray* files = chain->GetListOfFiles();
+    for (int ifile = 0; ifile < files->GetEntries(); ++ifile) {
+        TChainElement* element = static_cast<TChainElement*>(files->At(ifile));
+        file_entries.emplace_back(element->GetTitle(), element->GetEntries());
+    }
+    return file_entries;
+}
+vector<string> get_input_files(const string& input) {
+    // Resolves the input like create_new_chain without opening the files
+    TChain chain(m_input_ttree_name.c_str());
+    chain.SetDirectory(0);
+    ChainHelper::addInput(&chain, input, false);
+    vector<string> file_names;
+    TObjArray* files = chain.GetListOfFiles();
+    for (int ifile = 0; ifile < files->GetEntries(); ++ifile) {
+        file_names.push_back(static_cast<TChainElement*>(files->At(ifile))->GetTitle());
+    }
+    return file_names;
+}
+void print_shard_plan(const vector< pair<string, Long64_t> >& file_entries, int n_jobs) {
+    // Same partitioning as --shard k/N: N contiguous entry ranges whose sizes
+    // differ by at most one entry
+    Long64_t n_total = 0;
+    for (const auto& it : file_entries) n_total += it.second;
+    if (n_jobs > n_total) n_jobs = std::max<Long64_t>(n_total, 1);
+    cout << m_ana_name << "    Splitting " << n_total << " entries in "
+         << file_entries.size() << " files into " << n_jobs << " jobs\n";
+    uint ifile = 0;
+    Long64_t file_offset = 0;
+    for (int ijob = 0; ijob < n_jobs; ++ijob) {
+        Long64_t first = ijob * n_total / n_jobs;
+        Long64_t last = (ijob + 1) * n_total / n_jobs - 1;
+        // Files overlapping the entry range
+        while (ifile < file_entries.size() && file_offset + file_entries.at(ifile).second <= first) {
+            file_offset += file_entries.at(ifile++).second;
+        }
+        uint jfile = ifile;
+        Long64_t jfile_offset = file_offset;
+        while (jfile + 1 < file_entries.size() && jfile_offset + file_entries.at(jfile).second <= last) {
+            jfile_offset += file_entries.at(jfile++).second;
+        }
+        cout << "  --shard " << ijob << "/" << n_jobs
+             << " : entries [" << first << ", " << last << "]"
+             << ", " << last - first + 1 << " entries"
+             << ", files " << ifile << "-" << jfile << '\n';
+    }
+}
+EventContext::EventContext(const string& tool_suffix) :
+    m_truthClassifier("truthClassifier" + tool_suffix)
+{
+    // Generous upper bounds on the object multiplicities of a single event
+    const size_t max_leps = 8;
+    const size_t max_jets = 32;
+    m_light_jets.reserve(max_jets);
+    for (vector<unsigned char>* col : {&m_jet_table.flags, &m_jet_table.isB}) col->reserve(max_jets);
+    for (vector<double>* col : {&m_jet_table.eta, &m_jet_table.phi}) col->reserve(max_jets);
+    m_jet_table.kin.reserve(max_jets);
+    for (LeptonVector* lv : {&m_leps, &m_sigLeps, &m_invLeps, &m_promptLeps,
+                             &m_fnpLeps, &m_promptSigLeps, &m_promptInvLeps,
+                             &m_fnpSigLeps, &m_fnpInvLeps, &m_ZLeps, &m_probeLeps,
+                             &m_prefTrigLeps, &m_allTrigLeps}) {
+        lv->reserve(max_leps);
+    }
+    for (vector<int>* idx : {&m_leps_idx, &m_sigLeps_idx, &m_invLeps_idx,
+                             &m_promptLeps_idx, &m_fnpLeps_idx, &m_promptSigLeps_idx,
+                             &m_promptInvLeps_idx, &m_fnpSigLeps_idx, &m_fnpInvLeps_idx,
+                             &m_ZLeps_idx, &m_probeLeps_idx, &m_trigMatch_idx}) {
+        idx->reserve(max_leps);
+    }
+    m_iff_electron.makePrivateStore();
+    m_iff_muon.makePrivateStore();
+    m_sys_cache.m_trig_leps.reserve(SysInvariantCache::MAX_TRIG_LEPS);
+    m_jigsaw_objects["leptons"].resize(2);
+    m_jigsaw_objects["met"].resize(1);
+}
+void EventContext::clear() {
+    m_cutflags = 0;
+    m_stages_done = 0;
+    m_cleaning_chain.clear();
+    m_jet_table.clear();
+    m_light_jets.clear();
+    m_MET = PtEtaPhiM();
+    m_leps.clear();
+    m_sigLeps.clear();
+    m_invLeps.clear();
+    m_promptLeps.clear();
+    m_fnpLeps.clear();
+    m_promptSigLeps.clear();
+    m_promptInvLeps.clear();
+    m_fnpSigLeps.clear();
+    m_fnpInvLeps.clear();
+    m_lep_table.clear();
+    m_nearest_valid = false;
+    m_dilep.valid = false;
+    for (vector<int>* idx : {&m_leps_idx, &m_sigLeps_idx, &m_invLeps_idx,
+                             &m_promptLeps_idx, &m_fnpLeps_idx, &m_promptSigLeps_idx,
+                             &m_promptInvLeps_idx, &m_fnpSigLeps_idx, &m_fnpInvLeps_idx}) {
+        idx->clear();
+    }
+    clear_region();
+}
+void EventContext::clear_region() {
+    m_ZLeps.clear();
+    m_probeLeps.clear();
+    m_Zsys.valid = false;
+    m_Zprobe.valid = false;
+    m_ZLeps_idx.clear();
+    m_probeLeps_idx.clear();
+    m_prefTrigLeps.clear();
+    m_allTrigLeps.clear();
+    m_triggerPass.reset();
+}
+bool add_selection(const string& selection_name) {
+    Selection sel;
+    if (selection_name == "baseline_DF") {
+        sel = Selection::baseline_DF;
+        m_baseline_DF = true;
+        cout << "INFO :: Running baseline DF selections\n";
+    } else if (selection_name == "baseline_SS") {
+        sel = Selection::baseline_SS;
+        m_baseline_SS = true;
+        cout << "INFO :: Running baseline SF selections\n";
+    } else if (selection_name == "baseline_SS_den") {
+        sel = Selection::baseline_SS_den;
+        m_baseline_SS_den = true;
+        cout << "INFO :: Running baseline SF denominator selections\n";
+    } else if (selection_name == "zjets3l") {
+        sel = Selection::zjets3l;
+        m_zjets_3l = true;
+        cout << "INFO :: Running Z+jets selections\n";
+    } else if (selection_name == "fake_baseline_DF") {
+        sel = Selection::fake_baseline_DF;
+        m_fake_baseline_DF = true;
+        cout << "INFO :: Running baseline DF denominator selections\n";
+    } else if (selection_name == "fake_zjets3l") {
+        sel = Selection::fake_zjets3l;
+        m_fake_zjets_3l = true;
+        cout << "INFO :: Running Z+jets denominator selections\n";
+    } else if (selection_name == "zjets2l_inc") {
+        sel = Selection::zjets2l_inc;
+        m_zjets2l_inc = true;
+        cout << "INFO :: Running Z+jets 2 lepton inclusive selections\n";
+    } else {
+        cout << "ERROR :: Unknown analysis selection:" << selection_name << '\n';
+        return false;
+    }
+    if (std::find(m_selections.begin(), m_selections.end(), sel) != m_selections.end()) {
+        cout << "ERROR :: Analysis selection requested twice: " << selection_name << '\n';
+        return false;
+    }
+    m_selections.push_back(sel);
+    return true;
+}
+string selection_name(Selection sel) {
+    switch (sel) {
+        case Selection::baseline_DF:      return "baseline_DF";
+        case Selection::baseline_SS:      return "baseline_SS";
+        case Selection::baseline_SS_den:  return "baseline_SS_den";
+        case Selection::zjets3l:          return "zjets3l";
+        case Selection::fake_baseline_DF: return "fake_baseline_DF";
+        case Selection::fake_zjets3l:     return "fake_zjets3l";
+        case Selection::zjets2l_inc:      return "zjets2l_inc";
+    }
+    return "";
+}
+bool can_overlap(Selection a, Selection b) {
+    // The selections differ in their lepton multiplicities or charges (see
+    // get_analysis_cuts), except zjets2l_inc whose >=2 signal leptons out of
+    // 3 baseline include the events of both 3 lepton Z+jets selections
+    if (a == b) return true;
+    if (b == Selection::zjets2l_inc) std::swap(a, b);
+    return a == Selection::zjets2l_inc && (b == Selection::zjets3l || b == Selection::fake_zjets3l);
+}
+string selection_output_name(const string& output_name, Selection sel) {
+    string base_name = output_name;
+    if (base_name.size() > 5 && base_name.substr(base_name.size() - 5) == ".root") {
+        base_name = base_name.substr(0, base_name.size() - 5);
+    }
+    return base_name + "_" + selection_name(sel) + ".root";
+}
+bool split_output_by_selection(const string& output_name, const vector<SelectionCuts>& selection_cuts) {
+    // Copy the entries passing each selection into their own file,
+    // <output>_<selection>.root, then remove the combined file. Each file gets
+    // the branches and cutflow a job running only that selection writes.
+    TFile* in_file = TFile::Open(output_name.c_str(), "READ");
+    if (!in_file || in_file->IsZombie()) {
+        cout << "ERROR :: Unable to open " << output_name << " to split by selection\n";
+        return false;
+    }
+    bool ok = true;
+    for (const SelectionCuts& sel_cuts : selection_cuts) {
+        Selection sel = sel_cuts.sel;
+        string sel_file_name = selection_output_name(output_name, sel);
+        TFile* out_file = TFile::Open(sel_file_name.c_str(), "RECREATE");
+        std::set<string> copied; // keys are ordered by decreasing cycle
+        TIter next_key(in_file->GetListOfKeys());
+        while (TKey* key = static_cast<TKey*>(next_key())) {
+            if (!copied.insert(key->GetName()).second) continue;
+            TObject* obj = key->ReadObj();
+            out_file->cd();
+            TH1* hist = dynamic_cast<TH1*>(obj);
+            int pass_bin = 0; // bin of the combined "pass selections" cut in a cutflow histogram
+            for (int ibin = 1; hist && ibin <= hist->GetNbinsX(); ++ibin) {
+                if (string(hist->GetXaxis()->GetBinLabel(ibin)) == "pass selections") pass_bin = ibin;
+            }
+            if (TTree* tree = dynamic_cast<TTree*>(obj)) {
+                TTree* sel_tree = copy_selection_entries(tree, sel);
+                if (sel_tree) {
+                    sel_tree->Write();
+                    delete sel_tree;
+                } else {
+                    ok = false;
+                }
+            } else if (pass_bin > 0) {
+                TH1* sel_hist = split_cutflow_histogram(hist, pass_bin, sel_cuts, selection_cuts);
+                if (sel_hist) {
+                    sel_hist->Write(key->GetName());
+                    delete sel_hist;
+                } else {
+                    cout << "WARNING :: Cutflow histogram " << key->GetName() << " matches neither the raw"
+                         << " nor the weighted counts of the selections, leaving it out of "
+                         << sel_file_name << '\n';
+                }
+            } else {
+                obj->Write(key->GetName());
+            }
+            delete obj;
+        }
+        out_file->Close();
+        delete out_file;
+        cout << m_ana_name << "    Wrote " << selection_name(sel) << " output to " << sel_file_name << '\n';
+    }
+    in_file->Close();
+    delete in_file;
+    if (!ok) return false;
+    gSystem->Unlink(output_name.c_str());
+    return true;
+}
+TTree* copy_selection_entries(TTree* tree, Selection sel) {
+    // Branches of the other selections and the passSelections mask are
+    // disabled so CloneTree leaves them out. The mask is still read directly.
+    TBranch* mask_branch = tree->GetBranch("passSelections");
+    if (!mask_branch) {
+        cout << "ERROR :: Tree " << tree->GetName() << " has no passSelections branch to split by\n";
+        return nullptr;
+    }
+    for (const auto& it : m_region_branches) {
+        if (it.second.count(sel) || !tree->GetBranch(it.first.c_str())) continue;
+        tree->SetBranchStatus(it.first.c_str(), 0);
+    }
+    tree->SetBranchStatus("passSelections", 0);
+    TTree* sel_tree = tree->CloneTree(0);
+    int mask = 0;
+    tree->SetBranchAddress("passSelections", &mask);
+    const int sel_bit = 1 << static_cast<int>(sel);
+    for (Long64_t ientry = 0; ientry < tree->GetEntries(); ++ientry) {
+        mask_branch->GetEntry(ientry, 1); // read although disabled
+        if (!(mask & sel_bit)) continue;
+        tree->GetEntry(ientry);
+        sel_tree->Fill();
+    }
+    return sel_tree;
+}
+TH1* split_cutflow_histogram(TH1* hist, int pass_bin, const SelectionCuts& sel_cuts, const vector<SelectionCuts>& selection_cuts) {
+    // Superflow counts the selections as the single cut in pass_bin. The bins
+    // before it are shared and the selection's own cuts replace it. Whether
+    // the histogram counts raw or weighted events is told by that bin, which
+    // holds the sum over the (disjoint) selections.
+    double n_raw = 0, n_weighted = 0;
+    for (const SelectionCuts& other : selection_cuts) {
+        if (!other.n_pass.empty()) n_raw += other.n_pass.back();
+        if (!other.sumw_pass.empty()) n_weighted += other.sumw_pass.back();
+    }
+    double n_pass_bin = hist->GetBinContent(pass_bin);
+    auto same = [](double a, double b) { return fabs(a - b) <= 1e-6 * std::max(1.0, fabs(a)); };
+    bool weighted = false;
+    if (same(n_pass_bin, n_raw)) {
+        weighted = false;
+    } else if (same(n_pass_bin, n_weighted) && sel_cuts.sumw_pass.size() == sel_cuts.cuts.size()) {
+        weighted = true;
+    } else {
+        return nullptr;
+    }
+    int n_bins = pass_bin - 1 + sel_cuts.cuts.size();
+    TH1* sel_hist = new TH1D(hist->GetName(), hist->GetTitle(), n_bins, 0, n_bins);
+    for (int ibin = 1; ibin < pass_bin; ++ibin) {
+        sel_hist->SetBinContent(ibin, hist->GetBinContent(ibin));
+        sel_hist->GetXaxis()->SetBinLabel(ibin, hist->GetXaxis()->GetBinLabel(ibin));
+    }
+    for (uint icut = 0; icut < sel_cuts.cuts.size(); ++icut) {
+        int ibin = pass_bin + icut;
+        sel_hist->SetBinContent(ibin, weighted ? sel_cuts.sumw_pass.at(icut) : sel_cuts.n_pass.at(icut));
+        sel_hist->GetXaxis()->SetBinLabel(ibin, sel_cuts.cuts.at(icut).name.c_str());
+    }
+    return sel_hist;
+}
+bool finalize_output(const string& output_name, const RunSummary& summary) {
+    // Applied once to the complete output, after merging any part files
+    if (m_selections.size() > 1 && !split_output_by_selection(output_name, summary.selection_cuts)) return false;
+    if (m_ana_options.output_format != "rntuple") return true;
+    vector<string> file_names;
+    if (m_selections.size() > 1) {
+        for (Selection sel : m_selections) file_names.push_back(selection_output_name(output_name, sel));
+    } else {
+        file_names.push_back(output_name);
+    }
+    for (const string& file_name : file_names) {
+        if (!Stop2L::convert_to_rntuple(file_name)) return false;
+        cout << m_ana_name << "    Converted " << file_name << " to RNTuple\n";
+    }
+    return true;
+}
 TChain* create_new_chain(string input, string input_ttree_name, bool verbose) {
     TChain* chain = new TChain(input_ttree_name.c_str());
     chain->SetDirectory(0);
+    if (!m_file_entries.empty()) {
+        // Known entry counts mean the files are only opened when read
+        for (const auto& it : m_file_entries) {
+            chain->Add(it.first.c_str(), it.second);
+        }
+        if (verbose) {
+            cout << m_ana_name << "    Added " << m_file_entries.size() << " files from the entry cache\n";
+        }
+        return chain;
+    }
     ChainHelper::addInput(chain, input, verbose);
     return chain;
 }
@@ -864,450 +1921,1018 @@ Superflow* create_new_superflow(SFOptions sf_options, TChain* chain) {
     if(sf_options.suffix_name != "") {
         sf->setFileSuffix(sf_options.suffix_name);
     }
-    if(sf_options.sumw_file_name != "") {
-        cout << sf_options.ana_name
-             << "    Reading sumw for sample from file: "
-             << sf_options.sumw_file_name << endl;
-        sf->setUseSumwFile(sf_options.sumw_file_name);
+    if(sf_options.sumw_file_name != "") {
+        cout << sf_options.ana_name
+             << "    Reading sumw for sample from file: "
+             << sf_options.sumw_file_name << endl;
+        sf->setUseSumwFile(sf_options.sumw_file_name);
+    }
+    return sf;
+}
+Superflow* build_superflow(SFOptions sf_options, TChain* chain, EventContext* ctx) {
+    Superflow* superflow = create_new_superflow(sf_options, chain);
+    resolve_trigger_bits(superflow->nttools().triggerTool(), ctx);
+
+    // Set variables for use in other cuts/vars. MUST ADD FIRST!
+    // TODO: Move to after cleaning cuts and remove globals from cutflow
+    set_global_variables(superflow, ctx);
+
+    // Event selections
+    add_cleaning_cuts(superflow, ctx);
+    add_analysis_cuts(superflow, ctx);
+    //add_4bcutflow_cuts(superflow, ctx);
+
+    // Output variables
+    VarFlow vars(superflow, m_branch_selection, m_output_precision);
+    add_event_variables(&vars, ctx);
+    add_trigger_variables(&vars, ctx);
+    add_lepton_variables(&vars, ctx);
+    add_mc_lepton_variables(&vars, ctx);
+    add_jet_variables(&vars, ctx);
+    add_met_variables(&vars);
+    add_dilepton_variables(&vars, ctx);
+    if (m_baseline_DF || m_baseline_SS || m_baseline_SS_den || m_fake_baseline_DF) {
+        size_t first = vars.kept_names().size();
+        add_jigsaw_variables(&vars, ctx);
+        add_region_branches(vars, first, {Selection::baseline_DF, Selection::baseline_SS,
+                                          Selection::baseline_SS_den, Selection::fake_baseline_DF});
+    }
+    if (m_zjets_3l || m_fake_zjets_3l || m_zjets2l_inc) {
+        size_t first = vars.kept_names().size();
+        add_Zlepton_variables(&vars, ctx);
+        add_region_branches(vars, first, {Selection::zjets3l, Selection::fake_zjets3l, Selection::zjets2l_inc});
+    }
+    if (m_zjets_3l || m_fake_zjets_3l) {
+        size_t first = vars.kept_names().size();
+        add_Zll_probeLep_variables(&vars, ctx);
+        add_region_branches(vars, first, {Selection::zjets3l, Selection::fake_zjets3l});
+    };
+    add_miscellaneous_variables(&vars, ctx);
+    add_multi_object_variables(&vars, ctx);
+    if (!m_branch_selection.empty()) {
+        // Every build registers the same variables so only report once
+        static std::once_flag report_once;
+        std::call_once(report_once, print_branch_selection_summary, std::cref(vars));
+    }
+
+    // Systematics
+    add_weight_systematics(superflow);
+    add_shape_systematics(superflow);
+
+    return superflow;
+}
+void add_region_branches(const VarFlow& vars, size_t first, const vector<Selection>& sels) {
+    // Every build registers the same branches, and builds never run concurrently
+    const vector<string>& names = vars.kept_names();
+    for (size_t i = first; i < names.size(); ++i) {
+        m_region_branches[names.at(i)].insert(sels.begin(), sels.end());
+    }
+}
+void print_branch_selection_summary(const VarFlow& vars) {
+    cout << m_ana_name << "    Branch selection keeps " << vars.n_kept() << " of "
+         << vars.n_kept() + vars.n_skipped() << " output variables\n";
+    for (const string& pattern : vars.selection().unmatched_patterns()) {
+        cout << "WARNING :: Branch selection pattern matches no output variable: " << pattern << '\n';
+    }
+}
+bool run_multithreaded(SFOptions sf_options, int n_threads, Long64_t first_entry, RunSummary& summary) {
+    // Split the entries into contiguous ranges, one per worker thread.
+    // Each worker writes its own part file and the parts are merged back in
+    // entry order so the output does not depend on thread scheduling.
+    if (sf_options.output_name == "") {
+        cout << "ERROR :: Multi-threaded mode requires an explicit output file name\n";
+        return false;
+    }
+    Long64_t n_entries = sf_options.n_events_to_process;
+    if (n_entries < n_threads) n_threads = std::max<Long64_t>(n_entries, 1);
+    cout << m_ana_name << "    Processing " << n_entries
+         << " entries with " << n_threads << " threads\n";
+
+    ROOT::EnableThreadSafety();
+
+    string base_name = sf_options.output_name;
+    if (base_name.size() > 5 && base_name.substr(base_name.size() - 5) == ".root") {
+        base_name = base_name.substr(0, base_name.size() - 5);
+    }
+    vector<string> part_names;
+    vector<std::thread> workers;
+    vector<RunSummary> summaries(n_threads); // one per worker, summed in order after the join
+    for (int ithread = 0; ithread < n_threads; ++ithread) {
+        // Spread the remainder over the first workers
+        Long64_t n_worker_entries = n_entries / n_threads + (ithread < n_entries % n_threads ? 1 : 0);
+        string part_name = base_name + "_part" + std::to_string(ithread) + ".root";
+        part_names.push_back(part_name);
+        workers.emplace_back([=, &summaries]() {
+            SFOptions worker_options = sf_options;
+            worker_options.output_name = part_name;
+            TChain* chain = create_new_chain(worker_options.input, m_input_ttree_name, false);
+            std::unique_lock<std::mutex> lock(m_tool_mutex);
+            // xAOD events and stores are per thread
+            std::unique_ptr<xAOD::TEvent> tEvent(new xAOD::TEvent());
+            std::unique_ptr<xAOD::TStore> tStore(new xAOD::TStore());
+            std::unique_ptr<EventContext> ctx(new EventContext("_" + std::to_string(ithread)));
+            Superflow* superflow = build_superflow(worker_options, chain, ctx.get());
+            lock.unlock();
+
+            chain->Process(superflow, worker_options.input.c_str(), n_worker_entries, first_entry);
+            summaries.at(ithread).add(*ctx);
+
+            lock.lock();
+            delete superflow;
+            ctx.reset();
+            tStore.reset();
+            tEvent.reset();
+            lock.unlock();
+            delete chain;
+        });
+        first_entry += n_worker_entries;
+    }
+    for (std::thread& worker : workers) worker.join();
+    for (const RunSummary& worker_summary : summaries) summary.add(worker_summary);
+    print_run_summary(summary);
+
+    cout << m_ana_name << "    Merging " << part_names.size()
+         << " part files into " << sf_options.output_name << '\n';
+    TFileMerger merger;
+    merger.OutputFile(sf_options.output_name.c_str(), "RECREATE");
+    for (const string& part_name : part_names) {
+        if (!merger.AddFile(part_name.c_str())) {
+            cout << "ERROR :: Unable to add part file " << part_name << " to " << sf_options.output_name << '\n';
+            return false;
+        }
+    }
+    if (!merger.Merge()) {
+        cout << "ERROR :: Failed to merge part files into " << sf_options.output_name << '\n';
+        return false;
+    }
+    for (const string& part_name : part_names) {
+        gSystem->Unlink(part_name.c_str());
+    }
+    return true;
+}
+bool run_with_checkpoints(SFOptions sf_options, Long64_t first_entry, Long64_t checkpoint_every, bool resume, RunSummary& summary) {
+    // Process the entries in blocks of checkpoint_every entries, each written
+    // to its own part file. After a block finishes the checkpoint file records
+    // the completed parts, the next entry and the selection cutflow counts.
+    // A resumed job skips the completed blocks so, once the parts are merged
+    // in entry order, the output matches that of an uninterrupted run.
+    if (sf_options.output_name == "") {
+        cout << "ERROR :: Checkpointing requires an explicit output file name\n";
+        return false;
+    }
+    string base_name = sf_options.output_name;
+    if (base_name.size() > 5 && base_name.substr(base_name.size() - 5) == ".root") {
+        base_name = base_name.substr(0, base_name.size() - 5);
+    }
+    string checkpoint_name = base_name + ".checkpoint";
+    Long64_t last_entry = first_entry + sf_options.n_events_to_process - 1;
+    string range = std::to_string(first_entry) + " " + std::to_string(last_entry)
+                 + " " + std::to_string(checkpoint_every);
+
+    Long64_t next_entry = first_entry;
+    vector<string> part_names;
+    // summary: selection cutflows include the resumed blocks, the rest only this job's
+    vector< vector<Long64_t> > resumed_n_pass;
+    vector< vector<double> > resumed_sumw_pass;
+    if (resume) {
+        std::ifstream checkpoint(checkpoint_name);
+        if (!checkpoint.is_open()) {
+            cout << m_ana_name << "    No checkpoint found at " << checkpoint_name << ", starting from the beginning\n";
+        } else {
+            string line;
+            while (std::getline(checkpoint, line)) {
+                std::stringstream fields(line);
+                string key;
+                fields >> key;
+                if (key == "range") {
+                    string saved_range;
+                    std::getline(fields >> std::ws, saved_range);
+                    if (saved_range != range) {
+                        cout << "ERROR :: Checkpoint " << checkpoint_name << " is for entries and interval ["
+                             << saved_range << "], not [" << range << "]\n";
+                        return false;
+                    }
+                } else if (key == "next_entry") {
+                    fields >> next_entry;
+                } else if (key == "part") {
+                    string part_name;
+                    fields >> part_name;
+                    part_names.push_back(part_name);
+                } else if (key == "cutflow") {
+                    resumed_n_pass.emplace_back();
+                    Long64_t n_pass;
+                    while (fields >> n_pass) resumed_n_pass.back().push_back(n_pass);
+                } else if (key == "cutflow_weighted") {
+                    resumed_sumw_pass.emplace_back();
+                    double sumw;
+                    while (fields >> sumw) resumed_sumw_pass.back().push_back(sumw);
+                }
+            }
+            if (!check_resumed_parts(part_names, next_entry, first_entry, checkpoint_every)) {
+                cout << "ERROR :: Checkpoint " << checkpoint_name << " cannot be resumed, rerun without"
+                     << " resuming to start from the beginning\n";
+                return false;
+            }
+            cout << m_ana_name << "    Resuming from entry " << next_entry << " with "
+                 << part_names.size() << " completed part files\n";
+        }
+    }
+    // The blocks run here add their counts to the resumed ones. They are
+    // seeded up front so a resume with every block done still has them.
+    if (m_selections.size() > 1 && !resumed_n_pass.empty()) {
+        if (resumed_n_pass.size() != m_selections.size() || resumed_sumw_pass.size() != m_selections.size()) {
+            cout << "ERROR :: Checkpoint " << checkpoint_name << " has cutflows for "
+                 << resumed_n_pass.size() << " selections, not " << m_selections.size() << '\n';
+            return false;
+        }
+        for (uint isel = 0; isel < m_selections.size(); ++isel) {
+            // Only the cut names are used, so no event context is needed
+            SelectionCuts sel_cuts {m_selections.at(isel), get_analysis_cuts(m_selections.at(isel), nullptr),
+                                    resumed_n_pass.at(isel), resumed_sumw_pass.at(isel)};
+            if (sel_cuts.n_pass.size() != sel_cuts.cuts.size() || sel_cuts.sumw_pass.size() != sel_cuts.cuts.size()) {
+                cout << "ERROR :: Checkpoint " << checkpoint_name << " cutflow for "
+                     << selection_name(sel_cuts.sel) << " does not match its " << sel_cuts.cuts.size() << " cuts\n";
+                return false;
+            }
+            summary.selection_cuts.push_back(sel_cuts);
+        }
+    }
+
+    while (next_entry <= last_entry) {
+        Long64_t n_block_entries = std::min(checkpoint_every, last_entry - next_entry + 1);
+        int iblock = (next_entry - first_entry) / checkpoint_every;
+        string part_name = base_name + "_ckpt" + std::to_string(iblock) + ".root";
+
+        SFOptions block_options = sf_options;
+        block_options.output_name = part_name;
+        TChain* chain = create_new_chain(block_options.input, m_input_ttree_name, false);
+        EventContext ctx("_ckpt" + std::to_string(iblock));
+        Superflow* superflow = build_superflow(block_options, chain, &ctx);
+        chain->Process(superflow, block_options.input.c_str(), n_block_entries, next_entry);
+        delete superflow;
+        delete chain;
+
+        // Accumulate the cutflows of all blocks
+        summary.add(ctx);
+        part_names.push_back(part_name);
+        next_entry += n_block_entries;
+
+        // Write to a temporary file first so an eviction while writing never
+        // leaves a truncated checkpoint behind
+        string tmp_name = checkpoint_name + ".tmp";
+        {
+            std::ofstream checkpoint(tmp_name);
+            checkpoint << "range " << range << '\n';
+            checkpoint << "next_entry " << next_entry << '\n';
+            for (const string& name : part_names) checkpoint << "part " << name << '\n';
+            for (const SelectionCuts& sel_cuts : summary.selection_cuts) {
+                checkpoint << "cutflow";
+                for (Long64_t n_pass : sel_cuts.n_pass) checkpoint << ' ' << n_pass;
+                checkpoint << '\n';
+                checkpoint << "cutflow_weighted" << std::setprecision(17);
+                for (double sumw : sel_cuts.sumw_pass) checkpoint << ' ' << sumw;
+                checkpoint << '\n';
+            }
+        }
+        gSystem->Rename(tmp_name.c_str(), checkpoint_name.c_str());
+        cout << m_ana_name << "    Checkpoint at entry " << next_entry << " of [" << first_entry
+             << ", " << last_entry << "]\n";
+    }
+    print_run_summary(summary);
+
+    cout << m_ana_name << "    Merging " << part_names.size()
+         << " part files into " << sf_options.output_name << '\n';
+    TFileMerger merger;
+    merger.OutputFile(sf_options.output_name.c_str(), "RECREATE");
+    for (const string& part_name : part_names) {
+        if (!merger.AddFile(part_name.c_str())) {
+            cout << "ERROR :: Unable to add part file " << part_name << " to " << sf_options.output_name
+                 << ", keeping the part files and checkpoint\n";
+            return false;
+        }
+    }
+    if (!merger.Merge()) {
+        cout << "ERROR :: Failed to merge part files into " << sf_options.output_name << '\n';
+        return false;
+    }
+    for (const string& part_name : part_names) {
+        gSystem->Unlink(part_name.c_str());
+    }
+    gSystem->Unlink(checkpoint_name.c_str());
+    return true;
+}
+bool check_resumed_parts(const vector<string>& part_names, Long64_t next_entry,
+                         Long64_t first_entry, Long64_t checkpoint_every) {
+    // One part per completed block, each a complete file. The resumed
+    // cutflow counts cover every listed block, so a lost part cannot be
+    // rerun on its own.
+    Long64_t n_blocks = (next_entry - first_entry + checkpoint_every - 1) / checkpoint_every;
+    if ((Long64_t)part_names.size() != n_blocks) {
+        cout << "ERROR :: Checkpoint lists " << part_names.size() << " part files for "
+             << n_blocks << " completed blocks\n";
+        return false;
+    }
+    for (const string& part_name : part_names) {
+        TFile* part_file = TFile::Open(part_name.c_str(), "READ");
+        bool readable = part_file && !part_file->IsZombie() && !part_file->TestBit(TFile::kRecovered);
+        if (part_file) part_file->Close();
+        delete part_file;
+        if (!readable) {
+            cout << "ERROR :: Completed part file " << part_name << " is missing or unreadable\n";
+            return false;
+        }
+    }
+    return true;
+}
+bool set_global_variables(Superflow* sf, EventContext* ctx) {
+    // IFFTruthClassifier
+    ANA_CHECK( ctx->m_truthClassifier.initialize(); )
+    // Jigsaw
+    ctx->m_calculator.initialize("TTMET2LW");
+
+    // Only the event level state is read here. The objects and everything
+    // built from them are stages run by the cuts that need them.
+    add_cut(sf, ctx, {"read in", [ctx](Superlink* sl) -> bool {
+        read_event(sl, ctx);
+        return true; // All events pass this cut
+    }});
+
+    return true;
+}
+void read_event(Superlink* sl, EventContext* ctx) {
+    ////////////////////////////////////////////////////////////////////////////
+    // Reset all per-event state used in cuts/variables
+    ctx->clear();
+    // Keep the systematic-invariant cache if this is another systematic
+    // pass over the same event
+    if (ctx->m_sys_cache.update(sl->nt->evt(), ctx->m_trig_bit_idx)) ctx->m_n_events++;
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Set per-event state
+    // Note: No cuts have been applied so add appropriate checks before
+    //       dereferencing pointers or accessing vector indices
+    ctx->m_cutflags = sl->nt->evt()->cutFlags[NtSys::NOM];
+}
+void require_stages(Superlink* sl, EventContext* ctx, unsigned stages) {
+    for (int istage = 0; istage < N_STAGES; ++istage) {
+        unsigned stage = 1u << istage;
+        if (!(stages & stage) || (ctx->m_stages_done & stage)) continue;
+        require_stages(sl, ctx, m_stage_deps[istage]);
+        run_stage(sl, ctx, stage);
+        ctx->m_stages_done |= stage;
+    }
+}
+void run_stage(Superlink* sl, EventContext* ctx, unsigned stage) {
+    switch (stage) {
+        case STAGE_OBJECTS: read_objects(sl, ctx); break;
+        case STAGE_TRUTH: if (sl->isMC) read_truth(ctx); break;
+        case STAGE_ZTAG: find_Z_pair(ctx); break;
+        // In multi-selection mode the "pass selections" cut sets the
+        // selection specific state itself and marks this stage done
+        case STAGE_TRIGGER: set_region_variables(sl, ctx, m_selections.front()); break;
+        case STAGE_JIGSAW: compute_jigsaw_vars(ctx); break;
+        default:
+            cout << "ERROR :: Unknown event stage " << stage << '\n';
+            exit(1);
     }
-    return sf;
 }
-bool set_global_variables(Superflow* sf) {
-    // IFFTruthClassifier
-    ANA_CHECK( m_truthClassifier.initialize(); )
-    // Jigsaw
-    m_calculator.initialize("TTMET2LW");
-
-    *sf << CutName("read in") << [](Superlink* sl) -> bool {
-        ////////////////////////////////////////////////////////////////////////
-        // Reset all globals used in cuts/variables
-        m_cutflags = 0;
-        m_light_jets.clear();
-        m_MET = {};
-        m_leps.clear();
-        m_sigLeps.clear();
-        m_invLeps.clear();
-        m_promptLeps.clear();
-        m_fnpLeps.clear();
-        m_promptSigLeps.clear();
-        m_promptInvLeps.clear();
-        m_fnpSigLeps.clear();
-        m_fnpInvLeps.clear();
-        m_ZLeps.clear();
-        m_probeLeps.clear();
-        m_triggerPass.clear();
-
-        ////////////////////////////////////////////////////////////////////////
-        // Set globals
-        // Note: No cuts have been applied so add appropriate checks before
-        //       dereferencing pointers or accessing vector indices
-        m_cutflags = sl->nt->evt()->cutFlags[NtSys::NOM];
-
-        // Light jets: jets that are neither forward nor b-tagged
-        for (int i = 0; i < (int)sl->jets->size(); i++) {
-            if ( !sl->tools->jetSelector().isBJet(sl->jets->at(i))
-              && !sl->tools->jetSelector().isForward(sl->jets->at(i))) {
-                m_light_jets.push_back(sl->jets->at(i));
-            }
+void read_objects(Superlink* sl, EventContext* ctx) {
+    // Jet classification
+    // Light jets: jets that are neither forward nor b-tagged
+    for (Susy::Jet* jet : *sl->jets) {
+        const SysInvariantCache::JetFlags& flags = get_jet_flags(sl, ctx, jet);
+        ctx->m_jet_table.add(jet, flags.isB, flags.isForward);
+        if (ctx->m_jet_table.flags.back() & JetTable::LIGHT) {
+            ctx->m_light_jets.push_back(jet);
         }
+    }
 
-        // Missing transverse momentum
-        m_MET.SetPxPyPzE(sl->met->Et * cos(sl->met->phi),
-                         sl->met->Et * sin(sl->met->phi),
-                         0.,
-                         sl->met->Et);
-
-        // Commonly used leptons
-        m_leps = *sl->baseLeptons;
-        //for (Susy::Lepton* lepton : *sl->baseLeptons) {
-        //    if (isSignal(lepton, sl) || isInverted(lepton, sl)) m_leps.push_back(lepton);
-        //}
-        for (Susy::Lepton* lepton : m_leps) {
-            bool isSig = false, isInv = false;
-            if (isSignal(lepton, sl)) {
-                isSig = true;
-                m_sigLeps.push_back(lepton);
-            } else if (isInverted(lepton, sl)) {
-                isInv = true;
-                m_invLeps.push_back(lepton);
-            }
-            if (sl->isMC) {
-                if (isPrompt(lepton)) {
-                    m_promptLeps.push_back(lepton);
-                    if (isSig) m_promptSigLeps.push_back(lepton);
-                    else if (isInv) m_promptInvLeps.push_back(lepton);
-                } else if (isFNP(lepton)) {
-                    m_fnpLeps.push_back(lepton);
-                    if (isSig) m_fnpSigLeps.push_back(lepton);
-                    else if (isInv) m_fnpInvLeps.push_back(lepton);
-                }
-            }
+    // Missing transverse momentum
+    ctx->m_MET = to_kin(sl->met->Et * cos(sl->met->phi),
+                        sl->met->Et * sin(sl->met->phi),
+                        0.,
+                        sl->met->Et);
+
+    // Commonly used leptons
+    ctx->m_leps = *sl->baseLeptons;
+    //for (Susy::Lepton* lepton : *sl->baseLeptons) {
+    //    if (isSignal(lepton, sl) || isInverted(lepton, sl)) ctx->m_leps.push_back(lepton);
+    //}
+    for (Susy::Lepton* lepton : ctx->m_leps) {
+        if (isSignal(lepton, sl)) {
+            ctx->m_sigLeps.push_back(lepton);
+        } else if (isInverted(lepton, sl)) {
+            ctx->m_invLeps.push_back(lepton);
         }
-        m_ztagged_idx1 = -1;
-        m_ztagged_idx2 = -1;
-        if (m_sigLeps.size() >= 2) {
-            float Z_diff = FLT_MAX;
-            for (uint ii = 0; ii < m_sigLeps.size(); ++ii) {
-                Susy::Lepton *lep_ii = m_sigLeps.at(ii);
-                for (uint jj = ii+1; jj < m_sigLeps.size(); ++jj) {
-                    Susy::Lepton *lep_jj = m_sigLeps.at(jj);
-                    bool SF = lep_ii->isEle() == lep_jj->isEle();
-                    bool OS = lep_ii->q * lep_jj->q < 0;
-                    if (!SF || !OS) continue;
-                    float Z_diff_cf = fabs((*lep_ii+*lep_jj).M() - ZMASS);
-                    if (Z_diff_cf < Z_diff) {
-                        Z_diff = Z_diff_cf;
-                        m_ztagged_idx1 = ii;
-                        m_ztagged_idx2 = jj;
-                    }
+    }
+    // Lepton kinematics, computed once for all lepton collections
+    const LeptonTable& lep_table = ctx->m_lep_table;
+    ctx->m_lep_table.fill(ctx->m_leps, ctx->m_MET);
+    lep_table.index(ctx->m_leps, ctx->m_leps_idx);
+    lep_table.index(ctx->m_sigLeps, ctx->m_sigLeps_idx);
+    lep_table.index(ctx->m_invLeps, ctx->m_invLeps_idx);
+
+    int validate_every = m_ana_options.validate_fast_math_every;
+    if (validate_every > 0 && ctx->m_n_events % validate_every == 0) validate_fast_math(sl, ctx);
+}
+void read_truth(EventContext* ctx) {
+    for (Susy::Lepton* lepton : ctx->m_leps) {
+        bool isSig = isSignal(lepton, ctx);
+        bool isInv = !isSig && isInverted(lepton, ctx);
+        if (isPrompt(lepton, ctx)) {
+            ctx->m_promptLeps.push_back(lepton);
+            if (isSig) ctx->m_promptSigLeps.push_back(lepton);
+            else if (isInv) ctx->m_promptInvLeps.push_back(lepton);
+        } else if (isFNP(lepton, ctx)) {
+            ctx->m_fnpLeps.push_back(lepton);
+            if (isSig) ctx->m_fnpSigLeps.push_back(lepton);
+            else if (isInv) ctx->m_fnpInvLeps.push_back(lepton);
+        }
+    }
+    const LeptonTable& lep_table = ctx->m_lep_table;
+    lep_table.index(ctx->m_promptLeps, ctx->m_promptLeps_idx);
+    lep_table.index(ctx->m_fnpLeps, ctx->m_fnpLeps_idx);
+    lep_table.index(ctx->m_promptSigLeps, ctx->m_promptSigLeps_idx);
+    lep_table.index(ctx->m_promptInvLeps, ctx->m_promptInvLeps_idx);
+    lep_table.index(ctx->m_fnpSigLeps, ctx->m_fnpSigLeps_idx);
+    lep_table.index(ctx->m_fnpInvLeps, ctx->m_fnpInvLeps_idx);
+}
+void find_Z_pair(EventContext* ctx) {
+    ctx->m_ztagged_idx1 = -1;
+    ctx->m_ztagged_idx2 = -1;
+    if (ctx->m_sigLeps.size() >= 2) {
+        float Z_diff = FLT_MAX;
+        for (uint ii = 0; ii < ctx->m_sigLeps.size(); ++ii) {
+            Susy::Lepton *lep_ii = ctx->m_sigLeps.at(ii);
+            for (uint jj = ii+1; jj < ctx->m_sigLeps.size(); ++jj) {
+                Susy::Lepton *lep_jj = ctx->m_sigLeps.at(jj);
+                bool SF = lep_ii->isEle() == lep_jj->isEle();
+                bool OS = lep_ii->q * lep_jj->q < 0;
+                if (!SF || !OS) continue;
+                TLorentzVector pairP4 = *lep_ii + *lep_jj;
+                float Z_diff_cf = fabs(pairP4.M() - ZMASS);
+                if (Z_diff_cf < Z_diff) {
+                    Z_diff = Z_diff_cf;
+                    ctx->m_ztagged_idx1 = ii;
+                    ctx->m_ztagged_idx2 = jj;
+                    ctx->m_ztagged_p4 = pairP4;
                 }
             }
         }
-        bool ztagged = m_ztagged_idx1 >= 0 && m_ztagged_idx2 >=0;
-        LeptonVector prefTrigLeptons;
-        LeptonVector allTrigLeptons;
-        allTrigLeptons.reserve(m_sigLeps.size() + m_invLeps.size());
-        allTrigLeptons.insert( allTrigLeptons.end(), m_sigLeps.begin(), m_sigLeps.end() );
-        allTrigLeptons.insert( allTrigLeptons.end(), m_invLeps.begin(), m_invLeps.end() );
-        // Define region specific globals
-        if ((m_baseline_DF || m_baseline_SS) && m_sigLeps.size() == 2) {
-            prefTrigLeptons = m_sigLeps;
-        } else if ((m_fake_baseline_DF || m_baseline_SS_den) && m_sigLeps.size() == 1 && m_invLeps.size() == 1) {
-            prefTrigLeptons = m_sigLeps;
-        } else if (m_zjets_3l && m_sigLeps.size() == 3 && ztagged) {
-            m_ZLeps.push_back( m_sigLeps.at(m_ztagged_idx1) );
-            m_ZLeps.push_back( m_sigLeps.at(m_ztagged_idx2) );
-            m_probeLep_idx = -1;
-            if      (m_ztagged_idx1 != 0 && m_ztagged_idx2 != 0) { m_probeLep_idx = 0; }
-            else if (m_ztagged_idx1 != 1 && m_ztagged_idx2 != 1) { m_probeLep_idx = 1; }
-            else if (m_ztagged_idx1 != 2 && m_ztagged_idx2 != 2) { m_probeLep_idx = 2; }
-            m_probeLeps.push_back(m_sigLeps.at(m_probeLep_idx));
-            prefTrigLeptons.push_back(m_ZLeps.at(0));
-            prefTrigLeptons.push_back(m_ZLeps.at(1));
-        } else if (m_fake_zjets_3l && m_sigLeps.size() == 2 && m_invLeps.size() == 1 && ztagged) {
-            m_ZLeps = m_sigLeps;
-            m_probeLeps.push_back(m_invLeps.at(0));
-            m_probeLep_idx = -1;
-            if      (m_ztagged_idx1 != 0 && m_ztagged_idx2 != 0) { m_probeLep_idx = 0; }
-            else if (m_ztagged_idx1 != 1 && m_ztagged_idx2 != 1) { m_probeLep_idx = 1; }
-            else if (m_ztagged_idx1 != 2 && m_ztagged_idx2 != 2) { m_probeLep_idx = 2; }
-            prefTrigLeptons.push_back(m_ZLeps.at(0));
-            prefTrigLeptons.push_back(m_ZLeps.at(1));
-        } else if (m_zjets2l_inc && m_sigLeps.size() >= 2 && ztagged) {
-            m_ZLeps.push_back( m_sigLeps.at(m_ztagged_idx1) );
-            m_ZLeps.push_back( m_sigLeps.at(m_ztagged_idx2) );
-            prefTrigLeptons.push_back(m_ZLeps.at(0));
-            prefTrigLeptons.push_back(m_ZLeps.at(1));
-        } else {
-            // These events should be removed by the cutflow requirements
-            // Need to define ZLeps to be apply some selection though
-            m_ZLeps = m_sigLeps;
-            allTrigLeptons.clear();
+    }
+}
+void set_region_variables(Superlink* sl, EventContext* ctx, Selection sel) {
+    ctx->clear_region();
+    bool ztagged = ctx->m_ztagged_idx1 >= 0 && ctx->m_ztagged_idx2 >=0;
+    LeptonVector& prefTrigLeptons = ctx->m_prefTrigLeps;
+    LeptonVector& allTrigLeptons = ctx->m_allTrigLeps;
+    allTrigLeptons.insert( allTrigLeptons.end(), ctx->m_sigLeps.begin(), ctx->m_sigLeps.end() );
+    allTrigLeptons.insert( allTrigLeptons.end(), ctx->m_invLeps.begin(), ctx->m_invLeps.end() );
+    // Define region specific state
+    if ((sel == Selection::baseline_DF || sel == Selection::baseline_SS) && ctx->m_sigLeps.size() == 2) {
+        prefTrigLeptons = ctx->m_sigLeps;
+    } else if ((sel == Selection::fake_baseline_DF || sel == Selection::baseline_SS_den) && ctx->m_sigLeps.size() == 1 && ctx->m_invLeps.size() == 1) {
+        prefTrigLeptons = ctx->m_sigLeps;
+    } else if (sel == Selection::zjets3l && ctx->m_sigLeps.size() == 3 && ztagged) {
+        ctx->m_ZLeps.push_back( ctx->m_sigLeps.at(ctx->m_ztagged_idx1) );
+        ctx->m_ZLeps.push_back( ctx->m_sigLeps.at(ctx->m_ztagged_idx2) );
+        ctx->m_probeLep_idx = -1;
+        if      (ctx->m_ztagged_idx1 != 0 && ctx->m_ztagged_idx2 != 0) { ctx->m_probeLep_idx = 0; }
+        else if (ctx->m_ztagged_idx1 != 1 && ctx->m_ztagged_idx2 != 1) { ctx->m_probeLep_idx = 1; }
+        else if (ctx->m_ztagged_idx1 != 2 && ctx->m_ztagged_idx2 != 2) { ctx->m_probeLep_idx = 2; }
+        ctx->m_probeLeps.push_back(ctx->m_sigLeps.at(ctx->m_probeLep_idx));
+        prefTrigLeptons.push_back(ctx->m_ZLeps.at(0));
+        prefTrigLeptons.push_back(ctx->m_ZLeps.at(1));
+    } else if (sel == Selection::fake_zjets3l && ctx->m_sigLeps.size() == 2 && ctx->m_invLeps.size() == 1 && ztagged) {
+        ctx->m_ZLeps = ctx->m_sigLeps;
+        ctx->m_probeLeps.push_back(ctx->m_invLeps.at(0));
+        ctx->m_probeLep_idx = -1;
+        if      (ctx->m_ztagged_idx1 != 0 && ctx->m_ztagged_idx2 != 0) { ctx->m_probeLep_idx = 0; }
+        else if (ctx->m_ztagged_idx1 != 1 && ctx->m_ztagged_idx2 != 1) { ctx->m_probeLep_idx = 1; }
+        else if (ctx->m_ztagged_idx1 != 2 && ctx->m_ztagged_idx2 != 2) { ctx->m_probeLep_idx = 2; }
+        prefTrigLeptons.push_back(ctx->m_ZLeps.at(0));
+        prefTrigLeptons.push_back(ctx->m_ZLeps.at(1));
+    } else if (sel == Selection::zjets2l_inc && ctx->m_sigLeps.size() >= 2 && ztagged) {
+        ctx->m_ZLeps.push_back( ctx->m_sigLeps.at(ctx->m_ztagged_idx1) );
+        ctx->m_ZLeps.push_back( ctx->m_sigLeps.at(ctx->m_ztagged_idx2) );
+        prefTrigLeptons.push_back(ctx->m_ZLeps.at(0));
+        prefTrigLeptons.push_back(ctx->m_ZLeps.at(1));
+    } else {
+        // These events should be removed by the cutflow requirements
+        // Need to define ZLeps to be apply some selection though
+        ctx->m_ZLeps = ctx->m_sigLeps;
+        allTrigLeptons.clear();
+    }
+    ctx->m_lep_table.index(ctx->m_ZLeps, ctx->m_ZLeps_idx);
+    ctx->m_lep_table.index(ctx->m_probeLeps, ctx->m_probeLeps_idx);
+    const TrigMenu& menu = trig_menu(sl->nt->evt()->treatAsYear);
+    // Implement trigger strategy
+    ctx->m_trigLep_idx0 = -1;
+    ctx->m_trigLep_idx1 = -1;
+    ctx->m_firedTrig = Trig::none;
+
+    // Trigger matching is only needed for the menu triggers that fired
+    const TrigBits& fired = ctx->m_sys_cache.m_trig_fired;
+    bool any_dilep_fired = (fired & menu.dilep_mask).any();
+    bool any_single_lep_fired = (fired & menu.single_lep_mask).any();
+    if (any_dilep_fired || any_single_lep_fired) {
+        // Lepton index bitmasks of the trigger lepton sets
+        uint64_t pref_mask = 0, all_mask = 0;
+        vector<int>& match_idx = ctx->m_trigMatch_idx;
+        match_idx.clear();
+        for (uint idx = 0; idx < ctx->m_leps.size(); idx++) {
+            Susy::Lepton* lep = ctx->m_leps.at(idx);
+            match_idx.push_back(get_trig_match_index(sl, ctx, menu, lep));
+            if (idx >= 64) continue;
+            if (std::find(prefTrigLeptons.begin(), prefTrigLeptons.end(), lep) != prefTrigLeptons.end()) pref_mask |= 1ull << idx;
+            if (std::find(allTrigLeptons.begin(), allTrigLeptons.end(), lep) != allTrigLeptons.end()) all_mask |= 1ull << idx;
         }
-        int year = sl->nt->evt()->treatAsYear;
-        // Implement trigger strategy
-        m_trigLep_idx0 = -1;
-        m_trigLep_idx1 = -1;
-        m_firedTrig = "";
-
-        for (auto const& it : m_single_lep_pT_thresholds) { m_triggerPass.emplace(it.first, false);}
-        for (auto const& it : m_dilepton_pT_thresholds) { m_triggerPass.emplace(it.first, false);}
-
-        for (const LeptonVector& trigLeps : {prefTrigLeptons, allTrigLeptons}) {
-            for (uint idx0 = 0; idx0 < m_leps.size(); idx0++) {
-            for (uint idx1 = idx0 + 1; idx1 < m_leps.size(); idx1++) {
-                Susy::Lepton* lep0 = m_leps.at(idx0);
-                if (std::find(trigLeps.begin(), trigLeps.end(), lep0) == trigLeps.end()) continue;
-                Susy::Lepton* lep1 = m_leps.at(idx1);
-                if (std::find(trigLeps.begin(), trigLeps.end(), lep1) == trigLeps.end()) continue;
-
-                vector<string> dilepton_trigs;
+        const SysInvariantCache& cache = ctx->m_sys_cache;
+        for (uint64_t trig_mask : {pref_mask, all_mask}) {
+            for (uint idx0 = 0; any_dilep_fired && idx0 < ctx->m_leps.size() && idx0 < 64; idx0++) {
+            if (!(trig_mask >> idx0 & 1)) continue;
+            for (uint idx1 = idx0 + 1; idx1 < ctx->m_leps.size() && idx1 < 64; idx1++) {
+                if (!(trig_mask >> idx1 & 1)) continue;
+                Susy::Lepton* lep0 = ctx->m_leps.at(idx0);
+                Susy::Lepton* lep1 = ctx->m_leps.at(idx1);
+
+                const vector<Trig>* dilepton_trigs = nullptr;
                 if (lep0->isEle() == lep1->isEle()) {
-                    dilepton_trigs = lep0->isEle() ? m_dielectron_trigs.at(year) : m_dimuon_trigs.at(year);
+                    dilepton_trigs = lep0->isEle() ? &menu.dielectron : &menu.dimuon;
                 } else {
-                    dilepton_trigs = m_diff_flav_trigs.at(year);
+                    dilepton_trigs = &menu.diff_flav;
                     // pT thresholds for DF trigs assume electron is lep0
                     if (lep1->isEle()) { std::swap(lep0, lep1); }
                 }
-                for (const string& trig_name : dilepton_trigs ) {
-                    float pt_thresh0 = m_dilepton_pT_thresholds.at(trig_name).first;
-                    float pt_thresh1 = m_dilepton_pT_thresholds.at(trig_name).second;
-                    bool pass = is_2lep_trig_matched(sl, trig_name, lep0, lep1, pt_thresh0, pt_thresh1);
-                    m_triggerPass.at(trig_name) |= pass;
-                    if (m_firedTrig == "" && pass) {
-                       m_trigLep_idx0 = idx0;
-                       m_trigLep_idx1 = idx1;
-                       m_firedTrig = trig_name;
+                int cache_idx0 = match_idx.at(idx0);
+                int cache_idx1 = match_idx.at(idx1);
+                bool cached = cache_idx0 >= 0 && cache_idx1 >= 0;
+                TrigBits pair_match;
+                if (cached) pair_match = cache.m_dilep_trig_match.at(cache_idx0 * SysInvariantCache::MAX_TRIG_LEPS + cache_idx1);
+                for (Trig trig : *dilepton_trigs ) {
+                    if (!fired.test(to_idx(trig))) continue;
+                    if (cached && !pair_match.test(to_idx(trig))) continue;
+                    const pair<float,float>& pt_thresh = m_trig_pT_thresholds[to_idx(trig)];
+                    bool pass = cached ? lep0->Pt() >= pt_thresh.first && lep1->Pt() >= pt_thresh.second
+                                       : is_2lep_trig_matched(sl, ctx, trig, lep0, lep1, pt_thresh.first, pt_thresh.second);
+                    if (!pass) continue;
+                    ctx->m_triggerPass.set(to_idx(trig));
+                    if (ctx->m_firedTrig == Trig::none) {
+                       ctx->m_trigLep_idx0 = idx0;
+                       ctx->m_trigLep_idx1 = idx1;
+                       ctx->m_firedTrig = trig;
                     }
                 }
             }
             }
-            for (uint idx = 0; idx < m_leps.size(); idx++) {
-                Susy::Lepton* lep = m_leps.at(idx);
-                if (std::find(trigLeps.begin(), trigLeps.end(), lep) == trigLeps.end()) continue;
-                vector<string> single_lep_trigs = lep->isEle() ? m_single_ele_trigs.at(year) : m_single_mu_trigs.at(year);
-                for (const string& trig_name : single_lep_trigs ) {
-                    float pt_thresh = m_single_lep_pT_thresholds.at(trig_name);
-                    bool pass = is_1lep_trig_matched(sl, trig_name, lep, pt_thresh);
-                    m_triggerPass.at(trig_name) |= pass;
-                    if (m_firedTrig == "" && pass) {
-                       m_trigLep_idx0 = idx;
-                       m_firedTrig = trig_name;
+            for (uint idx = 0; any_single_lep_fired && idx < ctx->m_leps.size() && idx < 64; idx++) {
+                if (!(trig_mask >> idx & 1)) continue;
+                Susy::Lepton* lep = ctx->m_leps.at(idx);
+                int cache_idx = match_idx.at(idx);
+                const vector<Trig>& single_lep_trigs = lep->isEle() ? menu.single_ele : menu.single_mu;
+                for (Trig trig : single_lep_trigs ) {
+                    if (!fired.test(to_idx(trig))) continue;
+                    if (cache_idx >= 0 && !cache.m_lep_trig_match.at(cache_idx).test(to_idx(trig))) continue;
+                    float pt_thresh = m_trig_pT_thresholds[to_idx(trig)].first;
+                    bool pass = cache_idx >= 0 ? lep->Pt() >= pt_thresh
+                                               : is_1lep_trig_matched(sl, ctx, trig, lep, pt_thresh);
+                    if (!pass) continue;
+                    ctx->m_triggerPass.set(to_idx(trig));
+                    if (ctx->m_firedTrig == Trig::none) {
+                       ctx->m_trigLep_idx0 = idx;
+                       ctx->m_firedTrig = trig;
                     }
                 }
             }
         }
-        ////////////////////////////////////////////////////////////////////////////
-        // Combined triggers
-
-        bool passSingleLepTrig = false;
-        if (year == 2015) {
-            passSingleLepTrig |= m_triggerPass.at("HLT_e24_lhmedium_L1EM20VH")
-                              || m_triggerPass.at("HLT_e60_lhmedium")
-                              || m_triggerPass.at("HLT_e120_lhloose")
-                              || m_triggerPass.at("HLT_mu20_iloose_L1MU15")
-                              || m_triggerPass.at("HLT_mu40");
-        } else if (year == 2016 || year == 2017 || year == 2018) {
-            passSingleLepTrig |= m_triggerPass.at("HLT_e26_lhtight_nod0_ivarloose")
-                              || m_triggerPass.at("HLT_e60_lhmedium_nod0")
-                              || m_triggerPass.at("HLT_e140_lhloose_nod0")
-                              || m_triggerPass.at("HLT_mu26_ivarmedium")
-                              || m_triggerPass.at("HLT_mu50");
-        }
-        m_triggerPass.emplace("singleLepTrigs", passSingleLepTrig);
-
-        bool passDilepTrig = false;
-        if (year == 2015) {
-            passDilepTrig |= m_triggerPass.at("HLT_2e12_lhloose_L12EM10VH")
-                          || m_triggerPass.at("HLT_2mu10")
-                          || m_triggerPass.at("HLT_mu18_mu8noL1")
-                          || m_triggerPass.at("HLT_e17_lhloose_mu14")
-                          || m_triggerPass.at("HLT_e7_lhmedium_mu24");
-        } else if (year == 2016) {
-            passDilepTrig |= m_triggerPass.at("HLT_2e17_lhvloose_nod0")
-                          || m_triggerPass.at("HLT_mu22_mu8noL1")
-                          || m_triggerPass.at("HLT_2mu14")
-                          || m_triggerPass.at("HLT_e26_lhmedium_nod0_L1EM22VHI_mu8noL1")
-                          || m_triggerPass.at("HLT_e17_lhloose_nod0_mu14")
-                          || m_triggerPass.at("HLT_e7_lhmedium_nod0_mu24");
-        } else if (year == 2017) {
-            passDilepTrig |= m_triggerPass.at("HLT_2e24_lhvloose_nod0")
-                          || m_triggerPass.at("HLT_mu22_mu8noL1")
-                          || m_triggerPass.at("HLT_2mu14")
-                          || m_triggerPass.at("HLT_e26_lhmedium_nod0_mu8noL1")
-                          || m_triggerPass.at("HLT_e17_lhloose_nod0_mu14")
-                          || m_triggerPass.at("HLT_e7_lhmedium_nod0_mu24");
-        } else if (year == 2018) {
-            passDilepTrig |= m_triggerPass.at("HLT_2e24_lhvloose_nod0")
-                          || m_triggerPass.at("HLT_2e17_lhvloose_nod0_L12EM15VHI")
-                          || m_triggerPass.at("HLT_mu22_mu8noL1")
-                          || m_triggerPass.at("HLT_2mu14")
-                          || m_triggerPass.at("HLT_e17_lhloose_nod0_mu14")
-                          || m_triggerPass.at("HLT_e26_lhmedium_nod0_mu8noL1")
-                          || m_triggerPass.at("HLT_e7_lhmedium_nod0_mu24");
-        }
-        m_triggerPass.emplace("dilepTrigs", passDilepTrig);
-
-        bool passTrig = passSingleLepTrig || passDilepTrig;
-        m_triggerPass.emplace("lepTrigs", passTrig);
-
-        // Jigsaw variables
-        if (m_leps.size() >= 2) {
-            // build the object map for the calculator
-            // the TTMET2LW calculator expects "leptons" and "met"
-            std::map<std::string, std::vector<TLorentzVector>> object_map;
-            object_map["leptons"] = { *m_leps.at(0), *m_leps.at(1) };
-            object_map["met"] = { m_MET };
-            m_calculator.load_event(object_map);
-            m_jigsaw_vars = m_calculator.variables();
-        }
-
-        ////////////////////////////////////////////////////////////////////////
-        return true; // All events pass this cut
-    };
-
-    return true;
+    }
+    ////////////////////////////////////////////////////////////////////////////
+    // Combined triggers
+    bool passSingleLepTrig = (ctx->m_triggerPass & menu.single_lep_mask).any();
+    bool passDilepTrig = (ctx->m_triggerPass & menu.dilep_mask).any();
+    ctx->m_triggerPass.set(to_idx(Trig::singleLepTrigs), passSingleLepTrig);
+    ctx->m_triggerPass.set(to_idx(Trig::dilepTrigs), passDilepTrig);
+    ctx->m_triggerPass.set(to_idx(Trig::lepTrigs), passSingleLepTrig || passDilepTrig);
 }
-void add_cleaning_cuts(Superflow* sf) {
-    *sf << CutName("Pass GRL") << [](Superlink* sl) -> bool {
-        return (sl->tools->passGRL(m_cutflags));
-    };
-    *sf << CutName("Error flags") << [](Superlink* sl) -> bool {
-        return (sl->tools->passLarErr(m_cutflags)
-                && sl->tools->passTileErr(m_cutflags)
-                && sl->tools->passSCTErr(m_cutflags)
-                && sl->tools->passTTC(m_cutflags));
-    };
-    *sf << CutName("pass Good Vertex") << [](Superlink * sl) -> bool {
-        return (sl->tools->passGoodVtx(m_cutflags));
+void add_cut(Superflow* sf, EventContext* ctx, const AnaCut& cut) {
+    std::function<bool(Superlink*)> pass = cut.pass;
+    if (cut.stages) {
+        unsigned stages = cut.stages;
+        std::function<bool(Superlink*)> cut_pass = cut.pass;
+        pass = [ctx, stages, cut_pass](Superlink* sl) -> bool {
+            require_stages(sl, ctx, stages);
+            return cut_pass(sl);
+        };
+    }
+    if (m_ana_options.profile_cuts == "") {
+        *sf << CutName(cut.name) << pass;
+        return;
+    }
+    size_t iprof = ctx->m_cut_profiles.size();
+    ctx->m_cut_profiles.push_back({cut.name});
+    *sf << CutName(cut.name) << [ctx, iprof, pass](Superlink* sl) -> bool {
+        auto start = std::chrono::steady_clock::now();
+        bool result = pass(sl);
+        auto stop = std::chrono::steady_clock::now();
+        CutProfile& prof = ctx->m_cut_profiles.at(iprof);
+        prof.n_eval++;
+        if (!result) prof.n_fail++;
+        prof.total_ns += std::chrono::duration<double, std::nano>(stop - start).count();
+        return result;
     };
-    *sf << CutName("pass bad muon veto") << [](Superlink* sl) -> bool {
+}
+vector<AnaCut> get_cleaning_cuts(EventContext* ctx) {
+    vector<AnaCut> cuts;
+    cuts.push_back({"Pass GRL", [ctx](Superlink* sl) -> bool {
+        return (sl->tools->passGRL(ctx->m_cutflags));
+    }});
+    cuts.push_back({"Error flags", [ctx](Superlink* sl) -> bool {
+        return (sl->tools->passLarErr(ctx->m_cutflags)
+                && sl->tools->passTileErr(ctx->m_cutflags)
+                && sl->tools->passSCTErr(ctx->m_cutflags)
+                && sl->tools->passTTC(ctx->m_cutflags));
+    }});
+    cuts.push_back({"pass Good Vertex", [ctx](Superlink * sl) -> bool {
+        return (sl->tools->passGoodVtx(ctx->m_cutflags));
+    }});
+    cuts.push_back({"pass bad muon veto", [](Superlink* sl) -> bool {
         return (sl->tools->passBadMuon(sl->preMuons));
-    };
-    //*sf << CutName("pass cosmic muon veto") << [](Superlink* sl) -> bool {
+    }});
+    //cuts.push_back({"pass cosmic muon veto", [](Superlink* sl) -> bool {
     //    return (sl->tools->passCosmicMuon(sl->baseMuons));
-    //};
-    *sf << CutName("pass jet cleaning") << [](Superlink* sl) -> bool {
+    //}});
+    cuts.push_back({"pass jet cleaning", [](Superlink* sl) -> bool {
         return (sl->tools->passJetCleaning(sl->baseJets));
+    }});
+    return cuts;
+}
+void add_cleaning_cuts(Superflow* sf, EventContext* ctx) {
+    vector<AnaCut> cuts = get_cleaning_cuts(ctx);
+    if (m_cut_profile.empty()) {
+        for (const AnaCut& cut : cuts) add_cut(sf, ctx, cut);
+        return;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Reordered cut chain
+    // The cleaning cuts only depend on the event so they are evaluated
+    // cheapest per rejected event first, when the first of them is asked
+    // for. The analysis cuts depend on each other and keep their order.
+    CutChain& chain = ctx->m_cleaning_chain;
+    chain.cuts = cuts;
+    chain.order = order_by_expected_cost(cuts, m_cut_profile);
+    static std::once_flag report_once;
+    std::call_once(report_once, [&chain]() {
+        cout << m_ana_name << "    Cleaning cuts evaluated in the order:\n";
+        for (int icut : chain.order) cout << "    " << chain.cuts.at(icut).name << '\n';
+    });
+    for (int icut = 0; icut < (int)cuts.size(); ++icut) {
+        add_cut(sf, ctx, {cuts.at(icut).name, [ctx, icut](Superlink* sl) -> bool {
+            return ctx->m_cleaning_chain.pass(sl, icut);
+        }});
+    }
+}
+vector<int> order_by_expected_cost(const vector<AnaCut>& cuts, const map<string, CutProfile>& profile) {
+    // For independent cuts the expected cost per event is smallest when they
+    // are evaluated in increasing cost / rejection. Cuts missing from the
+    // profile or that never reject go last in their canonical order.
+    auto rank = [&](int icut) -> double {
+        auto it = profile.find(cuts.at(icut).name);
+        if (it == profile.end() || it->second.n_fail == 0) return DBL_MAX;
+        return it->second.ns_per_eval() / it->second.rejection();
     };
+    vector<int> order;
+    for (int icut = 0; icut < (int)cuts.size(); ++icut) order.push_back(icut);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return rank(a) < rank(b); });
+    return order;
+}
+bool CutChain::pass(Superlink* sl, int icut) {
+    if (!m_run) {
+        m_run = true;
+        for (int jcut : order) {
+            m_evaluated |= 1ull << jcut;
+            if (!cuts[jcut].pass(sl)) break;
+            m_passed |= 1ull << jcut;
+        }
+    }
+    // Superflow counts a rejected event against the first failing cut in
+    // canonical order, which may be one the evaluation order had not reached
+    if (!(m_evaluated >> icut & 1)) {
+        m_evaluated |= 1ull << icut;
+        if (cuts[icut].pass(sl)) m_passed |= 1ull << icut;
+    }
+    return m_passed >> icut & 1;
 }
-void add_analysis_cuts(Superflow* sf) {
+vector<AnaCut> get_analysis_cuts(Selection sel, EventContext* ctx) {
+    bool baseline_DF = sel == Selection::baseline_DF;
+    bool baseline_SS = sel == Selection::baseline_SS;
+    bool baseline_SS_den = sel == Selection::baseline_SS_den;
+    bool zjets_3l = sel == Selection::zjets3l;
+    bool fake_baseline_DF = sel == Selection::fake_baseline_DF;
+    bool fake_zjets_3l = sel == Selection::fake_zjets3l;
+    bool zjets2l_inc = sel == Selection::zjets2l_inc;
+
+    vector<AnaCut> cuts;
     ////////////////////////////////////////////////////////////////////////////
     // Baseline Selections
-    if (m_baseline_DF || m_baseline_SS || m_fake_baseline_DF || m_baseline_SS_den) {
-        *sf << CutName("2 baseline leptons") << [](Superlink* /*sl*/) -> bool {
-            return m_leps.size() == 2;
-        };
-
-        if (m_baseline_DF || m_baseline_SS) {
-            *sf << CutName("2 signal leptons") << [](Superlink* /*sl*/) -> bool {
-                return (m_sigLeps.size() == 2);
-            };
-        } else if (m_fake_baseline_DF || m_baseline_SS_den) {
-            *sf << CutName("1 inverted and signal lepton") << [](Superlink* /*sl*/) -> bool {
-                return (m_invLeps.size() == 1 && m_sigLeps.size() == 1);
-            };
+    if (baseline_DF || baseline_SS || fake_baseline_DF || baseline_SS_den) {
+        cuts.push_back({"2 baseline leptons", [ctx](Superlink* /*sl*/) -> bool {
+            return ctx->m_leps.size() == 2;
+        }, STAGE_OBJECTS});
+
+        if (baseline_DF || baseline_SS) {
+            cuts.push_back({"2 signal leptons", [ctx](Superlink* /*sl*/) -> bool {
+                return (ctx->m_sigLeps.size() == 2);
+            }, STAGE_OBJECTS});
+        } else if (fake_baseline_DF || baseline_SS_den) {
+            cuts.push_back({"1 inverted and signal lepton", [ctx](Superlink* /*sl*/) -> bool {
+                return (ctx->m_invLeps.size() == 1 && ctx->m_sigLeps.size() == 1);
+            }, STAGE_OBJECTS});
         }
-        if (m_baseline_DF || m_fake_baseline_DF) {
-            *sf << CutName("opposite sign") << [](Superlink* /*sl*/) -> bool {
-                return (m_leps.at(0)->q * m_leps.at(1)->q < 0);
-            };
-            *sf << CutName("dilepton flavor (emu/mue)") << [](Superlink* /*sl*/) -> bool {
-                return (m_leps.at(0)->isEle() != m_leps.at(1)->isEle());
-            };
-        } else if (m_baseline_SS || m_baseline_SS_den) {
-            *sf << CutName("same sign") << [](Superlink* /*sl*/) -> bool {
-                return (m_leps.at(0)->q * m_leps.at(1)->q > 0);
-            };
-            *sf << CutName("if SF, then |mll - mZ| > 20") << [](Superlink* /*sl*/) -> bool {
-                if (m_leps.at(0)->isEle() == m_leps.at(1)->isEle()) {
-                    TLorentzVector dilepP4 = *m_leps.at(0) + *m_leps.at(1);
-                    return fabs(dilepP4.M() - ZMASS) > 20.0;
+        if (baseline_DF || fake_baseline_DF) {
+            cuts.push_back({"opposite sign", [ctx](Superlink* /*sl*/) -> bool {
+                return (ctx->m_leps.at(0)->q * ctx->m_leps.at(1)->q < 0);
+            }, STAGE_OBJECTS});
+            cuts.push_back({"dilepton flavor (emu/mue)", [ctx](Superlink* /*sl*/) -> bool {
+                return (ctx->m_leps.at(0)->isEle() != ctx->m_leps.at(1)->isEle());
+            }, STAGE_OBJECTS});
+        } else if (baseline_SS || baseline_SS_den) {
+            cuts.push_back({"same sign", [ctx](Superlink* /*sl*/) -> bool {
+                return (ctx->m_leps.at(0)->q * ctx->m_leps.at(1)->q > 0);
+            }, STAGE_OBJECTS});
+            cuts.push_back({"if SF, then |mll - mZ| > 20", [ctx](Superlink* /*sl*/) -> bool {
+                if (ctx->m_leps.at(0)->isEle() == ctx->m_leps.at(1)->isEle()) {
+                    return fabs(get_dilepton(ctx).m - ZMASS) > 20.0;
                 } else {
                     return true;
                 }
-            };
+            }, STAGE_OBJECTS});
         }
-        *sf << CutName("m_ll > 20 GeV") << [](Superlink* /*sl*/) -> bool {
-            TLorentzVector dilepP4 = *m_leps.at(0) + *m_leps.at(1);
-            return dilepP4.M() > 20.0;
-        };
+        cuts.push_back({"m_ll > 20 GeV", [ctx](Superlink* /*sl*/) -> bool {
+            return get_dilepton(ctx).m > 20.0;
+        }, STAGE_OBJECTS});
     ////////////////////////////////////////////////////////////////////////////
     // Z+Jets Fake Factor Selections
-    } else if (m_zjets_3l || m_fake_zjets_3l || m_zjets2l_inc) {
-        *sf << CutName("3 baseline leptons") << [](Superlink* /*sl*/) -> bool {
-            return (m_leps.size() == 3);
-        };
-        if (m_zjets_3l) {
-            *sf << CutName("3 signal and 0 inverted leptons") << [](Superlink* /*sl*/) -> bool {
-                return (m_sigLeps.size() == 3 && m_invLeps.size() == 0);
-            };
-        } else if (m_fake_zjets_3l) {
-            *sf << CutName("2 signal and 1 inverted lepton") << [](Superlink* /*sl*/) -> bool {
-                return (m_sigLeps.size() == 2 && m_invLeps.size() == 1);
-            };
-        } else if (m_zjets2l_inc) {
-            *sf << CutName(">=2 signal leptons") << [](Superlink* /*sl*/) -> bool {
-                return (m_sigLeps.size() >= 2);
-            };
+    } else if (zjets_3l || fake_zjets_3l || zjets2l_inc) {
+        cuts.push_back({"3 baseline leptons", [ctx](Superlink* /*sl*/) -> bool {
+            return (ctx->m_leps.size() == 3);
+        }, STAGE_OBJECTS});
+        if (zjets_3l) {
+            cuts.push_back({"3 signal and 0 inverted leptons", [ctx](Superlink* /*sl*/) -> bool {
+                return (ctx->m_sigLeps.size() == 3 && ctx->m_invLeps.size() == 0);
+            }, STAGE_OBJECTS});
+        } else if (fake_zjets_3l) {
+            cuts.push_back({"2 signal and 1 inverted lepton", [ctx](Superlink* /*sl*/) -> bool {
+                return (ctx->m_sigLeps.size() == 2 && ctx->m_invLeps.size() == 1);
+            }, STAGE_OBJECTS});
+        } else if (zjets2l_inc) {
+            cuts.push_back({">=2 signal leptons", [ctx](Superlink* /*sl*/) -> bool {
+                return (ctx->m_sigLeps.size() >= 2);
+            }, STAGE_OBJECTS});
+        }
+        cuts.push_back({"opposite sign", [ctx](Superlink* /*sl*/) -> bool {
+            return (ctx->m_ZLeps.at(0)->q * ctx->m_ZLeps.at(1)->q < 0);
+        }, STAGE_TRIGGER});
+        cuts.push_back({"Z dilepton flavor (ee/mumu)", [ctx](Superlink* /*sl*/) -> bool {
+            return ctx->m_ZLeps.at(0)->isEle() == ctx->m_ZLeps.at(1)->isEle();
+        }, STAGE_TRIGGER});
+        cuts.push_back({"|mZ_ll - Zmass| < 10 GeV", [ctx](Superlink* /*sl*/) -> bool {
+            return fabs(get_Z_system(ctx).m - ZMASS) < 10;
+        }, STAGE_TRIGGER});
+    }
+    cuts.push_back({"pass trigger", [ctx](Superlink* /*sl*/) -> bool {
+        return ctx->m_triggerPass.test(to_idx(Trig::lepTrigs));
+    }, STAGE_TRIGGER});
+    return cuts;
+}
+void add_analysis_cuts(Superflow* sf, EventContext* ctx) {
+    // Every selection starts with an objects cut and ends with the trigger
+    // cut, so the variables find those stages run. The variables reading the
+    // truth collections require that stage themselves, so it only runs for
+    // events passing every cut.
+    if (m_selections.size() == 1) {
+        vector<AnaCut> cuts = get_analysis_cuts(m_selections.front(), ctx);
+        for (const AnaCut& cut : cuts) add_cut(sf, ctx, cut);
+        return;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Multi-selection mode
+    // Every selection's cut chain is evaluated on the shared objects and the
+    // event is kept if any of them pass. The selections are disjoint (see
+    // can_overlap), so a kept event carries the state of its one selection.
+    for (Selection sel : m_selections) {
+        SelectionCuts sel_cuts {sel, get_analysis_cuts(sel, ctx), {}, {}};
+        sel_cuts.n_pass.assign(sel_cuts.cuts.size(), 0);
+        sel_cuts.sumw_pass.assign(sel_cuts.cuts.size(), 0);
+        ctx->m_selection_cuts.push_back(sel_cuts);
+    }
+    // The selection cuts are called directly, so the stages they need are
+    // run up front and the selection specific state is set here
+    add_cut(sf, ctx, {"pass selections", [ctx](Superlink* sl) -> bool {
+        ctx->m_stages_done |= STAGE_TRIGGER;
+        ctx->m_passSelections = 0;
+        const double weight = m_print_weighted_cutflow ? sl->weights->product() : 1;
+        int first_pass = -1;
+        int last_set = -1;
+        for (int isel = 0; isel < (int)ctx->m_selection_cuts.size(); ++isel) {
+            SelectionCuts& sel_cuts = ctx->m_selection_cuts.at(isel);
+            set_region_variables(sl, ctx, sel_cuts.sel);
+            last_set = isel;
+            bool pass = true;
+            for (uint icut = 0; icut < sel_cuts.cuts.size(); ++icut) {
+                if (!sel_cuts.cuts.at(icut).pass(sl)) { pass = false; break; }
+                sel_cuts.n_pass.at(icut)++;
+                sel_cuts.sumw_pass.at(icut) += weight;
+            }
+            if (!pass) continue;
+            ctx->m_passSelections |= 1 << static_cast<int>(sel_cuts.sel);
+            if (first_pass < 0) first_pass = isel;
+        }
+        if (first_pass < 0) return false;
+        if (first_pass != last_set) {
+            set_region_variables(sl, ctx, ctx->m_selection_cuts.at(first_pass).sel);
+        }
+        return true;
+    }, STAGE_OBJECTS | STAGE_ZTAG});
+}
+void RunSummary::add(const EventContext& ctx) {
+    RunSummary other;
+    other.selection_cuts = ctx.m_selection_cuts;
+    other.iff_lut_size = ctx.m_iff_lut.size();
+    other.iff_n_hits = ctx.m_iff_lut.n_hits();
+    other.iff_n_misses = ctx.m_iff_lut.n_misses();
+    other.iff_n_validated = ctx.m_iff_n_validated;
+    other.iff_n_mismatched = ctx.m_iff_n_mismatched;
+    other.fast_math_report = ctx.m_fast_math_report;
+    add(other);
+}
+void RunSummary::add(const RunSummary& other) {
+    // The cuts are the same in every context, only the counts are summed
+    if (selection_cuts.empty()) {
+        selection_cuts = other.selection_cuts;
+    } else {
+        for (uint isel = 0; isel < selection_cuts.size(); ++isel) {
+            for (uint icut = 0; icut < selection_cuts.at(isel).n_pass.size(); ++icut) {
+                selection_cuts.at(isel).n_pass.at(icut) += other.selection_cuts.at(isel).n_pass.at(icut);
+            }
+            for (uint icut = 0; icut < selection_cuts.at(isel).sumw_pass.size(); ++icut) {
+                selection_cuts.at(isel).sumw_pass.at(icut) += other.selection_cuts.at(isel).sumw_pass.at(icut);
+            }
+        }
+    }
+    iff_lut_size = std::max(iff_lut_size, other.iff_lut_size);
+    iff_n_hits += other.iff_n_hits;
+    iff_n_misses += other.iff_n_misses;
+    iff_n_validated += other.iff_n_validated;
+    iff_n_mismatched += other.iff_n_mismatched;
+    fast_math_report.add(other.fast_math_report);
+}
+void print_run_summary(const RunSummary& summary) {
+    print_selection_cutflows(summary.selection_cuts);
+    print_IFF_summary(summary);
+    print_fast_math_summary(summary);
+}
+bool read_cut_profile(const string& file_name, map<string, CutProfile>& profile) {
+    std::ifstream ifs(file_name);
+    if (!ifs) {
+        cout << "ERROR :: Unable to read cut profile " << file_name << '\n';
+        return false;
+    }
+    // Tab separated: name, events evaluated, events rejected, total time [ns]
+    string line;
+    while (std::getline(ifs, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::stringstream ss(line);
+        CutProfile prof;
+        string n_eval, n_fail, total_ns;
+        if (!std::getline(ss, prof.name, '\t') || !std::getline(ss, n_eval, '\t')
+            || !std::getline(ss, n_fail, '\t') || !std::getline(ss, total_ns, '\t')) {
+            cout << "ERROR :: Malformed line in cut profile " << file_name << ": " << line << '\n';
+            return false;
+        }
+        prof.n_eval = atoll(n_eval.c_str());
+        prof.n_fail = atoll(n_fail.c_str());
+        prof.total_ns = atof(total_ns.c_str());
+        profile[prof.name] = prof;
+    }
+    return true;
+}
+bool write_cut_profile(const string& file_name, const vector<CutProfile>& profiles) {
+    std::ofstream ofs(file_name);
+    if (!ofs) {
+        cout << "ERROR :: Unable to write cut profile " << file_name << '\n';
+        return false;
+    }
+    ofs << "# name\tevents evaluated\tevents rejected\ttotal time [ns]\n";
+    for (const CutProfile& prof : profiles) {
+        ofs << prof.name << '\t' << prof.n_eval << '\t' << prof.n_fail << '\t' << prof.total_ns << '\n';
+    }
+    return true;
+}
+void print_cut_profile(const vector<CutProfile>& profiles) {
+    cout << m_ana_name << "    Cut profile (cost per evaluation, rejection of events reaching the cut)\n";
+    for (const CutProfile& prof : profiles) {
+        cout << "    " << prof.name << " : " << prof.ns_per_eval() / 1000. << " us, "
+             << 100. * prof.rejection() << "% of " << prof.n_eval << '\n';
+    }
+}
+void print_selection_cutflows(const vector<SelectionCuts>& selection_cuts) {
+    for (const SelectionCuts& sel_cuts : selection_cuts) {
+        cout << m_ana_name << "    Cutflow for " << selection_name(sel_cuts.sel)
+             << " (after cleaning cuts)\n";
+        for (uint icut = 0; icut < sel_cuts.cuts.size(); ++icut) {
+            cout << "    " << sel_cuts.cuts.at(icut).name << " : "
+                 << sel_cuts.n_pass.at(icut);
+            if (m_print_weighted_cutflow && icut < sel_cuts.sumw_pass.size()) {
+                cout << " (weighted " << sel_cuts.sumw_pass.at(icut) << ')';
+            }
+            cout << '\n';
         }
-        *sf << CutName("opposite sign") << [](Superlink* /*sl*/) -> bool {
-            return (m_ZLeps.at(0)->q * m_ZLeps.at(1)->q < 0);
-        };
-        *sf << CutName("Z dilepton flavor (ee/mumu)") << [](Superlink* /*sl*/) -> bool {
-            return m_ZLeps.at(0)->isEle() == m_ZLeps.at(1)->isEle();
-        };
-        *sf << CutName("|mZ_ll - Zmass| < 10 GeV") << [](Superlink* /*sl*/) -> bool {
-            TLorentzVector ZLepsP4 = *m_ZLeps.at(0) + *m_ZLeps.at(1);
-            return fabs(ZLepsP4.M() - ZMASS) < 10;
-        };
     }
-    *sf << CutName("pass trigger") << [](Superlink* /*sl*/) -> bool {
-        return m_triggerPass.at("lepTrigs");
-    };
 }
 
-void add_4bcutflow_cuts(Superflow* sf) {
-    *sf << CutName("Error flags") << [](Superlink* sl) -> bool {
-        return (sl->tools->passLarErr(m_cutflags)
-                && sl->tools->passTileErr(m_cutflags)
-                && sl->tools->passSCTErr(m_cutflags)
-                && sl->tools->passTTC(m_cutflags));
+void add_4bcutflow_cuts(Superflow* sf, EventContext* ctx) {
+    *sf << CutName("Error flags") << [ctx](Superlink* sl) -> bool {
+        return (sl->tools->passLarErr(ctx->m_cutflags)
+                && sl->tools->passTileErr(ctx->m_cutflags)
+                && sl->tools->passSCTErr(ctx->m_cutflags)
+                && sl->tools->passTTC(ctx->m_cutflags));
     };
-    *sf << CutName("pass Good Vertex") << [](Superlink * sl) -> bool {
-        return (sl->tools->passGoodVtx(m_cutflags));
+    *sf << CutName("pass Good Vertex") << [ctx](Superlink * sl) -> bool {
+        return (sl->tools->passGoodVtx(ctx->m_cutflags));
     };
-    *sf << CutName("pass Trigger") << [](Superlink * sl) -> bool {
-        return (sl->tools->triggerTool().passTrigger(sl->nt->evt()->trigBits, "HLT_e17_lhloose_nod0_mu14"));
+    *sf << CutName("pass Trigger") << [ctx](Superlink * sl) -> bool {
+        return (is_trig_fired(sl, ctx, Trig::HLT_e17_lhloose_nod0_mu14));
     };
 
     *sf << CutName("pass cleaing") << [](Superlink* sl) -> bool {
         return (sl->tools->passJetCleaning(sl->baseJets)
                 && sl->tools->passBadMuon(sl->preMuons));
     };
-    *sf << CutName("exactly two base leptons") << [](Superlink* /*sl*/) -> bool {
-        return m_leps.size() == 2;
+    *sf << CutName("exactly two base leptons") << [ctx](Superlink* sl) -> bool {
+        require_stages(sl, ctx, STAGE_TRIGGER);
+        return ctx->m_leps.size() == 2;
     };
 
-    *sf << CutName("opposite sign") << [](Superlink* /*sl*/) -> bool {
-        return (m_leps.at(0)->q * m_leps.at(1)->q < 0);
+    *sf << CutName("opposite sign") << [ctx](Superlink* /*sl*/) -> bool {
+        return (ctx->m_leps.at(0)->q * ctx->m_leps.at(1)->q < 0);
     };
 
-    *sf << CutName("isolation") << [](Superlink* /*sl*/) -> bool {
-        bool passIso1 = m_leps.at(0)->isEle() ? m_leps.at(0)->isoGradient : m_leps.at(0)->isoFCLoose;
-        bool passIso2 = m_leps.at(1)->isEle() ? m_leps.at(1)->isoGradient : m_leps.at(1)->isoFCLoose;
+    *sf << CutName("isolation") << [ctx](Superlink* /*sl*/) -> bool {
+        bool passIso1 = ctx->m_leps.at(0)->isEle() ? ctx->m_leps.at(0)->isoGradient : ctx->m_leps.at(0)->isoFCLoose;
+        bool passIso2 = ctx->m_leps.at(1)->isEle() ? ctx->m_leps.at(1)->isoGradient : ctx->m_leps.at(1)->isoFCLoose;
         return passIso1 && passIso2;
     };
 
-    *sf << CutName("exactly two signal leptons") << [](Superlink* /*sl*/) -> bool {
-        return (m_sigLeps.size() == 2);
+    *sf << CutName("exactly two signal leptons") << [ctx](Superlink* /*sl*/) -> bool {
+        return (ctx->m_sigLeps.size() == 2);
     };
 
-    *sf << CutName("truth origin") << [](Superlink* /*sl*/) -> bool {
-        bool promptLep1 = m_sigLeps.at(0)->mcOrigin == 10 || // Top
-                          m_sigLeps.at(0)->mcOrigin == 12 || // W
-                          m_sigLeps.at(0)->mcOrigin == 13 || // Z
-                          m_sigLeps.at(0)->mcOrigin == 14 || // Higgs
-                          m_sigLeps.at(0)->mcOrigin == 43;   // Diboson
-        bool promptLep2 = m_sigLeps.at(1)->mcOrigin == 10 || // Top
-                          m_sigLeps.at(1)->mcOrigin == 12 || // W
-                          m_sigLeps.at(1)->mcOrigin == 13 || // Z
-                          m_sigLeps.at(1)->mcOrigin == 14 || // Higgs
-                          m_sigLeps.at(1)->mcOrigin == 43;   // Diboson
+    *sf << CutName("truth origin") << [ctx](Superlink* /*sl*/) -> bool {
+        bool promptLep1 = ctx->m_sigLeps.at(0)->mcOrigin == 10 || // Top
+                          ctx->m_sigLeps.at(0)->mcOrigin == 12 || // W
+                          ctx->m_sigLeps.at(0)->mcOrigin == 13 || // Z
+                          ctx->m_sigLeps.at(0)->mcOrigin == 14 || // Higgs
+                          ctx->m_sigLeps.at(0)->mcOrigin == 43;   // Diboson
+        bool promptLep2 = ctx->m_sigLeps.at(1)->mcOrigin == 10 || // Top
+                          ctx->m_sigLeps.at(1)->mcOrigin == 12 || // W
+                          ctx->m_sigLeps.at(1)->mcOrigin == 13 || // Z
+                          ctx->m_sigLeps.at(1)->mcOrigin == 14 || // Higgs
+                          ctx->m_sigLeps.at(1)->mcOrigin == 43;   // Diboson
         return promptLep1 && promptLep2;
     };
 
-    *sf << CutName("eta requirement") << [](Superlink* /*sl*/) -> bool {
-        float eta1 = fabs(m_sigLeps.at(0)->eta);
-        float eta2 = fabs(m_sigLeps.at(1)->eta);
-        bool passEta1 = m_sigLeps.at(0)->isEle() ? eta1 < 2.47 : eta1 < 2.4;
-        bool passEta2 = m_sigLeps.at(1)->isEle() ? eta2 < 2.47 : eta2 < 2.4;
+    *sf << CutName("eta requirement") << [ctx](Superlink* /*sl*/) -> bool {
+        float eta1 = fabs(ctx->m_sigLeps.at(0)->eta);
+        float eta2 = fabs(ctx->m_sigLeps.at(1)->eta);
+        bool passEta1 = ctx->m_sigLeps.at(0)->isEle() ? eta1 < 2.47 : eta1 < 2.4;
+        bool passEta2 = ctx->m_sigLeps.at(1)->isEle() ? eta2 < 2.47 : eta2 < 2.4;
         return passEta1 && passEta2;
     };
 
-    *sf << CutName("pass HLT_e17_lhloose_nod0_mu14") << [](Superlink* /*sl*/) -> bool {
-        return (m_triggerPass.at("HLT_e17_lhloose_nod0_mu14"));
+    *sf << CutName("pass HLT_e17_lhloose_nod0_mu14") << [ctx](Superlink* /*sl*/) -> bool {
+        return (ctx->m_triggerPass.test(to_idx(Trig::HLT_e17_lhloose_nod0_mu14)));
     };
 
-    *sf << CutName("m_ll > 20 GeV") << [](Superlink* /*sl*/) -> bool {
-        TLorentzVector dilepP4 = *m_leps.at(0) + *m_leps.at(1);
-        return dilepP4.M() > 20.0;
+    *sf << CutName("m_ll > 20 GeV") << [ctx](Superlink* /*sl*/) -> bool {
+        return get_dilepton(ctx).m > 20.0;
     };
 
-    *sf << CutName("lep1Pt > 25GeV") << [](Superlink* /*sl*/) -> bool {
-        return m_sigLeps.at(0)->Pt() > 25.0;
+    *sf << CutName("lep1Pt > 25GeV") << [ctx](Superlink* /*sl*/) -> bool {
+        return ctx->m_sigLeps.at(0)->Pt() > 25.0;
     };
 
-    *sf << CutName("lep2Pt > 20GeV") << [](Superlink* /*sl*/) -> bool {
-        return m_sigLeps.at(1)->Pt() > 20.0;
+    *sf << CutName("lep2Pt > 20GeV") << [ctx](Superlink* /*sl*/) -> bool {
+        return ctx->m_sigLeps.at(1)->Pt() > 20.0;
     };
 
-    *sf << CutName("MET > 250GeV") << [](Superlink* /*sl*/) -> bool {
-        return m_MET.Pt() > 250.0;
+    *sf << CutName("MET > 250GeV") << [ctx](Superlink* /*sl*/) -> bool {
+        return ctx->m_MET.pt > 250.0;
     };
 }
 
-void add_event_variables(Superflow* sf) {
+void add_event_variables(VarFlow* sf, EventContext* ctx) {
     // Event weights
     *sf << NewVar("event weight (multi period)"); {
         *sf << HFTname("eventweight_multi");
@@ -1460,27 +3085,35 @@ void add_event_variables(Superflow* sf) {
         *sf << SaveVar();
     }
 
+    if (m_selections.size() > 1) {
+        *sf << NewVar("Selections passed (bit per Selection)"); {
+            *sf << HFTname("passSelections");
+            *sf << [ctx](Superlink* /*sl*/, var_int*) -> int { return ctx->m_passSelections; };
+            *sf << SaveVar();
+        }
+    }
+
     *sf << NewVar("pT ordering of signal and inverted lepton types"); {
         *sf << HFTname("recoLepOrderType");
-        *sf << [](Superlink* /*sl*/, var_int*) -> int {
+        *sf << [ctx](Superlink* /*sl*/, var_int*) -> int {
             bool l0isSig = false, l1isSig = false, l2isSig = false;
             bool l0isInv = false, l1isInv = false, l2isInv = false;
-            if (m_leps.size() >= 2) {
-                l0isSig = isSignal(m_leps.at(0));
-                l1isSig = isSignal(m_leps.at(1));
-                l0isInv = isInverted(m_leps.at(0));
-                l1isInv = isInverted(m_leps.at(1));
-                if (m_leps.size() >= 3) {
-                    l2isSig = isSignal(m_leps.at(2));
-                    l2isInv = isInverted(m_leps.at(2));
+            if (ctx->m_leps.size() >= 2) {
+                l0isSig = isSignal(ctx->m_leps.at(0), ctx);
+                l1isSig = isSignal(ctx->m_leps.at(1), ctx);
+                l0isInv = isInverted(ctx->m_leps.at(0), ctx);
+                l1isInv = isInverted(ctx->m_leps.at(1), ctx);
+                if (ctx->m_leps.size() >= 3) {
+                    l2isSig = isSignal(ctx->m_leps.at(2), ctx);
+                    l2isInv = isInverted(ctx->m_leps.at(2), ctx);
                 }
             }
-            if (m_leps.size() == 2) {
+            if (ctx->m_leps.size() == 2) {
                 if (l0isSig && l1isSig) return 1;
                 if (l0isSig && l1isInv) return 2;
                 if (l0isInv && l1isSig) return 3;
                 if (l0isInv && l1isInv) return 4;
-            } else if (m_leps.size() == 3) {
+            } else if (ctx->m_leps.size() == 3) {
                 if (l0isSig && l1isSig && l2isSig) return 5;
                 if (l0isSig && l1isSig && l2isInv) return 6;
                 if (l0isSig && l1isInv && l2isSig) return 7;
@@ -1497,26 +3130,26 @@ void add_event_variables(Superflow* sf) {
 
     *sf << NewVar("pT ordering of prompt and fnp lepton types"); {
         *sf << HFTname("truthLepOrderType");
-        *sf << [](Superlink* sl, var_int*) -> int {
+        *sf << [ctx](Superlink* sl, var_int*) -> int {
             if (!sl->isMC) return -1;
             bool l0isPmt = false, l1isPmt = false, l2isPmt = false;
             bool l0isFnp = false, l1isFnp = false, l2isFnp = false;
-            if (m_leps.size() >= 2) {
-                l0isPmt = isPrompt(m_leps.at(0));
-                l1isPmt = isPrompt(m_leps.at(1));
-                l0isFnp = isFNP(m_leps.at(0));
-                l1isFnp = isFNP(m_leps.at(1));
-                if (m_leps.size() >= 3) {
-                    l2isPmt = isPrompt(m_leps.at(2));
-                    l2isFnp = isFNP(m_leps.at(2));
+            if (ctx->m_leps.size() >= 2) {
+                l0isPmt = isPrompt(ctx->m_leps.at(0), ctx);
+                l1isPmt = isPrompt(ctx->m_leps.at(1), ctx);
+                l0isFnp = isFNP(ctx->m_leps.at(0), ctx);
+                l1isFnp = isFNP(ctx->m_leps.at(1), ctx);
+                if (ctx->m_leps.size() >= 3) {
+                    l2isPmt = isPrompt(ctx->m_leps.at(2), ctx);
+                    l2isFnp = isFNP(ctx->m_leps.at(2), ctx);
                 }
             }
-            if (m_leps.size() == 2) {
+            if (ctx->m_leps.size() == 2) {
                 if (l0isPmt && l1isPmt) return 1;
                 if (l0isPmt && l1isFnp) return 2;
                 if (l0isFnp && l1isPmt) return 3;
                 if (l0isFnp && l1isFnp) return 4;
-            } else if (m_leps.size() == 3) {
+            } else if (ctx->m_leps.size() == 3) {
                 if (l0isPmt && l1isPmt && l2isPmt) return 5;
                 if (l0isPmt && l1isPmt && l2isFnp) return 6;
                 if (l0isPmt && l1isFnp && l2isPmt) return 7;
@@ -1532,7 +3165,53 @@ void add_event_variables(Superflow* sf) {
     }
 }
 
-void add_trigger_variables(Superflow* sf) {
+void add_trigger_variables(VarFlow* sf, EventContext* ctx) {
+    if (m_ana_options.packed_triggers) {
+        add_packed_trigger_pass_variables(sf, ctx);
+    } else {
+        add_trigger_pass_variables(sf, ctx);
+    }
+
+    *sf << NewVar("Inverted lepton fired trigger"); {
+        *sf << HFTname("trigMatchedToInvLep");
+        *sf << [ctx](Superlink* /*sl*/, var_bool*) -> bool {
+            return (ctx->m_trigLep_idx0 >=0 && isInverted(ctx->m_leps.at(ctx->m_trigLep_idx0), ctx)) 
+                || (ctx->m_trigLep_idx1 >=0 && isInverted(ctx->m_leps.at(ctx->m_trigLep_idx1), ctx));
+        };
+        *sf << SaveVar();
+    }
+    *sf << NewVar("pT ordering of leptons firing trigger"); {
+        *sf << HFTname("trigLepOrderType");
+        *sf << [ctx](Superlink* /*sl*/, var_int*) -> int {
+            bool l0Fired = ctx->m_trigLep_idx0 == 0 || ctx->m_trigLep_idx1 == 0;
+            bool l1Fired = ctx->m_trigLep_idx0 == 1 || ctx->m_trigLep_idx1 == 1;
+            bool l2Fired = ctx->m_trigLep_idx0 == 2 || ctx->m_trigLep_idx1 == 2;
+            if (ctx->m_leps.size() >= 2) {
+                if ( l0Fired && !l1Fired) return 1;
+                if (!l0Fired &&  l1Fired) return 2;
+                if ( l0Fired &&  l1Fired) return 3;
+            }
+            if (ctx->m_leps.size() >= 3) {
+                if ( l0Fired && !l1Fired && !l2Fired) return 4;
+                if (!l0Fired &&  l1Fired && !l2Fired) return 5;
+                if (!l0Fired && !l1Fired &&  l2Fired) return 6;
+                if ( l0Fired &&  l1Fired && !l2Fired) return 7;
+                if ( l0Fired && !l1Fired &&  l2Fired) return 8;
+                if (!l0Fired &&  l1Fired &&  l2Fired) return 9;
+            }
+            return 0;
+        };
+        *sf << SaveVar();
+    }
+    *sf << NewVar("Fired trigger"); {
+        *sf << HFTname("firedTrig");
+        *sf << [ctx](Superlink* /*sl*/, var_int*) -> int {
+            return static_cast<int>(ctx->m_firedTrig);
+        };
+        *sf << SaveVar();
+    }
+}
+void add_trigger_pass_variables(VarFlow* sf, EventContext* ctx) {
     ////////////////////////////////////////////////////////////////////////////
     // Trigger Variables
     // ADD_*_TRIGGER_VAR preprocessor defined
@@ -1592,86 +3271,57 @@ void add_trigger_variables(Superflow* sf) {
 
     *sf << NewVar("Pass single lepton triggers"); {
         *sf << HFTname("passSingleLepTrigs");
-        *sf << [](Superlink* /*sl*/, var_bool*) -> bool {
-            return m_triggerPass.at("singleLepTrigs");
+        *sf << [ctx](Superlink* /*sl*/, var_bool*) -> bool {
+            return ctx->m_triggerPass.test(to_idx(Trig::singleLepTrigs));
         };
         *sf << SaveVar();
     }
     *sf << NewVar("Pass dilepton triggers"); {
         *sf << HFTname("passDilepTrigs");
-        *sf << [](Superlink* /*sl*/, var_bool*) -> bool {
-            return m_triggerPass.at("dilepTrigs");
+        *sf << [ctx](Superlink* /*sl*/, var_bool*) -> bool {
+            return ctx->m_triggerPass.test(to_idx(Trig::dilepTrigs));
         };
         *sf << SaveVar();
     }
     *sf << NewVar("Pass single or dilepton triggers"); {
         *sf << HFTname("passLepTrigs");
-        *sf << [](Superlink* /*sl*/, var_bool*) -> bool {
-            return m_triggerPass.at("lepTrigs");
-        };
-        *sf << SaveVar();
-    }
-
-    *sf << NewVar("Inverted lepton fired trigger"); {
-        *sf << HFTname("trigMatchedToInvLep");
-        *sf << [](Superlink* /*sl*/, var_bool*) -> bool {
-            return (m_trigLep_idx0 >=0 && isInverted(m_leps.at(m_trigLep_idx0))) 
-                || (m_trigLep_idx1 >=0 && isInverted(m_leps.at(m_trigLep_idx1)));
-        };
-        *sf << SaveVar();
-    }
-    *sf << NewVar("pT ordering of leptons firing trigger"); {
-        *sf << HFTname("trigLepOrderType");
-        *sf << [](Superlink* /*sl*/, var_int*) -> int {
-            bool l0Fired = m_trigLep_idx0 == 0 || m_trigLep_idx1 == 0;
-            bool l1Fired = m_trigLep_idx0 == 1 || m_trigLep_idx1 == 1;
-            bool l2Fired = m_trigLep_idx0 == 2 || m_trigLep_idx1 == 2;
-            if (m_leps.size() >= 2) {
-                if ( l0Fired && !l1Fired) return 1;
-                if (!l0Fired &&  l1Fired) return 2;
-                if ( l0Fired &&  l1Fired) return 3;
-            }
-            if (m_leps.size() >= 3) {
-                if ( l0Fired && !l1Fired && !l2Fired) return 4;
-                if (!l0Fired &&  l1Fired && !l2Fired) return 5;
-                if (!l0Fired && !l1Fired &&  l2Fired) return 6;
-                if ( l0Fired &&  l1Fired && !l2Fired) return 7;
-                if ( l0Fired && !l1Fired &&  l2Fired) return 8;
-                if (!l0Fired &&  l1Fired &&  l2Fired) return 9;
-            }
-            return 0;
+        *sf << [ctx](Superlink* /*sl*/, var_bool*) -> bool {
+            return ctx->m_triggerPass.test(to_idx(Trig::lepTrigs));
         };
         *sf << SaveVar();
     }
-    *sf << NewVar("Fired trigger"); {
-        *sf << HFTname("firedTrig");
-        *sf << [](Superlink* /*sl*/, var_int*) -> int {
-            return m_trig_enum.at(m_firedTrig);
+}
+void add_packed_trigger_pass_variables(VarFlow* sf, EventContext* ctx) {
+    // Decoded with LexStop2LAnalysis/TriggerBits.h
+    *sf << NewVar("Trigger pass bits"); {
+        *sf << HFTname("trigPassBits");
+        *sf << [ctx](Superlink* /*sl*/, var_int*) -> int {
+            return static_cast<int>(ctx->m_triggerPass.to_ulong());
         };
         *sf << SaveVar();
     }
 }
-void add_lepton_variables(Superflow* sf) {
-
-    ADD_LEPTON_VARS(lep);
-    ADD_LEPTON_VARS(sigLep);
-    ADD_LEPTON_VARS(invLep);
-    ADD_LEPTON_VARS(ZLep);
-    ADD_LEPTON_VARS(probeLep);
-    add_lepton_property_flags(sf);
-    add_lepton_property_indexes(sf);
+void add_lepton_variables(VarFlow* sf, EventContext* ctx) {
+
+    ADD_LEPTON_VARS(lep, 0);
+    ADD_LEPTON_VARS(sigLep, 0);
+    ADD_LEPTON_VARS(invLep, 0);
+    ADD_LEPTON_VARS(ZLep, 0);
+    ADD_LEPTON_VARS(probeLep, 0);
+    add_lepton_property_flags(sf, ctx);
+    add_lepton_property_indexes(sf, ctx);
 }
 
-void add_mc_lepton_variables(Superflow* sf) {
-    ADD_LEPTON_VARS(promptLep);
-    ADD_LEPTON_VARS(fnpLep);
-    //ADD_LEPTON_VARS(promptSigLep);
-    //ADD_LEPTON_VARS(promptInvLep);
-    //ADD_LEPTON_VARS(fnpSigLep);
-    //ADD_LEPTON_VARS(fnpInvLep);
+void add_mc_lepton_variables(VarFlow* sf, EventContext* ctx) {
+    ADD_LEPTON_VARS(promptLep, STAGE_TRUTH);
+    ADD_LEPTON_VARS(fnpLep, STAGE_TRUTH);
+    //ADD_LEPTON_VARS(promptSigLep, STAGE_TRUTH);
+    //ADD_LEPTON_VARS(promptInvLep, STAGE_TRUTH);
+    //ADD_LEPTON_VARS(fnpSigLep, STAGE_TRUTH);
+    //ADD_LEPTON_VARS(fnpInvLep, STAGE_TRUTH);
 
-    add_mc_lepton_property_flags(sf);
-    add_mc_lepton_property_indexes(sf);
+    add_mc_lepton_property_flags(sf, ctx);
+    add_mc_lepton_property_indexes(sf, ctx);
 }
 bool isSignal(const Susy::Lepton* lep, Superlink* sl) {
     if (lep == nullptr) return false;
@@ -1685,9 +3335,9 @@ bool isSignal(const Susy::Lepton* lep, Superlink* sl) {
         return sl->tools->muonSelector().isSignal(mu);
     }
 }
-bool isSignal(const Susy::Lepton* lep) {
-    auto it = find(m_sigLeps.begin(), m_sigLeps.end(), lep);
-    return it != m_sigLeps.end();
+bool isSignal(const Susy::Lepton* lep, const EventContext* ctx) {
+    auto it = find(ctx->m_sigLeps.begin(), ctx->m_sigLeps.end(), lep);
+    return it != ctx->m_sigLeps.end();
 }
 
 bool isInverted(const Susy::Lepton* lep, Superlink* sl) {
@@ -1700,12 +3350,12 @@ bool isInverted(const Susy::Lepton* lep, Superlink* sl) {
         return sl->tools->muonSelector().isAntiID(mu);
     }
 }
-bool isInverted(const Susy::Lepton* lep) {
-    auto it = find(m_invLeps.begin(), m_invLeps.end(), lep);
-    return it != m_invLeps.end();
+bool isInverted(const Susy::Lepton* lep, const EventContext* ctx) {
+    auto it = find(ctx->m_invLeps.begin(), ctx->m_invLeps.end(), lep);
+    return it != ctx->m_invLeps.end();
 }
-bool isPrompt(Susy::Lepton* lep) {
-    IFF::Type t = get_IFF_class(lep);
+bool isPrompt(Susy::Lepton* lep, EventContext* ctx) {
+    IFF::Type t = get_IFF_class(lep, ctx);
     switch (t) {
         case IFF::Type::PromptElectron: return true;
         case IFF::Type::ChargeFlipPromptElectron: return true;
@@ -1715,15 +3365,15 @@ bool isPrompt(Susy::Lepton* lep) {
             return false;
     }
 }
-bool isFNP(Susy::Lepton* lep) {
+bool isFNP(Susy::Lepton* lep, EventContext* ctx) {
     // Treats unknown truth types as fakes
     // Should aim to minimize unknowns
     // Reconsider this if unknowns are a problem
-    return !(isPrompt(lep));
+    return !(isPrompt(lep, ctx));
 }
-bool isUnknownTruth(Susy::Lepton* lep) {
-    //IFF::Type t = get_IFF_class(lep);
-    switch (get_IFF_class(lep)) {
+bool isUnknownTruth(Susy::Lepton* lep, EventContext* ctx) {
+    //IFF::Type t = get_IFF_class(lep, ctx);
+    switch (get_IFF_class(lep, ctx)) {
         case IFF::Type::Unknown: return true;
         case IFF::Type::KnownUnknown: return true;
         default:
@@ -1731,33 +3381,33 @@ bool isUnknownTruth(Susy::Lepton* lep) {
     }
 }
 
-void add_lepton_property_flags(Superflow* sf) {
+void add_lepton_property_flags(VarFlow* sf, EventContext* ctx) {
     *sf << NewVar("lepton is signal (i.e. ID)"); {
         *sf << HFTname("lepIsSig");
-        *sf << [](Superlink* /*sl*/, var_int_array*) -> vector<int> {
+        *sf << [ctx](Superlink* /*sl*/, var_int_array*) -> vector<int> {
             vector<int> out;
-            for (const Susy::Lepton* l : m_leps) { out.push_back( isSignal(l) ); }
+            for (const Susy::Lepton* l : ctx->m_leps) { out.push_back( isSignal(l, ctx) ); }
             return out;
         };
         *sf << SaveVar();
     }
     *sf << NewVar("lepton is inverted (i.e. Anti-ID)"); {
         *sf << HFTname("lepIsInv");
-        *sf << [](Superlink* /*sl*/, var_int_array*) -> vector<int> {
+        *sf << [ctx](Superlink* /*sl*/, var_int_array*) -> vector<int> {
             vector<int> out;
-            for (const Susy::Lepton* l : m_leps) { out.push_back( isInverted(l) ); }
+            for (const Susy::Lepton* l : ctx->m_leps) { out.push_back( isInverted(l, ctx) ); }
             return out;
         };
         *sf << SaveVar();
     }
 }
-void add_mc_lepton_property_flags(Superflow* sf) {
+void add_mc_lepton_property_flags(VarFlow* sf, EventContext* ctx) {
     *sf << NewVar("lepton is prompt"); {
         *sf << HFTname("lepIsPrompt");
-        *sf << [](Superlink* sl, var_int_array*) -> vector<int> {
+        *sf << [ctx](Superlink* sl, var_int_array*) -> vector<int> {
             vector<int> out;
-            for (Susy::Lepton* l : m_leps) {
-                bool result = sl->isMC ? isPrompt(l) : false;
+            for (Susy::Lepton* l : ctx->m_leps) {
+                bool result = sl->isMC ? isPrompt(l, ctx) : false;
                 out.push_back(result);
             }
             return out;
@@ -1766,10 +3416,10 @@ void add_mc_lepton_property_flags(Superflow* sf) {
     }
     *sf << NewVar("lepton is fake or non-prompt"); {
         *sf << HFTname("lepIsFNP");
-        *sf << [](Superlink* sl, var_int_array*) -> vector<int> {
+        *sf << [ctx](Superlink* sl, var_int_array*) -> vector<int> {
             vector<int> out;
-            for (Susy::Lepton* l : m_leps) {
-                bool result = sl->isMC ? isFNP(l) : false;
+            for (Susy::Lepton* l : ctx->m_leps) {
+                bool result = sl->isMC ? isFNP(l, ctx) : false;
                 out.push_back(result);
             }
             return out;
@@ -1778,10 +3428,10 @@ void add_mc_lepton_property_flags(Superflow* sf) {
     }
     *sf << NewVar("lepton is fake or non-prompt"); {
         *sf << HFTname("lepTruthIsUnknown");
-        *sf << [](Superlink* sl, var_int_array*) -> vector<int> {
+        *sf << [ctx](Superlink* sl, var_int_array*) -> vector<int> {
             vector<int> out;
-            for (Susy::Lepton* l : m_leps) {
-                bool result = sl->isMC ? isUnknownTruth(l) : false;
+            for (Susy::Lepton* l : ctx->m_leps) {
+                bool result = sl->isMC ? isUnknownTruth(l, ctx) : false;
                 out.push_back(result);
             }
             return out;
@@ -1790,10 +3440,10 @@ void add_mc_lepton_property_flags(Superflow* sf) {
     }
     *sf << NewVar("lepton is Z-tagged"); {
         *sf << HFTname("lepIsZtagged");
-        *sf << [](Superlink* /*sl*/, var_int_array*) -> vector<int> {
+        *sf << [ctx](Superlink* /*sl*/, var_int_array*) -> vector<int> {
             vector<int> out;
-            for (Susy::Lepton* l : m_leps) {
-                bool found = std::find(m_ZLeps.begin(), m_ZLeps.end(), l) != m_ZLeps.end();
+            for (Susy::Lepton* l : ctx->m_leps) {
+                bool found = std::find(ctx->m_ZLeps.begin(), ctx->m_ZLeps.end(), l) != ctx->m_ZLeps.end();
                 out.push_back(found);
             }
             return out;
@@ -1802,22 +3452,22 @@ void add_mc_lepton_property_flags(Superflow* sf) {
     }
     *sf << NewVar("lepton is trig matched"); {
         *sf << HFTname("lepIsTrigMatched");
-        *sf << [](Superlink* /*sl*/, var_int_array*) -> vector<int> {
-            vector<int> out(m_leps.size(), false);
-            if (m_trigLep_idx0 >= 0) out.at(m_trigLep_idx0) = true;
-            if (m_trigLep_idx1 >= 0) out.at(m_trigLep_idx1) = true;
+        *sf << [ctx](Superlink* /*sl*/, var_int_array*) -> vector<int> {
+            vector<int> out(ctx->m_leps.size(), false);
+            if (ctx->m_trigLep_idx0 >= 0) out.at(ctx->m_trigLep_idx0) = true;
+            if (ctx->m_trigLep_idx1 >= 0) out.at(ctx->m_trigLep_idx1) = true;
             return out;
         };
         *sf << SaveVar();
     }
 }
-void add_lepton_property_indexes(Superflow* sf) {
+void add_lepton_property_indexes(VarFlow* sf, EventContext* ctx) {
     *sf << NewVar("index of signal lepton (i.e. ID)"); {
         *sf << HFTname("sigLepIdx");
-        *sf << [](Superlink* /*sl*/, var_int_array*) -> vector<int> {
+        *sf << [ctx](Superlink* /*sl*/, var_int_array*) -> vector<int> {
             vector<int> out;
-            for (unsigned int idx=0; idx < m_leps.size(); idx++) {
-                if (isSignal(m_leps.at(idx))) { out.push_back(idx); }
+            for (unsigned int idx=0; idx < ctx->m_leps.size(); idx++) {
+                if (isSignal(ctx->m_leps.at(idx), ctx)) { out.push_back(idx); }
             }
             return out;
         };
@@ -1825,10 +3475,10 @@ void add_lepton_property_indexes(Superflow* sf) {
     }
     *sf << NewVar("index of inverted leptons (i.e. anti-ID)"); {
         *sf << HFTname("invLepIdx");
-        *sf << [](Superlink* /*sl*/, var_int_array*) -> vector<int> {
+        *sf << [ctx](Superlink* /*sl*/, var_int_array*) -> vector<int> {
             vector<int> out;
-            for (unsigned int idx=0; idx < m_leps.size(); idx++) {
-                if (isInverted(m_leps.at(idx))) { out.push_back(idx); }
+            for (unsigned int idx=0; idx < ctx->m_leps.size(); idx++) {
+                if (isInverted(ctx->m_leps.at(idx), ctx)) { out.push_back(idx); }
             }
             return out;
         };
@@ -1836,107 +3486,89 @@ void add_lepton_property_indexes(Superflow* sf) {
     }
     *sf << NewVar("index of probe leptons"); {
         *sf << HFTname("probeLepIdx");
-        *sf << [](Superlink* /*sl*/, var_int_array*) -> vector<int> {
+        *sf << [ctx](Superlink* /*sl*/, var_int_array*) -> vector<int> {
             vector<int> out;
-            //for (unsigned int idx=0; idx < m_leps.size(); idx++) {
-            //    if (isProbe(m_leps.at(idx))) { out.push_back(idx); }
+            //for (unsigned int idx=0; idx < ctx->m_leps.size(); idx++) {
+            //    if (isProbe(ctx->m_leps.at(idx))) { out.push_back(idx); }
             //}
-            out.push_back(m_probeLep_idx);
+            out.push_back(ctx->m_probeLep_idx);
             return out;
         };
         *sf << SaveVar();
     }
     *sf << NewVar("index of Z-tagged leptons"); {
         *sf << HFTname("ZLepIdx");
-        *sf << [](Superlink* /*sl*/, var_int_array*) -> vector<int> {
+        *sf << [ctx](Superlink* /*sl*/, var_int_array*) -> vector<int> {
             vector<int> out;
-            out.push_back(m_ztagged_idx1);
-            out.push_back(m_ztagged_idx2);
+            out.push_back(ctx->m_ztagged_idx1);
+            out.push_back(ctx->m_ztagged_idx2);
             return out;
         };
         *sf << SaveVar();
     }
     *sf << NewVar("index of trigger matched lepton"); {
         *sf << HFTname("trigMatchedLepIdx");
-        *sf << [](Superlink* /*sl*/, var_int_array*) -> vector<int> {
+        *sf << [ctx](Superlink* /*sl*/, var_int_array*) -> vector<int> {
             vector<int> out;
-            if (m_trigLep_idx0 >= 0) out.push_back(m_trigLep_idx0);
-            if (m_trigLep_idx1 >= 0) out.push_back(m_trigLep_idx1);
+            if (ctx->m_trigLep_idx0 >= 0) out.push_back(ctx->m_trigLep_idx0);
+            if (ctx->m_trigLep_idx1 >= 0) out.push_back(ctx->m_trigLep_idx1);
             return out;
         };
         *sf << SaveVar();
     }
 }
-void add_mc_lepton_property_indexes(Superflow* sf) {
+void add_mc_lepton_property_indexes(VarFlow* sf, EventContext* ctx) {
     *sf << NewVar("index of prompt leptons"); {
         *sf << HFTname("promptLepIdx");
-        *sf << [](Superlink* sl, var_int_array*) -> vector<int> {
-            vector<int> out;
-            for (unsigned int idx=0; idx < m_leps.size(); idx++) {
-                if (sl->isMC && isPrompt(m_leps.at(idx))) { out.push_back(idx); }
-            }
-            return out;
+        *sf << [ctx](Superlink* sl, var_int_array*) -> vector<int> {
+            require_stages(sl, ctx, STAGE_TRUTH); // empty for data
+            return ctx->m_promptLeps_idx;
         };
         *sf << SaveVar();
     }
     *sf << NewVar("index of fake or non-prompt leptons"); {
         *sf << HFTname("fnpLepIdx");
-        *sf << [](Superlink* sl, var_int_array*) -> vector<int> {
-            vector<int> out;
-            for (unsigned int idx=0; idx < m_leps.size(); idx++) {
-                if (sl->isMC && isFNP(m_leps.at(idx))) { out.push_back(idx); }
-            }
-            return out;
+        *sf << [ctx](Superlink* sl, var_int_array*) -> vector<int> {
+            require_stages(sl, ctx, STAGE_TRUTH); // empty for data
+            return ctx->m_fnpLeps_idx;
         };
         *sf << SaveVar();
     }
     *sf << NewVar("index of prompt signal leptons"); {
         *sf << HFTname("promptSigLepIdx");
-        *sf << [](Superlink* sl, var_int_array*) -> vector<int> {
-            vector<int> out;
-            for (unsigned int idx=0; idx < m_leps.size(); idx++) {
-                if (sl->isMC && isPrompt(m_leps.at(idx)) && isSignal(m_leps.at(idx))) { out.push_back(idx); }
-            }
-            return out;
+        *sf << [ctx](Superlink* sl, var_int_array*) -> vector<int> {
+            require_stages(sl, ctx, STAGE_TRUTH); // empty for data
+            return ctx->m_promptSigLeps_idx;
         };
         *sf << SaveVar();
     }
     *sf << NewVar("index of prompt inverted leptons"); {
         *sf << HFTname("promptInvLepIdx");
-        *sf << [](Superlink* sl, var_int_array*) -> vector<int> {
-            vector<int> out;
-            for (unsigned int idx=0; idx < m_leps.size(); idx++) {
-                if (sl->isMC && isPrompt(m_leps.at(idx)) && isInverted(m_leps.at(idx))) { out.push_back(idx); }
-            }
-            return out;
+        *sf << [ctx](Superlink* sl, var_int_array*) -> vector<int> {
+            require_stages(sl, ctx, STAGE_TRUTH); // empty for data
+            return ctx->m_promptInvLeps_idx;
         };
         *sf << SaveVar();
     }
     *sf << NewVar("index of fake or non-prompt signal leptons"); {
         *sf << HFTname("fnpSigLepIdx");
-        *sf << [](Superlink* sl, var_int_array*) -> vector<int> {
-            vector<int> out;
-            for (unsigned int idx=0; idx < m_leps.size(); idx++) {
-                if (sl->isMC && isFNP(m_leps.at(idx)) && isSignal(m_leps.at(idx))) { out.push_back(idx); }
-            }
-            return out;
+        *sf << [ctx](Superlink* sl, var_int_array*) -> vector<int> {
+            require_stages(sl, ctx, STAGE_TRUTH); // empty for data
+            return ctx->m_fnpSigLeps_idx;
         };
         *sf << SaveVar();
     }
     *sf << NewVar("index of fake or non-prompt inverted leptons"); {
         *sf << HFTname("fnpInvLepIdx");
-        *sf << [](Superlink* sl, var_int_array*) -> vector<int> {
-            vector<int> out;
-            for (unsigned int idx=0; idx < m_leps.size(); idx++) {
-                if (sl->isMC && isFNP(m_leps.at(idx)) && isInverted(m_leps.at(idx))) { out.push_back(idx); }
-            }
-            return out;
+        *sf << [ctx](Superlink* sl, var_int_array*) -> vector<int> {
+            require_stages(sl, ctx, STAGE_TRUTH); // empty for data
+            return ctx->m_fnpInvLeps_idx;
         };
         *sf << SaveVar();
     }
 }
 
-void add_jet_variables(Superflow* sf) {
+void add_jet_variables(VarFlow* sf, EventContext* ctx) {
     *sf << NewVar("number of jets"); {
         *sf << HFTname("nJets");
         *sf << [](Superlink* sl, var_int*) -> int {return sl->jets->size(); };
@@ -1945,77 +3577,83 @@ void add_jet_variables(Superflow* sf) {
 
     *sf << NewVar("number of light jets"); {
         *sf << HFTname("nLightJets");
-        *sf << [](Superlink* /*sl*/, var_int*) -> int {return m_light_jets.size(); };
+        *sf << [ctx](Superlink* /*sl*/, var_int*) -> int {return ctx->m_jet_table.n_light; };
         *sf << SaveVar();
     }
 
     *sf << NewVar("number of b-tagged jets"); {
         *sf << HFTname("nBJets");
-        *sf << [](Superlink* sl, var_int*) -> int { return sl->tools->numberOfBJets(*sl->jets); };
+        *sf << [ctx](Superlink* /*sl*/, var_int*) -> int { return ctx->m_jet_table.n_bjets; };
         *sf << SaveVar();
     }
 
     *sf << NewVar("number of forward jets"); {
         *sf << HFTname("nForwardJets");
-        *sf << [](Superlink* sl, var_int*) -> int { return sl->tools->numberOfFJets(*sl->jets); };
+        *sf << [ctx](Superlink* /*sl*/, var_int*) -> int { return ctx->m_jet_table.n_forward; };
         *sf << SaveVar();
     }
 
     *sf << NewVar("number of non-b-tagged jets"); {
         *sf << HFTname("nNonBJets");
-        *sf << [](Superlink* sl, var_int*) -> int { return sl->jets->size() - sl->tools->numberOfBJets(*sl->jets); };
+        *sf << [ctx](Superlink* /*sl*/, var_int*) -> int { return ctx->m_jet_table.size() - ctx->m_jet_table.n_bjets; };
         *sf << SaveVar();
     }
 
     *sf << NewVar("jet-1 Pt"); {
         *sf << HFTname("jet1Pt");
-        *sf << [](Superlink* sl, var_float*) -> double {
-            return sl->jets->size() >= 1 ? sl->jets->at(0)->Pt() : -DBL_MAX;
+        *sf << [ctx](Superlink* /*sl*/, var_float*) -> double {
+            const JetTable& jets = ctx->m_jet_table;
+            return jets.size() >= 1 ? jets.kin[0].pt : -DBL_MAX;
         };
         *sf << SaveVar();
     }
 
     *sf << NewVar("jet-1 Eta"); {
         *sf << HFTname("jet1Eta");
-        *sf << [](Superlink* sl, var_float*) -> double {
-            return sl->jets->size() >= 1 ? sl->jets->at(0)->Eta() : -DBL_MAX;
+        *sf << [ctx](Superlink* /*sl*/, var_float*) -> double {
+            const JetTable& jets = ctx->m_jet_table;
+            return jets.size() >= 1 ? jets.kin[0].eta : -DBL_MAX;
         };
         *sf << SaveVar();
     }
 
     *sf << NewVar("jet-1 Phi"); {
         *sf << HFTname("jet1Phi");
-        *sf << [](Superlink* sl, var_float*) -> double {
-            return sl->jets->size() >= 1 ? sl->jets->at(0)->Eta() : -DBL_MAX;
+        *sf << [ctx](Superlink* /*sl*/, var_float*) -> double {
+            const JetTable& jets = ctx->m_jet_table;
+            return jets.size() >= 1 ? jets.kin[0].eta : -DBL_MAX;
         };
         *sf << SaveVar();
     }
 
     *sf << NewVar("jet-2 Pt"); {
         *sf << HFTname("jet2Pt");
-        *sf << [](Superlink* sl, var_float*) -> double {
-            return sl->jets->size() >= 2 ? sl->jets->at(1)->Pt() : -DBL_MAX;
+        *sf << [ctx](Superlink* /*sl*/, var_float*) -> double {
+            const JetTable& jets = ctx->m_jet_table;
+            return jets.size() >= 2 ? jets.kin[1].pt : -DBL_MAX;
         };
         *sf << SaveVar();
     }
 
     *sf << NewVar("jet-2 Eta"); {
         *sf << HFTname("jet2Eta");
-        *sf << [](Superlink* sl, var_float*) -> double {
-            return sl->jets->size() >= 2 ? sl->jets->at(1)->Eta() : -DBL_MAX;
+        *sf << [ctx](Superlink* /*sl*/, var_float*) -> double {
+            const JetTable& jets = ctx->m_jet_table;
+            return jets.size() >= 2 ? jets.kin[1].eta : -DBL_MAX;
         };
         *sf << SaveVar();
     }
 
     *sf << NewVar("jet-2 Phi"); {
         *sf << HFTname("jet2Phi");
-        *sf << [](Superlink* sl, var_float*) -> double {
-            return sl->jets->size() >= 2 ? sl->jets->at(1)->Phi() : -DBL_MAX;
+        *sf << [ctx](Superlink* /*sl*/, var_float*) -> double {
+            const JetTable& jets = ctx->m_jet_table;
+            return jets.size() >= 2 ? jets.kin[1].phi : -DBL_MAX;
         };
         *sf << SaveVar();
     }
 }
-void add_met_variables(Superflow* sf) {
+void add_met_variables(VarFlow* sf) {
     *sf << NewVar("transverse missing energy (Et)"); {
         *sf << HFTname("met");
         *sf << [](Superlink* sl, var_float*) -> double { return sl->met->Et; };
@@ -2028,163 +3666,173 @@ void add_met_variables(Superflow* sf) {
         *sf << SaveVar();
     }
 }
-void add_dilepton_variables(Superflow* sf) {
+void add_dilepton_variables(VarFlow* sf, EventContext* ctx) {
     *sf << NewVar("is e + e"); {
         *sf << HFTname("isElEl");
-        *sf << [](Superlink* /*sl*/, var_bool*) -> bool { return m_leps.at(0)->isEle() && m_leps.at(1)->isEle(); };
+        *sf << [ctx](Superlink* /*sl*/, var_bool*) -> bool { return ctx->m_leps.at(0)->isEle() && ctx->m_leps.at(1)->isEle(); };
         *sf << SaveVar();
     }
 
     *sf << NewVar("is mu + mu"); {
         *sf << HFTname("isMuMu");
-        *sf << [](Superlink* /*sl*/, var_bool*) -> bool { return m_leps.at(0)->isMu() && m_leps.at(1)->isMu(); };
+        *sf << [ctx](Superlink* /*sl*/, var_bool*) -> bool { return ctx->m_leps.at(0)->isMu() && ctx->m_leps.at(1)->isMu(); };
         *sf << SaveVar();
     }
 
     *sf << NewVar("is mu (lead) + e (sub)"); {
         *sf << HFTname("isMuEl");
-        *sf << [](Superlink* /*sl*/, var_bool*) -> bool { return m_leps.at(0)->isMu() && m_leps.at(1)->isEle(); };
+        *sf << [ctx](Superlink* /*sl*/, var_bool*) -> bool { return ctx->m_leps.at(0)->isMu() && ctx->m_leps.at(1)->isEle(); };
         *sf << SaveVar();
     }
 
     *sf << NewVar("is e (lead) + mu (sub)"); {
         *sf << HFTname("isElMu");
-        *sf << [](Superlink* /*sl*/, var_bool*) -> bool { return m_leps.at(0)->isEle() && m_leps.at(1)->isMu(); };
+        *sf << [ctx](Superlink* /*sl*/, var_bool*) -> bool { return ctx->m_leps.at(0)->isEle() && ctx->m_leps.at(1)->isMu(); };
         *sf << SaveVar();
     }
 
     *sf << NewVar("is opposite-sign"); {
         *sf << HFTname("isOS");
-        *sf << [](Superlink* /*sl*/, var_bool*) -> bool { return m_leps.at(0)->q * m_leps.at(1)->q < 0; };
+        *sf << [ctx](Superlink* /*sl*/, var_bool*) -> bool { return ctx->m_leps.at(0)->q * ctx->m_leps.at(1)->q < 0; };
         *sf << SaveVar();
     }
 
     *sf << NewVar("is e + mu"); {
         *sf << HFTname("isDF");
-        *sf << [](Superlink* /*sl*/, var_bool*) -> bool { return m_leps.at(0)->isEle() ^ m_leps.at(1)->isEle(); };
+        *sf << [ctx](Superlink* /*sl*/, var_bool*) -> bool { return ctx->m_leps.at(0)->isEle() ^ ctx->m_leps.at(1)->isEle(); };
         *sf << SaveVar();
     }
 
 
     *sf << NewVar("mass of di-lepton system"); {
         *sf << HFTname("mll");
-        *sf << [](Superlink* /*sl*/, var_float*) -> double {return (*m_leps.at(0) + *m_leps.at(1)).M();};
+        *sf << [ctx](Superlink* /*sl*/, var_float*) -> double { return get_dilepton(ctx).m; };
         *sf << SaveVar();
     }
 
     *sf << NewVar("Pt of di-lepton system"); {
         *sf << HFTname("pTll");
-        *sf << [](Superlink* /*sl*/, var_float*) -> double {return (*m_leps.at(0) + *m_leps.at(1)).Pt();};
+        *sf << [ctx](Superlink* /*sl*/, var_float*) -> double { return get_dilepton(ctx).pt; };
         *sf << SaveVar();
     }
 
     *sf << NewVar("Pt difference of di-lepton system"); {
         *sf << HFTname("dpTll");
-        *sf << [](Superlink* /*sl*/, var_float*) -> double { return m_leps.at(0)->Pt() - m_leps.at(1)->Pt(); };
+        *sf << [ctx](Superlink* /*sl*/, var_float*) -> double { return ctx->m_leps.at(0)->Pt() - ctx->m_leps.at(1)->Pt(); };
         *sf << SaveVar();
     }
 
     *sf << NewVar("delta Eta of di-lepton system"); {
         *sf << HFTname("dEta_ll");
-        *sf << [](Superlink* /*sl*/, var_float*) -> double { return fabs(m_leps.at(0)->Eta() - m_leps.at(1)->Eta()); };
+        *sf << [ctx](Superlink* /*sl*/, var_float*) -> double { const LeptonTable& t = ctx->m_lep_table; return fabs(t.kin.at(0).eta - t.kin.at(1).eta); };
         *sf << SaveVar();
     }
 
     *sf << NewVar("delta Phi of di-lepton system"); {
         *sf << HFTname("dPhi_ll");
-        *sf << [](Superlink* /*sl*/, var_float*) -> double { return fabs(m_leps.at(0)->DeltaPhi(*m_leps.at(1))); };
+        *sf << [ctx](Superlink* /*sl*/, var_float*) -> double { const LeptonTable& t = ctx->m_lep_table; return fabs(Stop2L::delta_phi(t.kin.at(0), t.kin.at(1))); };
         *sf << SaveVar();
     }
 
     *sf << NewVar("delta R of di-lepton system"); {
         *sf << HFTname("dR_ll");
-        *sf << [](Superlink* /*sl*/, var_float*) -> double { return m_leps.at(0)->DeltaR(*m_leps.at(1)); };
+        *sf << [ctx](Superlink* /*sl*/, var_float*) -> double { const LeptonTable& t = ctx->m_lep_table; return Stop2L::delta_r(t.kin.at(0), t.kin.at(1)); };
         *sf << SaveVar();
     }
 }
-void add_Zlepton_variables(Superflow* sf) {
+void add_Zlepton_variables(VarFlow* sf, EventContext* ctx) {
+    // Guards are only needed in multi-selection mode, where events from
+    // non-Z selections are also written
     *sf << NewVar("Z -> ee"); {
         *sf << HFTname("ZisElEl");
-        *sf << [](Superlink* /*sl*/, var_bool*) -> bool { return m_ZLeps.at(0)->isEle() && m_ZLeps.at(1)->isEle(); };
+        *sf << [ctx](Superlink* /*sl*/, var_bool*) -> bool { if (ctx->m_ZLeps.size() < 2) return false; return ctx->m_ZLeps.at(0)->isEle() && ctx->m_ZLeps.at(1)->isEle(); };
         *sf << SaveVar();
     }
 
     *sf << NewVar("Z -> mumu"); {
         *sf << HFTname("ZisMuMu");
-        *sf << [](Superlink* /*sl*/, var_bool*) -> bool { return m_ZLeps.at(0)->isMu() && m_ZLeps.at(1)->isMu(); };
+        *sf << [ctx](Superlink* /*sl*/, var_bool*) -> bool { if (ctx->m_ZLeps.size() < 2) return false; return ctx->m_ZLeps.at(0)->isMu() && ctx->m_ZLeps.at(1)->isMu(); };
         *sf << SaveVar();
     }
 
     *sf << NewVar("mass of Z-tagged leptons"); {
         *sf << HFTname("Zmass");
-        *sf << [](Superlink* /*sl*/, var_float*) -> double {return (*m_ZLeps.at(0) + *m_ZLeps.at(1)).M();};
+        *sf << [ctx](Superlink* /*sl*/, var_float*) -> double { if (ctx->m_ZLeps.size() < 2) return -DBL_MAX; return get_Z_system(ctx).m; };
         *sf << SaveVar();
     }
 
     *sf << NewVar("Pt of Z-tagged leptons"); {
         *sf << HFTname("ZpT");
-        *sf << [](Superlink* /*sl*/, var_float*) -> double {return (*m_ZLeps.at(0) + *m_ZLeps.at(1)).Pt();};
+        *sf << [ctx](Superlink* /*sl*/, var_float*) -> double { if (ctx->m_ZLeps.size() < 2) return -DBL_MAX; return get_Z_system(ctx).pt; };
         *sf << SaveVar();
     }
 
     *sf << NewVar("Eta of Z-tagged leptons"); {
         *sf << HFTname("ZEta");
-        *sf << [](Superlink* /*sl*/, var_float*) -> double {return (*m_ZLeps.at(0) + *m_ZLeps.at(1)).Eta();};
+        *sf << [ctx](Superlink* /*sl*/, var_float*) -> double { if (ctx->m_ZLeps.size() < 2) return -DBL_MAX; return get_Z_system(ctx).eta; };
         *sf << SaveVar();
     }
 
     *sf << NewVar("Phi of Z-tagged leptons"); {
         *sf << HFTname("ZPhi");
-        *sf << [](Superlink* /*sl*/, var_float*) -> double {return (*m_ZLeps.at(0) + *m_ZLeps.at(1)).Phi();};
+        *sf << [ctx](Superlink* /*sl*/, var_float*) -> double { if (ctx->m_ZLeps.size() < 2) return -DBL_MAX; return get_Z_system(ctx).phi; };
         *sf << SaveVar();
     }
 
     *sf << NewVar("Pt difference of Z-tagged leptons"); {
         *sf << HFTname("dpT_ZLeps");
-        *sf << [](Superlink* /*sl*/, var_float*) -> double { return m_ZLeps.at(0)->Pt() - m_ZLeps.at(1)->Pt(); };
+        *sf << [ctx](Superlink* /*sl*/, var_float*) -> double { if (ctx->m_ZLeps.size() < 2) return -DBL_MAX; return ctx->m_ZLeps.at(0)->Pt() - ctx->m_ZLeps.at(1)->Pt(); };
         *sf << SaveVar();
     }
 
     *sf << NewVar("delta Eta of Z-tagged leptons"); {
         *sf << HFTname("dEta_ZLeps");
-        *sf << [](Superlink* /*sl*/, var_float*) -> double { return fabs(m_ZLeps.at(0)->Eta() - m_ZLeps.at(1)->Eta()); };
+        *sf << [ctx](Superlink* /*sl*/, var_float*) -> double { if (ctx->m_ZLeps.size() < 2) return -DBL_MAX; return fabs(ctx->m_lep_table.kin_at(ctx->m_ZLeps_idx, 0).eta - ctx->m_lep_table.kin_at(ctx->m_ZLeps_idx, 1).eta); };
         *sf << SaveVar();
     }
 
     *sf << NewVar("delta Phi of Z-tagged leptons"); {
         *sf << HFTname("dPhi_ZLeps");
-        *sf << [](Superlink* /*sl*/, var_float*) -> double { return fabs(m_ZLeps.at(0)->DeltaPhi(*m_ZLeps.at(1))); };
+        *sf << [ctx](Superlink* /*sl*/, var_float*) -> double { if (ctx->m_ZLeps.size() < 2) return -DBL_MAX; return fabs(Stop2L::delta_phi(ctx->m_lep_table.kin_at(ctx->m_ZLeps_idx, 0), ctx->m_lep_table.kin_at(ctx->m_ZLeps_idx, 1))); };
         *sf << SaveVar();
     }
 
     *sf << NewVar("delta R of Z-tagged leptons"); {
         *sf << HFTname("dR_ZLeps");
-        *sf << [](Superlink* /*sl*/, var_float*) -> double { return m_ZLeps.at(0)->DeltaR(*m_ZLeps.at(1)); };
+        *sf << [ctx](Superlink* /*sl*/, var_float*) -> double { if (ctx->m_ZLeps.size() < 2) return -DBL_MAX; return Stop2L::delta_r(ctx->m_lep_table.kin_at(ctx->m_ZLeps_idx, 0), ctx->m_lep_table.kin_at(ctx->m_ZLeps_idx, 1)); };
         *sf << SaveVar();
     }
 }
 
-void add_multi_object_variables(Superflow* sf) {
+void add_multi_object_variables(VarFlow* sf, EventContext* ctx) {
     // Jets and MET
     *sf << NewVar("delta Phi of leading jet and met"); {
         *sf << HFTname("dPhi_met_jet1");
-        *sf << [](Superlink* sl, var_float*) -> double {
-            return sl->jets->size() >= 1 ? sl->jets->at(0)->DeltaPhi(m_MET) : -DBL_MAX;
+        *sf << [ctx](Superlink* /*sl*/, var_float*) -> double {
+            const JetTable& jets = ctx->m_jet_table;
+            return jets.size() >= 1 ? Stop2L::delta_phi(jets.kin[0], ctx->m_MET) : -DBL_MAX;
         };
         *sf << SaveVar();
     }
 
     *sf << NewVar("delta Phi of subleading jet and met"); {
         *sf << HFTname("dPhi_met_jet2");
-        *sf << [](Superlink* sl, var_float*) -> double {
-            return sl->jets->size() >= 2 ? sl->jets->at(1)->DeltaPhi(m_MET) : -DBL_MAX;
+        *sf << [ctx](Superlink* /*sl*/, var_float*) -> double {
+            const JetTable& jets = ctx->m_jet_table;
+            return jets.size() >= 2 ? Stop2L::delta_phi(jets.kin[1], ctx->m_MET) : -DBL_MAX;
         };
         *sf << SaveVar();
     }
     *sf << NewVar("stransverse mass"); {
         *sf << HFTname("MT2");
-        *sf << [](Superlink* sl, var_float*) -> double {
-            double mt2_ = kin::getMT2(m_sigLeps, *sl->met);
+        *sf << [ctx](Superlink* sl, var_float*) -> double {
+            if (m_ana_options.mt2_precision > 0 && ctx->m_sigLeps.size() >= 2) {
+                const Susy::Lepton* l0 = ctx->m_sigLeps.at(0);
+                const Susy::Lepton* l1 = ctx->m_sigLeps.at(1);
+                return m_mt2_solver.mt2(l0->Px(), l0->Py(), l1->Px(), l1->Py(),
+                                        ctx->m_MET.px(), ctx->m_MET.py());
+            }
+            double mt2_ = kin::getMT2(ctx->m_sigLeps, *sl->met);
             return mt2_;
         };
         *sf << SaveVar();
@@ -2193,15 +3841,15 @@ void add_multi_object_variables(Superflow* sf) {
     // Leptons, Jets, and MET
     *sf << NewVar("Etmiss Rel"); {
         *sf << HFTname("metrel");
-        *sf << [](Superlink* sl, var_float*) -> double { return kin::getMetRel(sl->met, m_sigLeps, *sl->jets); };
+        *sf << [ctx](Superlink* sl, var_float*) -> double { return kin::getMetRel(sl->met, ctx->m_sigLeps, *sl->jets); };
         *sf << SaveVar();
     }
 
     *sf << NewVar("Ht (m_Eff: lep + met + jet)"); {
         *sf << HFTname("ht");
-        *sf << [](Superlink* sl, var_float*) -> double {
+        *sf << [ctx](Superlink* sl, var_float*) -> double {
             double ht = sl->met->Et;
-            for (const Susy::Lepton* l : m_leps) { ht += l->Pt(); }
+            for (const Susy::Lepton* l : ctx->m_leps) { ht += l->Pt(); }
             for (const Susy::Jet* j : *sl->jets) { ht += j->Pt(); }
             return ht;
         };
@@ -2209,21 +3857,20 @@ void add_multi_object_variables(Superflow* sf) {
     }
     *sf << NewVar("reco-level max(HT,pTV) "); {
         *sf << HFTname("max_HT_pTV_reco");
-        *sf << [](Superlink* sl, var_float*) -> double {
-            if (m_leps.size() < 2) return -DBL_MAX;
+        *sf << [ctx](Superlink* sl, var_float*) -> double {
+            if (ctx->m_leps.size() < 2) return -DBL_MAX;
             double ht = 0.0;
             for (int i = 0; i < (int)sl->jets->size(); i++) {
                 if (sl->jets->at(i)->Pt() < 20) {continue;}
                 ht += sl->jets->at(i)->Pt();
             }
-            TLorentzVector VllP4 = *m_leps.at(0) + *m_leps.at(1);
-            return max(ht, VllP4.Pt());
+            return max(ht, get_dilepton(ctx).pt);
         };
         *sf << SaveVar();
     }
 }
 
-void add_jigsaw_variables(Superflow* sf) {
+void add_jigsaw_variables(VarFlow* sf, EventContext* ctx) {
     //ADD_JIGSAW_VAR(H_11_SS)
     //ADD_JIGSAW_VAR(H_21_SS)
     //ADD_JIGSAW_VAR(H_12_SS)
@@ -2260,17 +3907,16 @@ void add_jigsaw_variables(Superflow* sf) {
     //ADD_JIGSAW_VAR(dphi_S_I_ss)
     //ADD_JIGSAW_VAR(dphi_S_I_s1)
 }
-void add_miscellaneous_variables(Superflow* sf) {
+void add_miscellaneous_variables(VarFlow* sf, EventContext* ctx) {
 
     *sf << NewVar("|cos(theta_b)|"); {
         *sf << HFTname("abs_costheta_b");
-        *sf << [](Superlink* /*sl*/, var_float*) -> double {
-            TLorentzVector lp, lm, ll;
-            lp = m_leps.at(0)->q > 0 ? *m_leps.at(0) : *m_leps.at(1);
-            lm = m_leps.at(0)->q < 0 ? *m_leps.at(0) : *m_leps.at(1);
-            ll = lp + lm;
+        *sf << [ctx](Superlink* /*sl*/, var_float*) -> double {
+            TLorentzVector lp, lm;
+            lp = ctx->m_leps.at(0)->q > 0 ? *ctx->m_leps.at(0) : *ctx->m_leps.at(1);
+            lm = ctx->m_leps.at(0)->q < 0 ? *ctx->m_leps.at(0) : *ctx->m_leps.at(1);
 
-            TVector3 boost = ll.BoostVector();
+            const TVector3& boost = get_dilepton(ctx).boost;
             lp.Boost(-boost);
             lm.Boost(-boost);
 
@@ -2284,77 +3930,84 @@ void add_miscellaneous_variables(Superflow* sf) {
 }
 
 
-void add_Zll_probeLep_variables(Superflow* sf) {
+void add_Zll_probeLep_variables(VarFlow* sf, EventContext* ctx) {
     *sf << NewVar("Mlll: Invariant mass of 3lep system"); {
       *sf << HFTname("mlll");
-      *sf << [](Superlink* /*sl*/, var_double*) -> double {
-          return (*m_ZLeps.at(0) + *m_ZLeps.at(1) + *m_probeLeps.at(0)).M();
+      *sf << [ctx](Superlink* /*sl*/, var_double*) -> double {
+          if (ctx->m_ZLeps.size() < 2 || ctx->m_probeLeps.empty()) return -DBL_MAX;
+          return get_Z_probe_system(ctx).m;
       };
       *sf << SaveVar();
     }
     *sf << NewVar("DeltaR of probeLep1 and ZLep1"); {
       *sf << HFTname("dR_ZLep1_probeLep1");
-      *sf << [](Superlink* /*sl*/, var_double*) -> double {
-        return (*m_ZLeps.at(0)).DeltaR(*m_probeLeps.at(0));
+      *sf << [ctx](Superlink* /*sl*/, var_double*) -> double {
+        if (ctx->m_ZLeps.size() < 2 || ctx->m_probeLeps.empty()) return -DBL_MAX;
+        return Stop2L::delta_r(ctx->m_lep_table.kin_at(ctx->m_ZLeps_idx, 0), ctx->m_lep_table.kin_at(ctx->m_probeLeps_idx, 0));
       };
       *sf << SaveVar();
     }
     *sf << NewVar("DeltaR of probeLep1 and ZLep2"); {
       *sf << HFTname("dR_ZLep2_probeLep1");
-      *sf << [](Superlink* /*sl*/, var_double*) -> double {
-        return (*m_ZLeps.at(1)).DeltaR(*m_probeLeps.at(0));
+      *sf << [ctx](Superlink* /*sl*/, var_double*) -> double {
+        if (ctx->m_ZLeps.size() < 2 || ctx->m_probeLeps.empty()) return -DBL_MAX;
+        return Stop2L::delta_r(ctx->m_lep_table.kin_at(ctx->m_ZLeps_idx, 1), ctx->m_lep_table.kin_at(ctx->m_probeLeps_idx, 0));
       };
       *sf << SaveVar();
     }
     *sf << NewVar("DeltaR of probeLep1 and Z"); {
       *sf << HFTname("dR_Z_probeLep1");
-      *sf << [](Superlink* /*sl*/, var_double*) -> double {
-        TLorentzVector ZLepsP4 = *m_ZLeps.at(0) + *m_ZLeps.at(1);
-        return ZLepsP4.DeltaR(*m_probeLeps.at(0));
+      *sf << [ctx](Superlink* /*sl*/, var_double*) -> double {
+        if (ctx->m_ZLeps.size() < 2 || ctx->m_probeLeps.empty()) return -DBL_MAX;
+        return Stop2L::delta_r(get_Z_system(ctx), ctx->m_lep_table.kin_at(ctx->m_probeLeps_idx, 0));
       };
       *sf << SaveVar();
     }
     *sf << NewVar("DeltaPhi of probeLep1 and ZLep1"); {
       *sf << HFTname("dPhi_ZLep1_probeLep1");
-      *sf << [](Superlink* /*sl*/, var_double*) -> double {
-        return (*m_ZLeps.at(0)).DeltaPhi(*m_probeLeps.at(0));
+      *sf << [ctx](Superlink* /*sl*/, var_double*) -> double {
+        if (ctx->m_ZLeps.size() < 2 || ctx->m_probeLeps.empty()) return -DBL_MAX;
+        return Stop2L::delta_phi(ctx->m_lep_table.kin_at(ctx->m_ZLeps_idx, 0), ctx->m_lep_table.kin_at(ctx->m_probeLeps_idx, 0));
       };
       *sf << SaveVar();
     }
     *sf << NewVar("DeltaPhi of probeLep1 and ZLep2"); {
       *sf << HFTname("dPhi_ZLep2_probeLep1");
-      *sf << [](Superlink* /*sl*/, var_double*) -> double {
-        return (*m_ZLeps.at(1)).DeltaPhi(*m_probeLeps.at(0));
+      *sf << [ctx](Superlink* /*sl*/, var_double*) -> double {
+        if (ctx->m_ZLeps.size() < 2 || ctx->m_probeLeps.empty()) return -DBL_MAX;
+        return Stop2L::delta_phi(ctx->m_lep_table.kin_at(ctx->m_ZLeps_idx, 1), ctx->m_lep_table.kin_at(ctx->m_probeLeps_idx, 0));
       };
       *sf << SaveVar();
     }
     *sf << NewVar("DeltaPhi of probeLep1 and Z"); {
       *sf << HFTname("dPhi_Z_probeLep1");
-      *sf << [](Superlink* /*sl*/, var_double*) -> double {
-        TLorentzVector ZLepsP4 = *m_ZLeps.at(0) + *m_ZLeps.at(1);
-        return ZLepsP4.DeltaPhi(*m_probeLeps.at(0));
+      *sf << [ctx](Superlink* /*sl*/, var_double*) -> double {
+        if (ctx->m_ZLeps.size() < 2 || ctx->m_probeLeps.empty()) return -DBL_MAX;
+        return Stop2L::delta_phi(get_Z_system(ctx), ctx->m_lep_table.kin_at(ctx->m_probeLeps_idx, 0));
       };
       *sf << SaveVar();
     }
     *sf << NewVar("DeltaEta of probeLep1 and ZLep1"); {
       *sf << HFTname("dEta_ZLep1_probeLep1");
-      *sf << [](Superlink* /*sl*/, var_double*) -> double {
-        return fabs(m_probeLeps.at(0)->Eta() - m_ZLeps.at(0)->Eta());
+      *sf << [ctx](Superlink* /*sl*/, var_double*) -> double {
+        if (ctx->m_ZLeps.size() < 2 || ctx->m_probeLeps.empty()) return -DBL_MAX;
+        return fabs(ctx->m_lep_table.kin_at(ctx->m_probeLeps_idx, 0).eta - ctx->m_lep_table.kin_at(ctx->m_ZLeps_idx, 0).eta);
       };
       *sf << SaveVar();
     }
     *sf << NewVar("DeltaEta of probeLep1 and ZLep2"); {
       *sf << HFTname("dEta_ZLep2_probeLep1");
-      *sf << [](Superlink* /*sl*/, var_double*) -> double {
-        return fabs(m_probeLeps.at(0)->Eta() - m_ZLeps.at(1)->Eta());
+      *sf << [ctx](Superlink* /*sl*/, var_double*) -> double {
+        if (ctx->m_ZLeps.size() < 2 || ctx->m_probeLeps.empty()) return -DBL_MAX;
+        return fabs(ctx->m_lep_table.kin_at(ctx->m_probeLeps_idx, 0).eta - ctx->m_lep_table.kin_at(ctx->m_ZLeps_idx, 1).eta);
       };
       *sf << SaveVar();
     }
     *sf << NewVar("DeltaEta of probeLep1 and Z"); {
       *sf << HFTname("dEta_Z_probeLep1");
-      *sf << [](Superlink* /*sl*/, var_double*) -> double {
-        TLorentzVector ZLepsP4 = *m_ZLeps.at(0) + *m_ZLeps.at(1);
-        return fabs(m_probeLeps.at(0)->Eta() - ZLepsP4.Eta()) ;
+      *sf << [ctx](Superlink* /*sl*/, var_double*) -> double {
+        if (ctx->m_ZLeps.size() < 2 || ctx->m_probeLeps.empty()) return -DBL_MAX;
+        return fabs(ctx->m_lep_table.kin_at(ctx->m_probeLeps_idx, 0).eta - get_Z_system(ctx).eta);
       };
       *sf << SaveVar();
     }
@@ -2400,48 +4053,418 @@ void add_shape_systematics(Superflow* sf) {
     }
 }
 
-bool is_1lep_trig_matched(Superlink* sl, string trig_name, Susy::Lepton* lep, float pt_min) {
+bool compile_trigger_menu() {
+    // Resolve the trigger tables, which are kept keyed by name for
+    // readability, into enum indexed arrays
+    bool ok = true;
+    auto compile = [&ok](const vector<string>& trig_names, vector<Trig>& trigs, TrigBits& mask) {
+        for (const string& trig_name : trig_names) {
+            Trig trig = to_trig(trig_name);
+            if (trig == Trig::none) {
+                cout << "ERROR :: Trigger missing from the Trig enum: " << trig_name << '\n';
+                ok = false;
+                continue;
+            }
+            trigs.push_back(trig);
+            mask.set(to_idx(trig));
+        }
+    };
+    for (uint iyear = 0; iyear < m_trig_menus.size(); ++iyear) {
+        uint year = FIRST_TRIG_YEAR + iyear;
+        TrigMenu& menu = m_trig_menus.at(iyear);
+        compile(m_single_ele_trigs.at(year), menu.single_ele, menu.single_lep_mask);
+        compile(m_single_mu_trigs.at(year), menu.single_mu, menu.single_lep_mask);
+        compile(m_dielectron_trigs.at(year), menu.dielectron, menu.dilep_mask);
+        compile(m_dimuon_trigs.at(year), menu.dimuon, menu.dilep_mask);
+        compile(m_diff_flav_trigs.at(year), menu.diff_flav, menu.dilep_mask);
+    }
+    for (const auto& it : m_single_lep_pT_thresholds) {
+        m_trig_pT_thresholds[to_idx(to_trig(it.first))] = std::make_pair(it.second, 0.0f);
+    }
+    for (const auto& it : m_dilepton_pT_thresholds) {
+        m_trig_pT_thresholds[to_idx(to_trig(it.first))] = it.second;
+    }
+    return ok;
+}
+
+const TrigMenu& trig_menu(int year) {
+    return m_trig_menus.at(year - FIRST_TRIG_YEAR);
+}
+
+void resolve_trigger_bits(TriggerTools& trig_tool, EventContext* ctx) {
+    // Look up each trigger's position in the event trigger bits once instead
+    // of by name every time a trigger decision is needed
+    ctx->m_trig_bit_idx.fill(-1);
+    const map<string, int> trig_map = trig_tool.triggerMap();
+    for (size_t itrig = 1; itrig < to_idx(Trig::singleLepTrigs); ++itrig) {
+        auto it = trig_map.find(m_trig_names[itrig]);
+        if (it == trig_map.end()) {
+            // passTrigger would also treat these as never fired
+            cout << "WARNING :: Trigger not found in trigger tool menu: " << m_trig_names[itrig] << '\n';
+            continue;
+        }
+        ctx->m_trig_bit_idx[itrig] = it->second;
+    }
+}
+
+bool is_trig_fired(Superlink* /*sl*/, EventContext* ctx, Trig trig) {
+    return ctx->m_sys_cache.m_trig_fired.test(to_idx(trig));
+}
+
+int get_trig_match_index(Superlink* sl, EventContext* ctx, const TrigMenu& menu, Susy::Lepton* lep) {
+    // Index of the lepton in the trigger match cache, filling in its single
+    // lepton matches and its dilepton matches with every lepton already in
+    // the cache. Returns -1 once the cache is full.
+    SysInvariantCache& cache = ctx->m_sys_cache;
+    const uint n_cached = cache.m_trig_leps.size();
+    for (uint icache = 0; icache < n_cached; ++icache) {
+        if (cache.m_trig_leps.at(icache) == lep) return icache;
+    }
+    if (n_cached == SysInvariantCache::MAX_TRIG_LEPS) return -1;
+    TriggerTools& trig_tool = sl->tools->triggerTool();
+    const TrigBits& fired = cache.m_trig_fired;
+
+    TrigBits& single_match = cache.m_lep_trig_match.at(n_cached);
+    single_match.reset();
+    for (Trig trig : lep->isEle() ? menu.single_ele : menu.single_mu) {
+        if (!fired.test(to_idx(trig))) continue;
+        if (trig_tool.lepton_trigger_match(lep, m_trig_names[to_idx(trig)])) {
+            single_match.set(to_idx(trig));
+        }
+    }
+    for (uint icache = 0; icache < n_cached; ++icache) {
+        const Susy::Lepton* other = cache.m_trig_leps.at(icache);
+        // electron must be first argument for different flavor triggers
+        const Susy::Lepton* lep0 = lep->isMu() && other->isEle() ? other : lep;
+        const Susy::Lepton* lep1 = lep0 == lep ? other : lep;
+        const vector<Trig>* dilepton_trigs = nullptr;
+        if (lep0->isEle() == lep1->isEle()) {
+            dilepton_trigs = lep0->isEle() ? &menu.dielectron : &menu.dimuon;
+        } else {
+            dilepton_trigs = &menu.diff_flav;
+        }
+        TrigBits pair_match;
+        for (Trig trig : *dilepton_trigs) {
+            if (!fired.test(to_idx(trig))) continue;
+            if (trig_tool.dilepton_trigger_match(sl->nt->evt(), lep0, lep1, m_trig_names[to_idx(trig)])) {
+                pair_match.set(to_idx(trig));
+            }
+        }
+        cache.m_dilep_trig_match.at(n_cached * SysInvariantCache::MAX_TRIG_LEPS + icache) = pair_match;
+        cache.m_dilep_trig_match.at(icache * SysInvariantCache::MAX_TRIG_LEPS + n_cached) = pair_match;
+    }
+    cache.m_trig_leps.push_back(lep);
+    return n_cached;
+}
+
+bool is_1lep_trig_matched(Superlink* sl, EventContext* ctx, Trig trig, Susy::Lepton* lep, float pt_min) {
     if(!lep) return false;
     if (lep->Pt() < pt_min) return false;
-    bool trig_fired = sl->tools->triggerTool().passTrigger(sl->nt->evt()->trigBits, trig_name);
-    if (!trig_fired) return false;
-    bool trig_matched = sl->tools->triggerTool().lepton_trigger_match(lep, trig_name);
-    if (trig_matched) return true;
-    return false;
+    if (!is_trig_fired(sl, ctx, trig)) return false;
+    return sl->tools->triggerTool().lepton_trigger_match(lep, m_trig_names[to_idx(trig)]);
 }
 
-bool is_2lep_trig_matched(Superlink* sl, string trig_name, Susy::Lepton* lep1, Susy::Lepton* lep2, float pt_min1, float pt_min2) {
+bool is_2lep_trig_matched(Superlink* sl, EventContext* ctx, Trig trig, Susy::Lepton* lep1, Susy::Lepton* lep2, float pt_min1, float pt_min2) {
     if(!lep1 || ! lep2) return false;
     if (lep1->Pt() < pt_min1 || lep2->Pt() < pt_min2) return false;
-    bool trig_fired = sl->tools->triggerTool().passTrigger(sl->nt->evt()->trigBits, trig_name);
-    if (!trig_fired) return false;
-    bool trig_matched = false;
-    if (lep1->isMu() && lep2->isEle()) {
-        // electron must be first argument for different flavor triggers
-        trig_matched = sl->tools->triggerTool().dilepton_trigger_match(sl->nt->evt(), lep2, lep1, trig_name);
+    if (!is_trig_fired(sl, ctx, trig)) return false;
+    // electron must be first argument for different flavor triggers
+    if (lep1->isMu() && lep2->isEle()) { std::swap(lep1, lep2); }
+    return sl->tools->triggerTool().dilepton_trigger_match(sl->nt->evt(), lep1, lep2, m_trig_names[to_idx(trig)]);
+}
+
+bool SysInvariantCache::update(const Susy::Event* evt, const std::array<int, N_TRIG>& trig_bit_idx) {
+    if (evt->run == m_run && evt->eventNumber == m_event_number) return false;
+    m_run = evt->run;
+    m_event_number = evt->eventNumber;
+    m_iff_classes.clear();
+    m_trig_fired.reset();
+    for (size_t itrig = 0; itrig < N_TRIG; ++itrig) {
+        if (trig_bit_idx[itrig] < 0) continue;
+        if (evt->trigBits.TestBitNumber(trig_bit_idx[itrig])) m_trig_fired.set(itrig);
+    }
+    m_trig_leps.clear();
+    m_jet_flags.clear();
+    return true;
+}
+
+void LeptonTable::clear() {
+    lep.clear();
+    isEle.clear();
+    q.clear();
+    kin.clear();
+    for (vector<double>* col : {&pt, &eta, &phi, &e, &m, &clusEtaBE,
+                                &d0sigBSCorr, &z0SinTheta, &mT, &dPhiMET}) {
+        col->clear();
+    }
+}
+void LeptonTable::fill(const LeptonVector& leps, const PtEtaPhiM& met) {
+    clear();
+    for (Susy::Lepton* l : leps) {
+        // Converted once, the columns below are copies for the output
+        kin.push_back(to_kin(l->Px(), l->Py(), l->Pz(), l->E()));
+        const PtEtaPhiM& k = kin.back();
+        lep.push_back(l);
+        isEle.push_back(l->isEle());
+        q.push_back(l->q);
+        pt.push_back(k.pt);
+        eta.push_back(k.eta);
+        phi.push_back(k.phi);
+        e.push_back(l->E());
+        m.push_back(k.m);
+        clusEtaBE.push_back(l->isEle() ? static_cast<const Susy::Electron*>(l)->clusEtaBE : k.eta);
+        d0sigBSCorr.push_back(l->d0sigBSCorr);
+        z0SinTheta.push_back(l->z0SinTheta());
+        mT.push_back(Stop2L::transverse_mass(k, met));
+        dPhiMET.push_back(fabs(Stop2L::delta_phi(k, met)));
+    }
+}
+void LeptonTable::index(const LeptonVector& leps, vector<int>& idx) const {
+    idx.clear();
+    for (const Susy::Lepton* l : leps) {
+        auto it = std::find(lep.begin(), lep.end(), l);
+        if (it == lep.end()) {
+            cout << "ERROR :: Lepton missing from the lepton table\n";
+            exit(1);
+        }
+        idx.push_back(it - lep.begin());
+    }
+}
+const JigsawVars& get_jigsaw_vars(Superlink* sl, EventContext* ctx) {
+    require_stages(sl, ctx, STAGE_JIGSAW);
+    return ctx->m_jigsaw_vars;
+}
+void compute_jigsaw_vars(EventContext* ctx) {
+    JigsawVars& vars = ctx->m_jigsaw_vars;
+    vars = {-DBL_MAX, -DBL_MAX, -DBL_MAX, -DBL_MAX, -DBL_MAX, -DBL_MAX};
+    if (ctx->m_leps.size() >= 2) {
+        // build the object map for the calculator
+        // the TTMET2LW calculator expects "leptons" and "met"
+        std::map<std::string, std::vector<TLorentzVector>>& object_map = ctx->m_jigsaw_objects;
+        object_map.at("leptons").at(0) = *ctx->m_leps.at(0);
+        object_map.at("leptons").at(1) = *ctx->m_leps.at(1);
+        object_map.at("met").at(0).SetPxPyPzE(ctx->m_MET.px(), ctx->m_MET.py(), 0., ctx->m_MET.pt);
+        ctx->m_calculator.load_event(object_map);
+        const std::map<std::string, float> calc_vars = ctx->m_calculator.variables();
+        auto read_var = [&calc_vars](const char* name, double& var) {
+            auto it = calc_vars.find(name);
+            if (it != calc_vars.end()) var = it->second;
+        };
+        read_var("shat", vars.shat);
+        read_var("pTT_T", vars.pTT_T);
+        read_var("RPT", vars.RPT);
+        read_var("gamInvRp1", vars.gamInvRp1);
+        read_var("MDR", vars.MDR);
+        read_var("DPB_vSS", vars.DPB_vSS);
+    }
+}
+void JetTable::clear() {
+    flags.clear();
+    isB.clear();
+    kin.clear();
+    eta.clear();
+    phi.clear();
+    n_bjets = n_forward = n_light = 0;
+}
+void JetTable::add(const Susy::Jet* jet, bool is_bjet, bool is_forward) {
+    bool is_light = !is_bjet && !is_forward;
+    flags.push_back((is_bjet ? BJET : 0) | (is_forward ? FORWARD : 0) | (is_light ? LIGHT : 0));
+    isB.push_back(is_bjet);
+    kin.push_back(to_kin(jet->Px(), jet->Py(), jet->Pz(), jet->E()));
+    eta.push_back(kin.back().eta);
+    phi.push_back(kin.back().phi);
+    n_bjets += is_bjet;
+    n_forward += is_forward;
+    n_light += is_light;
+}
+const NearestDistances& get_nearest_distances(Superlink* /*sl*/, EventContext* ctx) {
+    // Computed for all of m_leps the first time a distance is requested
+    if (ctx->m_nearest_valid) return ctx->m_nearest;
+    const LeptonTable& lep_table = ctx->m_lep_table;
+    const JetTable& jet_table = ctx->m_jet_table;
+    Stop2L::nearest_distances(lep_table.eta.data(), lep_table.phi.data(), lep_table.size(),
+                              jet_table.eta.data(), jet_table.phi.data(),
+                              jet_table.isB.data(), jet_table.size(),
+                              ctx->m_nearest);
+    ctx->m_nearest_valid = true;
+    return ctx->m_nearest;
+}
+void LepSystem::set(const TLorentzVector& sum) {
+    p4 = sum;
+    static_cast<PtEtaPhiM&>(*this) = to_kin(sum.Px(), sum.Py(), sum.Pz(), sum.E());
+    boost = p4.BoostVector();
+    valid = true;
+}
+// The getters below expect the leptons they sum to exist
+const LepSystem& get_dilepton(EventContext* ctx) {
+    if (!ctx->m_dilep.valid) ctx->m_dilep.set(*ctx->m_leps.at(0) + *ctx->m_leps.at(1));
+    return ctx->m_dilep;
+}
+const LepSystem& get_Z_system(EventContext* ctx) {
+    if (ctx->m_Zsys.valid) return ctx->m_Zsys;
+    const Susy::Lepton* lep0 = ctx->m_ZLeps.at(0);
+    const Susy::Lepton* lep1 = ctx->m_ZLeps.at(1);
+    // Reuse the sum from the Z search if these are the tagged leptons
+    bool ztagged = (ctx->m_stages_done & STAGE_ZTAG) && ctx->m_ztagged_idx1 >= 0;
+    if (ztagged && lep0 == ctx->m_sigLeps.at(ctx->m_ztagged_idx1)
+                && lep1 == ctx->m_sigLeps.at(ctx->m_ztagged_idx2)) {
+        ctx->m_Zsys.set(ctx->m_ztagged_p4);
     } else {
-        trig_matched = sl->tools->triggerTool().dilepton_trigger_match(sl->nt->evt(), lep1, lep2, trig_name);
+        ctx->m_Zsys.set(*lep0 + *lep1);
+    }
+    return ctx->m_Zsys;
+}
+const LepSystem& get_Z_probe_system(EventContext* ctx) {
+    if (!ctx->m_Zprobe.valid) ctx->m_Zprobe.set(get_Z_system(ctx).p4 + *ctx->m_probeLeps.at(0));
+    return ctx->m_Zprobe;
+}
+template<typename T>
+vector<T> gather(const vector<T>& col, const vector<int>& idx) {
+    vector<T> out;
+    out.reserve(idx.size());
+    for (int i : idx) { out.push_back(col[i]); }
+    return out;
+}
+const SysInvariantCache::JetFlags& get_jet_flags(Superlink* sl, EventContext* ctx, Susy::Jet* jet) {
+    // b-tagging and forward flags depend on the jet pT and eta so cached
+    // flags are only reused if the jet kinematics are unchanged
+    for (SysInvariantCache::JetFlags& flags : ctx->m_sys_cache.m_jet_flags) {
+        if (flags.jet != jet) continue;
+        if (flags.pt != jet->pt || flags.eta != jet->eta) {
+            flags.pt = jet->pt;
+            flags.eta = jet->eta;
+            flags.isB = sl->tools->jetSelector().isBJet(jet);
+            flags.isForward = sl->tools->jetSelector().isForward(jet);
+        }
+        return flags;
     }
-    return trig_matched;
+    ctx->m_sys_cache.m_jet_flags.push_back({jet,
+                                            jet->pt,
+                                            jet->eta,
+                                            sl->tools->jetSelector().isBJet(jet),
+                                            sl->tools->jetSelector().isForward(jet)});
+    return ctx->m_sys_cache.m_jet_flags.back();
 }
 
+IFF::Type get_IFF_class(Susy::Lepton* lep, EventContext* ctx) {
+    // Truth classification does not change between systematic passes
+    for (const auto& it : ctx->m_sys_cache.m_iff_classes) {
+        if (it.first == lep) return it.second;
+    }
+    IFF::Type result = IFF::Type::Unknown;
+    uint64_t key = 0;
+    bool use_lut = m_ana_options.iff_lut && make_IFF_key(lep, key);
+    if (use_lut && ctx->m_iff_lut.find(key, result)) {
+        int validate_every = m_ana_options.validate_iff_every;
+        if (validate_every > 0 && ctx->m_n_events % validate_every == 0) {
+            IFF::Type tool_result = classify_IFF(lep, ctx);
+            ctx->m_iff_n_validated++;
+            if (tool_result != result) {
+                ctx->m_iff_n_mismatched++;
+                cout << "WARNING :: IFF lookup table gives " << to_int(result)
+                     << " but the classifier gives " << to_int(tool_result)
+                     << " (key " << key << ")\n";
+            }
+        }
+    } else {
+        result = classify_IFF(lep, ctx);
+        if (use_lut) ctx->m_iff_lut.insert(key, result);
+    }
+    ctx->m_sys_cache.m_iff_classes.emplace_back(lep, result);
+    return result;
+}
 
-IFF::Type get_IFF_class(Susy::Lepton* lep) {
+IFF::Type classify_IFF(const Susy::Lepton* lep, EventContext* ctx) {
     IFF::Type result = IFF::Type::Unknown;
     if (lep->isEle()) {
-        Susy::Electron* ele = static_cast<Susy::Electron*>(lep);
-        const xAOD::Electron* aod_ele = to_iff_aod_electron(*ele);
-        result = m_truthClassifier.classify(*aod_ele);
-        delete aod_ele;
+        const Susy::Electron* ele = static_cast<const Susy::Electron*>(lep);
+        result = ctx->m_truthClassifier.classify(to_iff_aod_electron(*ele, ctx->m_iff_electron));
     } else if (lep->isMu()) {
-        Susy::Muon* mu = static_cast<Susy::Muon*>(lep);
-        const xAOD::Muon* aod_mu = to_iff_aod_muon(*mu);
-        result =  m_truthClassifier.classify(*aod_mu);
-        delete aod_mu;
+        const Susy::Muon* mu = static_cast<const Susy::Muon*>(lep);
+        result =  ctx->m_truthClassifier.classify(to_iff_aod_muon(*mu, ctx->m_iff_muon));
     }
     return result;
 }
 
+bool make_IFF_key(const Susy::Lepton* lep, uint64_t& key) {
+    // Same inputs as to_iff_aod_electron/muon
+    if (lep->isEle()) {
+        const Susy::Electron* ele = static_cast<const Susy::Electron*>(lep);
+        return IFFTruthLUT::make_key(true, ele->q, ele->mcType, ele->mcOrigin,
+                                     ele->mcFirstEgMotherTruthType,
+                                     ele->mcFirstEgMotherTruthOrigin,
+                                     ele->mcFirstEgMotherPdgId, key);
+    } else if (lep->isMu()) {
+        const Susy::Muon* mu = static_cast<const Susy::Muon*>(lep);
+        return IFFTruthLUT::make_key(false, mu->q, mu->mcType, mu->mcOrigin,
+                                     mu->mcFirstEgMotherTruthType,
+                                     mu->mcFirstEgMotherTruthOrigin,
+                                     mu->mcFirstEgMotherPdgId, key);
+    }
+    return false;
+}
+
+void print_IFF_summary(const RunSummary& summary) {
+    if (summary.iff_n_hits + summary.iff_n_misses == 0) return;
+    cout << m_ana_name << "    IFF lookup table: " << summary.iff_lut_size << " entries, "
+         << summary.iff_n_hits << " hits, " << summary.iff_n_misses << " misses\n";
+    if (summary.iff_n_validated > 0) {
+        cout << m_ana_name << "    IFF lookup table validation: "
+             << summary.iff_n_mismatched << " mismatches in "
+             << summary.iff_n_validated << " checked leptons\n";
+    }
+}
+
+PtEtaPhiM to_kin(double px, double py, double pz, double e) {
+    if (m_ana_options.fast_math) return Stop2L::make_px_py_pz_e_fast(px, py, pz, e);
+    return Stop2L::make_px_py_pz_e(px, py, pz, e);
+}
+void validate_fast_math(Superlink* sl, EventContext* ctx) {
+    // Redo the conversions of read_objects exactly and compare
+    using Report = Stop2L::FastMathReport;
+    Report& report = ctx->m_fast_math_report;
+    const PtEtaPhiM& met = ctx->m_MET;
+    PtEtaPhiM exact_met = Stop2L::make_px_py_pz_e(sl->met->Et * cos(sl->met->phi),
+                                                  sl->met->Et * sin(sl->met->phi),
+                                                  0.,
+                                                  sl->met->Et);
+    report.fill(Report::PHI, met.phi, exact_met.phi);
+    const LeptonTable& lep_table = ctx->m_lep_table;
+    vector<PtEtaPhiM> exact_leps;
+    for (const Susy::Lepton* l : lep_table.lep) {
+        exact_leps.push_back(Stop2L::make_px_py_pz_e(l->Px(), l->Py(), l->Pz(), l->E()));
+    }
+    for (size_t i = 0; i < exact_leps.size(); ++i) {
+        const PtEtaPhiM& fast = lep_table.kin[i];
+        const PtEtaPhiM& exact = exact_leps[i];
+        report.fill(Report::PHI, fast.phi, exact.phi);
+        report.fill(Report::ETA, fast.eta, exact.eta);
+        report.fill(Report::MT, Stop2L::transverse_mass(fast, met),
+                    Stop2L::transverse_mass(exact, exact_met));
+        report.fill(Report::DPHI, Stop2L::delta_phi(fast, met), Stop2L::delta_phi(exact, exact_met));
+        for (size_t j = i + 1; j < exact_leps.size(); ++j) {
+            report.fill(Report::DR, Stop2L::delta_r(fast, lep_table.kin[j]),
+                        Stop2L::delta_r(exact, exact_leps[j]));
+        }
+    }
+    const JetTable& jet_table = ctx->m_jet_table;
+    for (size_t i = 0; i < jet_table.kin.size(); ++i) {
+        const Susy::Jet* jet = sl->jets->at(i);
+        PtEtaPhiM exact = Stop2L::make_px_py_pz_e(jet->Px(), jet->Py(), jet->Pz(), jet->E());
+        const PtEtaPhiM& fast = jet_table.kin[i];
+        report.fill(Report::PHI, fast.phi, exact.phi);
+        report.fill(Report::ETA, fast.eta, exact.eta);
+        report.fill(Report::DPHI, Stop2L::delta_phi(fast, met), Stop2L::delta_phi(exact, exact_met));
+    }
+}
+void print_fast_math_summary(const RunSummary& summary) {
+    const Stop2L::FastMathReport& report = summary.fast_math_report;
+    if (report.n_entries() == 0) return;
+    cout << m_ana_name << "    Fast math validation, |fast - exact| of "
+         << report.n_entries() << " values:\n";
+    report.print(m_ana_name + "    ");
+}
+
 int to_int(IFF::Type t) {
     switch(t) { // Needs to be in sync with IFFTruthClassifier/IFFTruthClassifierDefs.h
         case IFF::Type::Unknown:                  return 0;
@@ -2462,26 +4485,29 @@ int to_int(IFF::Type t) {
     return 0;
 }
 
-const xAOD::Electron* to_iff_aod_electron(Susy::Electron& ele) {
-    xAOD::Electron* e = new xAOD::Electron();
-    e->makePrivateStore();
-    e->auxdata<int>("truthType") = ele.mcType;
-    e->auxdata<int>("truthOrigin") = ele.mcOrigin;
-    e->auxdata<int>("firstEgMotherTruthType") = ele.mcFirstEgMotherTruthType;
-    e->auxdata<int>("firstEgMotherTruthOrigin") = ele.mcFirstEgMotherTruthOrigin;
-    e->auxdata<int>("firstEgMotherPdgId") = ele.mcFirstEgMotherPdgId;
-    e->setCharge(ele.q);
+// Decorations read by IFFTruthClassifier. Accessors resolve the aux IDs once.
+static const SG::AuxElement::Accessor<int> acc_truthType("truthType");
+static const SG::AuxElement::Accessor<int> acc_truthOrigin("truthOrigin");
+static const SG::AuxElement::Accessor<int> acc_firstEgMotherTruthType("firstEgMotherTruthType");
+static const SG::AuxElement::Accessor<int> acc_firstEgMotherTruthOrigin("firstEgMotherTruthOrigin");
+static const SG::AuxElement::Accessor<int> acc_firstEgMotherPdgId("firstEgMotherPdgId");
+
+const xAOD::Electron& to_iff_aod_electron(const Susy::Electron& ele, xAOD::Electron& e) {
+    acc_truthType(e) = ele.mcType;
+    acc_truthOrigin(e) = ele.mcOrigin;
+    acc_firstEgMotherTruthType(e) = ele.mcFirstEgMotherTruthType;
+    acc_firstEgMotherTruthOrigin(e) = ele.mcFirstEgMotherTruthOrigin;
+    acc_firstEgMotherPdgId(e) = ele.mcFirstEgMotherPdgId;
+    e.setCharge(ele.q);
     return e;
 }
-const xAOD::Muon* to_iff_aod_muon(Susy::Muon& muo) {
-    xAOD::Muon* m = new xAOD::Muon();
-    m->makePrivateStore();
-    m->auxdata<int>("truthType") = muo.mcType;
-    m->auxdata<int>("truthOrigin") = muo.mcOrigin;
-    m->auxdata<int>("firstEgMotherTruthType") = muo.mcFirstEgMotherTruthType;
-    m->auxdata<int>("firstEgMotherTruthOrigin") = muo.mcFirstEgMotherTruthOrigin;
-    m->auxdata<int>("firstEgMotherPdgId") = muo.mcFirstEgMotherPdgId;
-    m->setCharge(muo.q);
+const xAOD::Muon& to_iff_aod_muon(const Susy::Muon& muo, xAOD::Muon& m) {
+    acc_truthType(m) = muo.mcType;
+    acc_truthOrigin(m) = muo.mcOrigin;
+    acc_firstEgMotherTruthType(m) = muo.mcFirstEgMotherTruthType;
+    acc_firstEgMotherTruthOrigin(m) = muo.mcFirstEgMotherTruthOrigin;
+    acc_firstEgMotherPdgId(m) = muo.mcFirstEgMotherPdgId;
+    m.setCharge(muo.q);
     return m;
 }
 
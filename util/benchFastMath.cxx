@@ -0,0 +1,127 @@
+////////////////////////////////////////////////////////////////////////////////
+/// Copyright (c) <2018> by Alex Armstrong
+///
+/// @file benchFastMath.cxx
+/// @author Alex Armstrong (alarmstr@cern.ch)
+/// @date <December 2018>
+/// @brief Check the error bound of the fast math kernels and time them
+///
+/// Scans Stop2L::fast_atan2 over the full circle against a long double
+/// reference and fails if the documented maximum error is exceeded. Then
+/// converts random objects with the exact and the fast Stop2L::PtEtaPhiM
+/// conversion, prints the comparison report of the derived variables and
+/// times both conversions.
+///
+/// Usage: benchFastMath [n_objects] [seed]
+///
+////////////////////////////////////////////////////////////////////////////////
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+using std::cout;
+#include <random>
+#include <vector>
+using std::vector;
+
+// LexStop2LAnalysis
+#include "LexStop2LAnalysis/FastMath.h"
+#include "LexStop2LAnalysis/PtEtaPhiM.h"
+
+using Stop2L::FastMathReport;
+using Stop2L::PtEtaPhiM;
+
+struct Cartesian {
+    double px, py, pz, e;
+};
+
+double max_atan2_error() {
+    // Angles over the full circle at several magnitudes
+    const int N_ANGLES = 4000000;
+    double max_err = 0;
+    for (double r : {1e-3, 1.0, 1e3}) {
+        for (int i = 0; i <= N_ANGLES; ++i) {
+            long double angle = -M_PIl + 2 * M_PIl * i / N_ANGLES;
+            double x = r * std::cos(static_cast<double>(angle));
+            double y = r * std::sin(static_cast<double>(angle));
+            long double exact = std::atan2(static_cast<long double>(y), static_cast<long double>(x));
+            max_err = std::max(max_err, static_cast<double>(std::fabs(Stop2L::fast_atan2(y, x) - exact)));
+        }
+    }
+    return max_err;
+}
+vector<Cartesian> make_objects(uint n_objects, uint seed) {
+    std::mt19937 rng(seed);
+    std::exponential_distribution<double> pt_dist(1 / 50.0);
+    std::uniform_real_distribution<double> eta_dist(-2.8, 2.8);
+    std::uniform_real_distribution<double> phi_dist(-M_PI, M_PI);
+    vector<Cartesian> objects(n_objects);
+    for (Cartesian& obj : objects) {
+        double pt = 10 + pt_dist(rng);
+        double eta = eta_dist(rng);
+        double phi = phi_dist(rng);
+        obj.px = pt * std::cos(phi);
+        obj.py = pt * std::sin(phi);
+        obj.pz = pt * std::sinh(eta);
+        obj.e = std::sqrt(obj.px * obj.px + obj.py * obj.py + obj.pz * obj.pz);
+    }
+    return objects;
+}
+template<typename F>
+double time_ms(const vector<Cartesian>& objects, vector<PtEtaPhiM>& out, F convert) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < objects.size(); ++i) {
+        const Cartesian& obj = objects[i];
+        out[i] = convert(obj.px, obj.py, obj.pz, obj.e);
+    }
+    auto stop = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(stop - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+    uint n_objects = argc > 1 ? std::atoi(argv[1]) : 1000000;
+    uint seed = argc > 2 ? std::atoi(argv[2]) : 42;
+    if (n_objects < 2) {
+        cout << "ERROR :: At least two objects are needed\n";
+        return 1;
+    }
+
+    // Error bound
+    double atan2_err = max_atan2_error();
+    cout << "fast_atan2 : max error " << atan2_err << " (bound " << Stop2L::FAST_ATAN2_MAX_ERROR << ")\n";
+    if (atan2_err > Stop2L::FAST_ATAN2_MAX_ERROR) {
+        cout << "ERROR :: fast_atan2 exceeds its documented error\n";
+        return 1;
+    }
+
+    // Comparison report on random objects, pairing each object with the
+    // next one as the second lepton or the MET
+    cout << "Generating " << n_objects << " objects (seed " << seed << ")\n";
+    vector<Cartesian> objects = make_objects(n_objects, seed);
+    vector<PtEtaPhiM> exact(n_objects), fast(n_objects);
+    double exact_ms = time_ms(objects, exact, Stop2L::make_px_py_pz_e);
+    double fast_ms = time_ms(objects, fast, Stop2L::make_px_py_pz_e_fast);
+    FastMathReport report;
+    for (uint i = 0; i < n_objects; ++i) {
+        uint j = (i + 1) % n_objects;
+        report.fill(FastMathReport::PHI, fast[i].phi, exact[i].phi);
+        report.fill(FastMathReport::ETA, fast[i].eta, exact[i].eta);
+        report.fill(FastMathReport::MT, Stop2L::transverse_mass(fast[i], fast[j]),
+                    Stop2L::transverse_mass(exact[i], exact[j]));
+        report.fill(FastMathReport::DPHI, Stop2L::delta_phi(fast[i], fast[j]),
+                    Stop2L::delta_phi(exact[i], exact[j]));
+        report.fill(FastMathReport::DR, Stop2L::delta_r(fast[i], fast[j]),
+                    Stop2L::delta_r(exact[i], exact[j]));
+    }
+    cout << "Fast minus exact conversion over " << n_objects << " objects\n";
+    report.print("  ");
+
+    cout << "Exact conversion : " << exact_ms << " ms\n";
+    cout << "Fast conversion  : " << fast_ms << " ms\n";
+    if (fast_ms > 0) cout << "Speedup          : " << exact_ms / fast_ms << "x\n";
+    return 0;
+}
@@ -0,0 +1,268 @@
+////////////////////////////////////////////////////////////////////////////////
+/// Copyright (c) <2018> by Alex Armstrong
+///
+/// @file benchKinematics.cxx
+/// @author Alex Armstrong (alarmstr@cern.ch)
+/// @date <December 2018>
+/// @brief Check and time Stop2L::PtEtaPhiM against TLorentzVector
+///
+/// Generates random events, or reads them from a SusyNt input, and computes
+/// the per-event kinematics that SuperflowAnaStop2L takes from
+/// Stop2L::PtEtaPhiM (lepton-MET mT and dPhi, dilepton dEta/dPhi/dR, jet
+/// eta/phi and jet-MET dPhi) both with the TLorentzVector calls they replace
+/// and with the cached type, including the conversion when objects are read
+/// in. Then times both.
+///
+/// Usage: benchKinematics [n_events] [seed]
+///        benchKinematics -i <input> [n_events]
+///
+/// The input is a SusyNt file, directory or file list as for
+/// SuperflowAnaStop2L. Its events are read into memory before timing.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+using std::cout;
+#include <random>
+#include <string>
+using std::string;
+#include <vector>
+using std::vector;
+
+// ROOT
+#include "TChain.h"
+#include "TLorentzVector.h"
+
+// SusyNtuple
+#include "SusyNtuple/ChainHelper.h"
+#include "SusyNtuple/SusyNtObject.h"
+#include "SusyNtuple/SusyNtSys.h"
+
+// LexStop2LAnalysis
+#include "LexStop2LAnalysis/PtEtaPhiM.h"
+
+using Stop2L::PtEtaPhiM;
+
+struct BenchEvent {
+    vector<TLorentzVector> leps;
+    vector<TLorentzVector> jets;
+    double met_et, met_phi;
+};
+
+// Output quantities of one event, filled in the same order by both versions
+struct BenchOutput {
+    void clear() { values.clear(); }
+    vector<double> values;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Reference implementation, written like the analysis before PtEtaPhiM
+////////////////////////////////////////////////////////////////////////////////
+void reference_kinematics(const BenchEvent& evt, BenchOutput& out) {
+    out.clear();
+    TLorentzVector met;
+    met.SetPxPyPzE(evt.met_et * cos(evt.met_phi), evt.met_et * sin(evt.met_phi), 0., evt.met_et);
+    double met_pt = met.Pt();
+    out.values.push_back(met_pt);
+    for (const TLorentzVector& l : evt.leps) {
+        out.values.push_back(l.Pt());
+        out.values.push_back(l.Eta());
+        out.values.push_back(l.Phi());
+        out.values.push_back(l.M());
+        double dphi = l.DeltaPhi(met);
+        out.values.push_back(sqrt(2 * l.Pt() * met_pt * (1 - cos(dphi))));
+        out.values.push_back(fabs(dphi));
+    }
+    if (evt.leps.size() >= 2) {
+        const TLorentzVector& l0 = evt.leps[0];
+        const TLorentzVector& l1 = evt.leps[1];
+        out.values.push_back(fabs(l0.Eta() - l1.Eta()));
+        out.values.push_back(fabs(l0.DeltaPhi(l1)));
+        out.values.push_back(l0.DeltaR(l1));
+    }
+    for (const TLorentzVector& jet : evt.jets) {
+        out.values.push_back(jet.Eta());
+        out.values.push_back(jet.Phi());
+    }
+    for (size_t i = 0; i < std::min<size_t>(2, evt.jets.size()); ++i) {
+        out.values.push_back(evt.jets[i].DeltaPhi(met));
+    }
+}
+void cached_kinematics(const BenchEvent& evt, BenchOutput& out) {
+    out.clear();
+    // Conversion when the objects are read in
+    static vector<PtEtaPhiM> leps, jets;
+    leps.clear();
+    jets.clear();
+    for (const TLorentzVector& l : evt.leps) {
+        leps.push_back(Stop2L::make_px_py_pz_e(l.Px(), l.Py(), l.Pz(), l.E()));
+    }
+    for (const TLorentzVector& jet : evt.jets) {
+        jets.push_back(Stop2L::make_px_py_pz_e(jet.Px(), jet.Py(), jet.Pz(), jet.E()));
+    }
+    PtEtaPhiM met = Stop2L::make_px_py_pz_e(evt.met_et * cos(evt.met_phi),
+                                            evt.met_et * sin(evt.met_phi), 0., evt.met_et);
+
+    out.values.push_back(met.pt);
+    for (const PtEtaPhiM& l : leps) {
+        out.values.push_back(l.pt);
+        out.values.push_back(l.eta);
+        out.values.push_back(l.phi);
+        out.values.push_back(l.m);
+        out.values.push_back(Stop2L::transverse_mass(l, met));
+        out.values.push_back(fabs(Stop2L::delta_phi(l, met)));
+    }
+    if (leps.size() >= 2) {
+        out.values.push_back(fabs(leps[0].eta - leps[1].eta));
+        out.values.push_back(fabs(Stop2L::delta_phi(leps[0], leps[1])));
+        out.values.push_back(Stop2L::delta_r(leps[0], leps[1]));
+    }
+    for (const PtEtaPhiM& jet : jets) {
+        out.values.push_back(jet.eta);
+        out.values.push_back(jet.phi);
+    }
+    for (size_t i = 0; i < std::min<size_t>(2, jets.size()); ++i) {
+        out.values.push_back(Stop2L::delta_phi(jets[i], met));
+    }
+}
+vector<BenchEvent> make_events(uint n_events, uint seed) {
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> n_leps_dist(2, 4);
+    std::uniform_int_distribution<int> n_jets_dist(0, 10);
+    std::exponential_distribution<double> pt_dist(1 / 50.0);
+    std::exponential_distribution<double> met_dist(1 / 80.0);
+    std::uniform_real_distribution<double> eta_dist(-2.8, 2.8);
+    std::uniform_real_distribution<double> phi_dist(-M_PI, M_PI);
+    const double MU_MASS = 0.10566; // GeV
+
+    vector<BenchEvent> events(n_events);
+    for (BenchEvent& evt : events) {
+        int n_leps = n_leps_dist(rng);
+        int n_jets = n_jets_dist(rng);
+        for (int i = 0; i < n_leps + n_jets; ++i) {
+            TLorentzVector tlv;
+            if (i < n_leps) {
+                tlv.SetPtEtaPhiM(10 + pt_dist(rng), eta_dist(rng), phi_dist(rng), MU_MASS);
+                evt.leps.push_back(tlv);
+            } else {
+                tlv.SetPtEtaPhiM(20 + pt_dist(rng), eta_dist(rng), phi_dist(rng), 5.0);
+                evt.jets.push_back(tlv);
+            }
+        }
+        evt.met_et = met_dist(rng);
+        evt.met_phi = phi_dist(rng);
+    }
+    return events;
+}
+vector<BenchEvent> read_events(const string& input, uint n_events) {
+    // All the stored leptons (ordered by pT like the analysis) and jets, which
+    // are the pre-selected objects, and the nominal MET
+    TChain* chain = new TChain("susyNt");
+    ChainHelper::addInput(chain, input, false);
+    Long64_t n_entries = std::min<Long64_t>(n_events, chain->GetEntries());
+    Long64_t entry = 0; // entry in the current tree, read by nt
+    Susy::SusyNtObject nt(entry);
+    int tree_number = -1;
+    vector<BenchEvent> events;
+    events.reserve(n_entries);
+    for (Long64_t ientry = 0; ientry < n_entries; ++ientry) {
+        entry = chain->LoadTree(ientry);
+        if (chain->GetTreeNumber() != tree_number) {
+            tree_number = chain->GetTreeNumber();
+            nt.ReadFrom(chain->GetTree());
+        }
+        BenchEvent evt;
+        for (const Susy::Electron& ele : *nt.ele()) evt.leps.push_back(ele);
+        for (const Susy::Muon& muo : *nt.muo()) evt.leps.push_back(muo);
+        std::sort(evt.leps.begin(), evt.leps.end(), [](const TLorentzVector& a, const TLorentzVector& b) {
+            return a.Pt() > b.Pt();
+        });
+        for (const Susy::Jet& jet : *nt.jet()) evt.jets.push_back(jet);
+        evt.met_et = 0;
+        evt.met_phi = 0;
+        for (const Susy::Met& met : *nt.met()) {
+            if (met.sys != NtSys::NOM) continue;
+            evt.met_et = met.Et;
+            evt.met_phi = met.phi;
+            break;
+        }
+        events.push_back(evt);
+    }
+    delete chain;
+    return events;
+}
+template<typename F>
+double time_ms(const vector<BenchEvent>& events, BenchOutput& out, F kinematics) {
+    double sum = 0; // consumed so the work is not optimized away
+    auto start = std::chrono::steady_clock::now();
+    for (const BenchEvent& evt : events) {
+        kinematics(evt, out);
+        sum += out.values.back();
+    }
+    auto stop = std::chrono::steady_clock::now();
+    if (std::isnan(sum)) cout << "WARNING :: NaN in the outputs\n";
+    return std::chrono::duration<double, std::milli>(stop - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+    vector<BenchEvent> events;
+    if (argc > 2 && string(argv[1]) == "-i") {
+        string input = argv[2];
+        uint n_max = argc > 3 ? std::atoi(argv[3]) : 1000000;
+        cout << "Reading up to " << n_max << " events from " << input << '\n';
+        events = read_events(input, n_max);
+        if (events.empty()) {
+            cout << "ERROR :: No events read from " << input << '\n';
+            return 1;
+        }
+    } else {
+        uint n_generate = argc > 1 ? std::atoi(argv[1]) : 1000000;
+        uint seed = argc > 2 ? std::atoi(argv[2]) : 42;
+        cout << "Generating " << n_generate << " events (seed " << seed << ")\n";
+        events = make_events(n_generate, seed);
+    }
+    uint n_events = events.size();
+
+    // Validate
+    // Everything but the transverse masses must agree exactly. The reference
+    // mT loses precision to 1 - cos(dPhi) for leptons along the MET, which
+    // PtEtaPhiM avoids, so mT agrees to well below a keV.
+    const double MT_TOLERANCE = 1e-6; // GeV
+    BenchOutput ref, cached;
+    uint n_mismatched = 0;
+    double max_mT_diff = 0;
+    for (const BenchEvent& evt : events) {
+        reference_kinematics(evt, ref);
+        cached_kinematics(evt, cached);
+        bool match = ref.values.size() == cached.values.size();
+        for (size_t i = 0; match && i < ref.values.size(); ++i) {
+            // Lepton blocks are (pt, eta, phi, m, mT, dPhiMET) after the MET
+            bool is_mT = i >= 1 && i < 1 + 6 * evt.leps.size() && (i - 1) % 6 == 4;
+            double diff = fabs(ref.values[i] - cached.values[i]);
+            if (is_mT) max_mT_diff = std::max(max_mT_diff, diff);
+            match = is_mT ? diff < MT_TOLERANCE : diff == 0;
+        }
+        if (!match) ++n_mismatched;
+    }
+    if (n_mismatched) {
+        cout << "ERROR :: PtEtaPhiM disagrees with TLorentzVector in "
+             << n_mismatched << " of " << n_events << " events\n";
+        return 1;
+    }
+    cout << "PtEtaPhiM matches TLorentzVector in all events"
+         << " (largest mT difference " << max_mT_diff << " GeV)\n";
+
+    // Time
+    double ref_ms = time_ms(events, ref, reference_kinematics);
+    double cached_ms = time_ms(events, cached, cached_kinematics);
+    cout << "TLorentzVector : " << ref_ms << " ms\n";
+    cout << "PtEtaPhiM      : " << cached_ms << " ms\n";
+    if (cached_ms > 0) cout << "Speedup        : " << ref_ms / cached_ms << "x\n";
+    return 0;
+}
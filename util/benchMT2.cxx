@@ -0,0 +1,172 @@
+////////////////////////////////////////////////////////////////////////////////
+/// Copyright (c) <2018> by Alex Armstrong
+///
+/// @file benchMT2.cxx
+/// @author Alex Armstrong (alarmstr@cern.ch)
+/// @date <December 2018>
+/// @brief Compare and time Stop2L::MT2Solver against kin::getMT2
+///
+/// Generates a reference sample of dilepton events with a fixed seed and
+/// compares the MT2 of the fast solver, at several precisions, with
+/// kin::getMT2 as used for the MT2 branch of SuperflowAnaStop2L. Reports the
+/// largest and mean relative differences and the time per event of
+/// kin::getMT2 and of the scalar and batch interfaces of the solver.
+///
+/// Usage: benchMT2 [n_events] [seed]
+///
+////////////////////////////////////////////////////////////////////////////////
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+using std::cout;
+#include <random>
+#include <vector>
+using std::vector;
+
+// SusyNtuple
+#include "SusyNtuple/SusyDefs.h"
+#include "SusyNtuple/KinematicTools.h"
+
+// LexStop2LAnalysis
+#include "LexStop2LAnalysis/MT2Solver.h"
+
+using Stop2L::MT2Solver;
+
+// Events are kept both as SusyNt objects for kin::getMT2 and as flat
+// transverse momentum arrays for the solver
+struct BenchSample {
+    vector<Susy::Electron> electrons;
+    vector<Susy::Muon> muons;
+    vector<LeptonVector> leptons;
+    vector<Susy::Met> mets;
+    vector<double> p1x, p1y, p2x, p2y, pmx, pmy;
+};
+
+BenchSample make_sample(uint n_events, uint seed) {
+    std::mt19937 rng(seed);
+    std::exponential_distribution<double> pt_dist(1 / 60.0);
+    std::exponential_distribution<double> met_dist(1 / 80.0);
+    std::uniform_real_distribution<double> eta_dist(-2.5, 2.5);
+    std::uniform_real_distribution<double> phi_dist(-M_PI, M_PI);
+    std::bernoulli_distribution isEle_dist(0.5);
+    const double ELE_MASS = 0.000511; // GeV
+    const double MU_MASS = 0.10566; // GeV
+
+    BenchSample sample;
+    // Reserve up front so the lepton pointers stay valid
+    sample.electrons.reserve(2 * n_events);
+    sample.muons.reserve(2 * n_events);
+    sample.leptons.resize(n_events);
+    sample.mets.resize(n_events);
+    for (uint ievt = 0; ievt < n_events; ++ievt) {
+        TLorentzVector lep_p4[2];
+        for (int ilep = 0; ilep < 2; ++ilep) {
+            Susy::Lepton* lep = nullptr;
+            if (isEle_dist(rng)) {
+                sample.electrons.emplace_back();
+                lep = &sample.electrons.back();
+                lep_p4[ilep].SetPtEtaPhiM(10 + pt_dist(rng), eta_dist(rng), phi_dist(rng), ELE_MASS);
+            } else {
+                sample.muons.emplace_back();
+                lep = &sample.muons.back();
+                lep_p4[ilep].SetPtEtaPhiM(10 + pt_dist(rng), eta_dist(rng), phi_dist(rng), MU_MASS);
+            }
+            lep->SetPxPyPzE(lep_p4[ilep].Px(), lep_p4[ilep].Py(), lep_p4[ilep].Pz(), lep_p4[ilep].E());
+            sample.leptons[ievt].push_back(lep);
+        }
+        std::sort(sample.leptons[ievt].begin(), sample.leptons[ievt].end(),
+                  [](const Susy::Lepton* a, const Susy::Lepton* b) { return a->Pt() > b->Pt(); });
+        Susy::Met& met = sample.mets[ievt];
+        met.Et = met_dist(rng);
+        met.phi = phi_dist(rng);
+
+        const Susy::Lepton* l0 = sample.leptons[ievt].at(0);
+        const Susy::Lepton* l1 = sample.leptons[ievt].at(1);
+        sample.p1x.push_back(l0->Px());
+        sample.p1y.push_back(l0->Py());
+        sample.p2x.push_back(l1->Px());
+        sample.p2y.push_back(l1->Py());
+        sample.pmx.push_back(met.Et * std::cos(met.phi));
+        sample.pmy.push_back(met.Et * std::sin(met.phi));
+    }
+    return sample;
+}
+
+template<typename F>
+double time_ns_per_event(uint n_events, F run) {
+    auto start = std::chrono::steady_clock::now();
+    run();
+    auto stop = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(stop - start).count() / n_events;
+}
+
+int main(int argc, char* argv[])
+{
+    uint n_events = argc > 1 ? std::atoi(argv[1]) : 200000;
+    uint seed = argc > 2 ? std::atoi(argv[2]) : 42;
+    if (n_events == 0) {
+        cout << "ERROR :: Number of events must be positive\n";
+        return 1;
+    }
+    cout << "Generating " << n_events << " events (seed " << seed << ")\n";
+    BenchSample sample = make_sample(n_events, seed);
+
+    // Reference
+    vector<double> ref(n_events);
+    double ref_ns = time_ns_per_event(n_events, [&]() {
+        for (uint ievt = 0; ievt < n_events; ++ievt) {
+            ref[ievt] = kin::getMT2(sample.leptons[ievt], sample.mets[ievt]);
+        }
+    });
+    cout << "kin::getMT2 : " << ref_ns << " ns/event\n";
+
+    // Events with MT2 below this are compared in absolute terms [GeV]
+    const double SMALL_MT2 = 1.0;
+    cout << std::setprecision(4);
+    cout << std::setw(10) << "precision" << std::setw(7) << "steps"
+         << std::setw(14) << "max rel diff" << std::setw(15) << "mean rel diff"
+         << std::setw(15) << "max abs diff*" << std::setw(12) << "scalar ns"
+         << std::setw(12) << "batch ns" << std::setw(10) << "speedup" << '\n';
+    vector<double> fast(n_events), batch(n_events);
+    for (double precision : {1e-3, 1e-4, 1e-6, 1e-8}) {
+        MT2Solver solver(precision);
+        double scalar_ns = time_ns_per_event(n_events, [&]() {
+            for (uint ievt = 0; ievt < n_events; ++ievt) {
+                fast[ievt] = solver.mt2(sample.p1x[ievt], sample.p1y[ievt],
+                                        sample.p2x[ievt], sample.p2y[ievt],
+                                        sample.pmx[ievt], sample.pmy[ievt]);
+            }
+        });
+        double batch_ns = time_ns_per_event(n_events, [&]() {
+            solver.mt2(sample.p1x.data(), sample.p1y.data(), sample.p2x.data(), sample.p2y.data(),
+                       sample.pmx.data(), sample.pmy.data(), n_events, batch.data());
+        });
+        if (batch != fast) {
+            cout << "ERROR :: Batch and scalar interfaces disagree at precision " << precision << '\n';
+            return 1;
+        }
+        double max_rel = 0, sum_rel = 0, max_abs_small = 0;
+        uint n_rel = 0;
+        for (uint ievt = 0; ievt < n_events; ++ievt) {
+            double diff = std::fabs(fast[ievt] - ref[ievt]);
+            if (ref[ievt] < SMALL_MT2) {
+                max_abs_small = std::max(max_abs_small, diff);
+                continue;
+            }
+            max_rel = std::max(max_rel, diff / ref[ievt]);
+            sum_rel += diff / ref[ievt];
+            n_rel++;
+        }
+        cout << std::setw(10) << precision << std::setw(7) << solver.n_steps()
+             << std::setw(14) << max_rel << std::setw(15) << (n_rel ? sum_rel / n_rel : 0)
+             << std::setw(15) << max_abs_small << std::setw(12) << scalar_ns
+             << std::setw(12) << batch_ns << std::setw(9) << ref_ns / batch_ns << "x\n";
+    }
+    cout << "* absolute difference [GeV] for events with kin::getMT2 below " << SMALL_MT2 << " GeV\n";
+    return 0;
+}
@@ -0,0 +1,174 @@
+////////////////////////////////////////////////////////////////////////////////
+/// Copyright (c) <2018> by Alex Armstrong
+///
+/// @file benchNearestDistances.cxx
+/// @author Alex Armstrong (alarmstr@cern.ch)
+/// @date <December 2018>
+/// @brief Check and time the lepton nearest-object distance kernel
+///
+/// Generates random events and compares Stop2L::nearest_distances against the
+/// TLorentzVector loops used for the dR/dPhi/dEta branches of
+/// SuperflowAnaStop2L, then times both.
+///
+/// Usage: benchNearestDistances [n_events] [seed]
+///
+////////////////////////////////////////////////////////////////////////////////
+
+// std
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+using std::cout;
+#include <random>
+#include <string>
+using std::string;
+#include <vector>
+using std::vector;
+
+// ROOT
+#include "TLorentzVector.h"
+
+// LexStop2LAnalysis
+#include "LexStop2LAnalysis/NearestDistances.h"
+
+using Stop2L::NearestDistances;
+
+struct BenchEvent {
+    vector<TLorentzVector> leps;
+    vector<TLorentzVector> jets;
+    vector<unsigned char> jet_isB;
+    // flat copies for the kernel
+    vector<double> lep_eta, lep_phi, jet_eta, jet_phi;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Reference implementation, written like the ADD_LEPTON_VARS loops
+////////////////////////////////////////////////////////////////////////////////
+void reference_distances(const BenchEvent& evt, NearestDistances& out) {
+    typedef NearestDistances ND;
+    for (int t = 0; t < ND::N_TARGET; ++t) {
+        out.dR[t].clear();
+        out.dPhi[t].clear();
+        out.dEta[t].clear();
+    }
+    uint n_bjets = 0;
+    for (unsigned char isB : evt.jet_isB) n_bjets += isB;
+    for (uint i = 0; i < evt.leps.size(); ++i) {
+        const TLorentzVector& l = evt.leps[i];
+        double dR = evt.leps.size() ? DBL_MAX : -DBL_MAX;
+        double dPhi = dR, dEta = dR;
+        for (uint j = 0; j < evt.leps.size(); ++j) {
+            if (j == i) continue;
+            const TLorentzVector& l2 = evt.leps[j];
+            float tmp_dR = fabs(l2.DeltaR(l));
+            float tmp_dPhi = fabs(l2.DeltaPhi(l));
+            float tmp_dEta = fabs(l2.Eta() - l.Eta());
+            if (tmp_dR < dR) dR = tmp_dR;
+            if (tmp_dPhi < dPhi) dPhi = tmp_dPhi;
+            if (tmp_dEta < dEta) dEta = tmp_dEta;
+        }
+        out.dR[ND::LEP].push_back(fabs(dR));
+        out.dPhi[ND::LEP].push_back(fabs(dPhi));
+        out.dEta[ND::LEP].push_back(fabs(dEta));
+
+        for (int t : {ND::JET, ND::BJET, ND::NONBJET}) {
+            bool has_jets = t == ND::BJET ? n_bjets > 0 : evt.jets.size() > 0;
+            dR = dPhi = dEta = has_jets ? DBL_MAX : -DBL_MAX;
+            for (uint k = 0; k < evt.jets.size(); ++k) {
+                if (t == ND::BJET && !evt.jet_isB[k]) continue;
+                if (t == ND::NONBJET && evt.jet_isB[k]) continue;
+                const TLorentzVector& jet = evt.jets[k];
+                float tmp_dR = fabs(jet.DeltaR(l));
+                float tmp_dPhi = fabs(jet.DeltaPhi(l));
+                float tmp_dEta = fabs(jet.Eta() - l.Eta());
+                if (tmp_dR < dR) dR = tmp_dR;
+                if (tmp_dPhi < dPhi) dPhi = tmp_dPhi;
+                if (tmp_dEta < dEta) dEta = tmp_dEta;
+            }
+            out.dR[t].push_back(fabs(dR));
+            out.dPhi[t].push_back(fabs(dPhi));
+            out.dEta[t].push_back(fabs(dEta));
+        }
+    }
+}
+void kernel_distances(const BenchEvent& evt, NearestDistances& out) {
+    Stop2L::nearest_distances(evt.lep_eta.data(), evt.lep_phi.data(), evt.lep_eta.size(),
+                              evt.jet_eta.data(), evt.jet_phi.data(),
+                              evt.jet_isB.data(), evt.jet_eta.size(), out);
+}
+vector<BenchEvent> make_events(uint n_events, uint seed) {
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> n_leps_dist(0, 4);
+    std::uniform_int_distribution<int> n_jets_dist(0, 10);
+    std::uniform_real_distribution<double> pt_dist(10, 300);
+    std::uniform_real_distribution<double> eta_dist(-2.8, 2.8);
+    std::uniform_real_distribution<double> phi_dist(-M_PI, M_PI);
+    std::bernoulli_distribution isB_dist(0.2);
+
+    vector<BenchEvent> events(n_events);
+    for (BenchEvent& evt : events) {
+        int n_leps = n_leps_dist(rng);
+        int n_jets = n_jets_dist(rng);
+        for (int i = 0; i < n_leps + n_jets; ++i) {
+            TLorentzVector tlv;
+            tlv.SetPtEtaPhiM(pt_dist(rng), eta_dist(rng), phi_dist(rng), 0);
+            if (i < n_leps) {
+                evt.leps.push_back(tlv);
+                evt.lep_eta.push_back(tlv.Eta());
+                evt.lep_phi.push_back(tlv.Phi());
+            } else {
+                evt.jets.push_back(tlv);
+                evt.jet_eta.push_back(tlv.Eta());
+                evt.jet_phi.push_back(tlv.Phi());
+                evt.jet_isB.push_back(isB_dist(rng));
+            }
+        }
+    }
+    return events;
+}
+template<typename F>
+double time_ms(const vector<BenchEvent>& events, NearestDistances& out, F distances) {
+    auto start = std::chrono::steady_clock::now();
+    for (const BenchEvent& evt : events) distances(evt, out);
+    auto stop = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(stop - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+    uint n_events = argc > 1 ? std::atoi(argv[1]) : 1000000;
+    uint seed = argc > 2 ? std::atoi(argv[2]) : 42;
+    cout << "Generating " << n_events << " events (seed " << seed << ")\n";
+    vector<BenchEvent> events = make_events(n_events, seed);
+
+    // Validate
+    typedef NearestDistances ND;
+    NearestDistances ref, fused;
+    uint n_mismatched = 0;
+    for (const BenchEvent& evt : events) {
+        reference_distances(evt, ref);
+        kernel_distances(evt, fused);
+        for (int t = 0; t < ND::N_TARGET; ++t) {
+            if (ref.dR[t] != fused.dR[t] || ref.dPhi[t] != fused.dPhi[t] || ref.dEta[t] != fused.dEta[t]) {
+                ++n_mismatched;
+                break;
+            }
+        }
+    }
+    if (n_mismatched) {
+        cout << "ERROR :: Kernel disagrees with the reference in "
+             << n_mismatched << " of " << n_events << " events\n";
+        return 1;
+    }
+    cout << "Kernel matches the reference in all events\n";
+
+    // Time
+    double ref_ms = time_ms(events, ref, reference_distances);
+    double fused_ms = time_ms(events, fused, kernel_distances);
+    cout << "Reference : " << ref_ms << " ms\n";
+    cout << "Kernel    : " << fused_ms << " ms\n";
+    if (fused_ms > 0) cout << "Speedup   : " << ref_ms / fused_ms << "x\n";
+    return 0;
+}